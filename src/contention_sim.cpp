@@ -58,9 +58,10 @@ void ContentionSim::SimThreadTrampoline(void* arg) {
     csim->simThreadLoop(thid);
 }
 
-ContentionSim::ContentionSim(uint32_t _numDomains, uint32_t _numSimThreads) {
+ContentionSim::ContentionSim(uint32_t _numDomains, uint32_t _numSimThreads, bool _balanceDomains) {
     numDomains = _numDomains;
     numSimThreads = _numSimThreads;
+    balanceDomains = _balanceDomains;
     threadsDone = 0;
     limit = 0;
     lastLimit = 0;
@@ -73,16 +74,25 @@ ContentionSim::ContentionSim(uint32_t _numDomains, uint32_t _numSimThreads) {
         new (&domains[i].pq) PrioQueue<TimingEvent, PQ_BLOCKS>();
         domains[i].curCycle = 0;
         futex_init(&domains[i].pqLock);
+        domains[i].phaseStartEvents = 0;
     }
 
-    if ((numDomains % numSimThreads) != 0) panic("numDomains(%d) must be a multiple of numSimThreads(%d) for now", numDomains, numSimThreads);
+    if (numSimThreads > numDomains) panic("numSimThreads(%d) must not exceed numDomains(%d)", numSimThreads, numDomains);
+    if (!balanceDomains && (numDomains % numSimThreads) != 0) panic("numDomains(%d) must be a multiple of numSimThreads(%d) unless sim.balanceDomains is set", numDomains, numSimThreads);
 
+    //Static assignment: each thread gets a contiguous range of domains. With
+    //balanceDomains, this is only the first phase's assignment.
     for (uint32_t i = 0; i < numSimThreads; i++) {
         futex_init(&simThreads[i].wakeLock);
         futex_lock(&simThreads[i].wakeLock); //starts locked, so first actual call to lock blocks
-        simThreads[i].firstDomain = i*numDomains/numSimThreads;
-        simThreads[i].supDomain = (i+1)*numDomains/numSimThreads;
+        simThreads[i].doms = gm_calloc<uint32_t>(numDomains);
+        simThreads[i].numDoms = 0;
+        for (uint32_t d = i*numDomains/numSimThreads; d < (i+1)*numDomains/numSimThreads; d++) {
+            simThreads[i].doms[simThreads[i].numDoms++] = d;
+        }
+        simThreads[i].idleNs = 0;
     }
+    domOrder = gm_calloc<uint32_t>(numDomains);
 
     futex_init(&waitLock);
     futex_lock(&waitLock); //wait lock must also start locked
@@ -138,8 +148,24 @@ void ContentionSim::initStats(AggregateStat* parentStat) {
         new (&domains[i].profTime) ClockStat();
         domains[i].profTime.init("time", "Weave simulation time");
         domStat->append(&domains[i].profTime);
+        new (&domains[i].profEvents) Counter();
+        domains[i].profEvents.init("events", "Events simulated");
+        domStat->append(&domains[i].profEvents);
         objStat->append(domStat);
     }
+    for (uint32_t i = 0; i < numSimThreads; i++) {
+        std::stringstream ss;
+        ss << "thread-" << i;
+        AggregateStat* thStat = new AggregateStat();
+        thStat->init(gm_strdup(ss.str().c_str()), "Simulation thread stats");
+        new (&simThreads[i].profBusy) ClockStat();
+        simThreads[i].profBusy.init("busy", "Time simulating domains (ns)");
+        thStat->append(&simThreads[i].profBusy);
+        ProxyStat* idleStat = new ProxyStat();
+        idleStat->init("idle", "Time waiting for other threads at the end of phases (ns)", &simThreads[i].idleNs);
+        thStat->append(idleStat);
+        objStat->append(thStat);
+    }
     parentStat->append(objStat);
 }
 
@@ -157,6 +183,8 @@ void ContentionSim::simulatePhase(uint64_t limit) {
         if (ocore) ocore->cSimStart();
     }
 
+    if (balanceDomains) assignDomains();
+
     inCSim = true;
     __sync_synchronize();
 
@@ -254,6 +282,34 @@ void ContentionSim::enqueueCrossing(CrossingEvent* ev, uint64_t cycle, uint32_t
     }
 }
 
+/* Balances the next phase on the events each domain ran since the last
+ * assignment: longest first, each to the thread with the fewest events so far
+ * (LPT). Domains are still owned by one thread for the whole phase, so a
+ * crossing never waits on a domain that nobody simulates.
+ */
+void ContentionSim::assignDomains() {
+    for (uint32_t i = 0; i < numDomains; i++) domOrder[i] = i;
+    auto events = [this](uint32_t d) { return domains[d].profEvents.get() - domains[d].phaseStartEvents; };
+    std::stable_sort(domOrder, domOrder + numDomains, [&](uint32_t d1, uint32_t d2) { return events(d1) > events(d2); });
+
+    for (uint32_t t = 0; t < numSimThreads; t++) {
+        simThreads[t].numDoms = 0;
+        simThreads[t].load = 0;
+    }
+    for (uint32_t i = 0; i < numDomains; i++) {
+        uint32_t d = domOrder[i];
+        uint32_t best = 0;
+        for (uint32_t t = 1; t < numSimThreads; t++) {
+            const SimThreadData& th = simThreads[t];
+            const SimThreadData& b = simThreads[best];
+            if (th.load < b.load || (th.load == b.load && th.numDoms < b.numDoms)) best = t;
+        }
+        simThreads[best].doms[simThreads[best].numDoms++] = d;
+        simThreads[best].load += events(d);
+        domains[d].phaseStartEvents = domains[d].profEvents.get();
+    }
+}
+
 void ContentionSim::simThreadLoop(uint32_t thid) {
     info("Started contention simulation thread %d", thid);
 #if 0
@@ -278,11 +334,19 @@ void ContentionSim::simThreadLoop(uint32_t thid) {
         }
 
         //info("--- phase start");
+        simThreads[thid].profBusy.start();
         simulatePhaseThread(thid);
+        simThreads[thid].profBusy.end();
+        simThreads[thid].doneNs = getNs();
         //info("--- phase end");
 
         uint32_t val = __sync_add_and_fetch(&threadsDone, 1);
         if (val == numSimThreads) {
+            //Last one out; all other threads have set doneNs
+            uint64_t endNs = getNs();
+            for (uint32_t i = 0; i < numSimThreads; i++) {
+                simThreads[i].idleNs += endNs - MIN(endNs, simThreads[i].doneNs);
+            }
             threadsDone = 0;
             futex_unlock(&waitLock); //unblock caller
         }
@@ -291,17 +355,18 @@ void ContentionSim::simThreadLoop(uint32_t thid) {
 }
 
 void ContentionSim::simulatePhaseThread(uint32_t thid) {
-    uint32_t thDomains = simThreads[thid].supDomain - simThreads[thid].firstDomain;
+    uint32_t thDomains = simThreads[thid].numDoms;
     uint32_t numFinished = 0;
 	//info("thDomains = %d\n", thDomains);
     if (thDomains == 1) {
-        DomainData& domain = domains[simThreads[thid].firstDomain];
+        DomainData& domain = domains[simThreads[thid].doms[0]];
         domain.profTime.start();
         PrioQueue<TimingEvent, PQ_BLOCKS>& pq = domain.pq;
         while (pq.size() && pq.firstCycle() < limit) {
             uint64_t domCycle = domain.curCycle;
             uint64_t cycle;
             TimingEvent* te = pq.dequeue(cycle);
+            domain.profEvents.inc();
 			//info("cycle=%ld, domain=%d, numChild=%d, preDelay=%d, postDelay=%d, minStart=%ld\n",
 			//	cycle, te->getDomain(), te->getNumChildren(), te->getPreDelay(), te->getPostDelay(),
 			//	te->getMinStartCycle());
@@ -354,8 +419,8 @@ void ContentionSim::simulatePhaseThread(uint32_t thid) {
         //info("XXX %d / %d %d %d", thid, thDomains, simThreads[thid].supDomain, simThreads[thid].firstDomain);
 
         std::priority_queue<DomainData*, std::vector<DomainData*>, CompareDomains> domPq;
-        for (uint32_t i = simThreads[thid].firstDomain; i < simThreads[thid].supDomain; i++) {
-            domPq.push(&domains[i]);
+        for (uint32_t i = 0; i < thDomains; i++) {
+            domPq.push(&domains[simThreads[thid].doms[i]]);
         }
 
         std::vector<DomainData*> sq1;
@@ -376,6 +441,7 @@ void ContentionSim::simulatePhaseThread(uint32_t thid) {
                     //info("YYY %d %ld %ld %d", numFinished, domPq.size(), domain->curCycle, domain->prio);
                     uint64_t cycle;
                     TimingEvent* te = pq.dequeue(cycle);
+                    domain->profEvents.inc();
                     //uint64_t nextCycle = pq.size()? pq.firstCycle() : cycle;
                     if (cycle != domain->curCycle) domain->curCycle = cycle;
                     te->run(cycle);
@@ -397,6 +463,7 @@ void ContentionSim::simulatePhaseThread(uint32_t thid) {
                     //info("SSS %d %ld %ld", numFinished, stalledQueue.size(), domain->curCycle);
                     uint64_t cycle;
                     TimingEvent* te = pq.dequeue(cycle);
+                    domain->profEvents.inc();
                     if (cycle != domain->curCycle) domain->curCycle = cycle;
                     te->state = EV_RUNNING;
                     te->simulate(cycle);
@@ -77,6 +77,8 @@ class ContentionSim : public GlobAlloc {
             PAD();
 
             ClockStat profTime;
+            Counter profEvents;
+            uint64_t phaseStartEvents; //profEvents when the last assignment was made
 
 #if PROFILE_CROSSINGS
             VectorCounter profIncomingCrossingSims;
@@ -91,8 +93,13 @@ class ContentionSim : public GlobAlloc {
 
         struct SimThreadData {
             lock_t wakeLock; //used to sleep/wake up simulation thread
-            uint32_t firstDomain;
-            uint32_t supDomain; //supreme, ie first not included
+            uint32_t* doms; //domains simulated this phase
+            uint32_t numDoms;
+            uint64_t load; //used while assigning domains
+
+            ClockStat profBusy;
+            uint64_t idleNs; //waiting for other threads at the end of a phase
+            uint64_t doneNs;
 
             std::vector<std::pair<uint64_t, TimingEvent*> > logVec;
         };
@@ -106,6 +113,8 @@ class ContentionSim : public GlobAlloc {
         uint32_t numDomains;
         uint32_t numSimThreads;
         bool skipContention;
+        bool balanceDomains; //reassign domains to threads every phase
+        uint32_t* domOrder; //scratch for assignDomains()
 
         PAD();
 
@@ -126,7 +135,7 @@ class ContentionSim : public GlobAlloc {
         lock_t postMortemLock;
 
     public:
-        ContentionSim(uint32_t _numDomains, uint32_t _numSimThreads);
+        ContentionSim(uint32_t _numDomains, uint32_t _numSimThreads, bool _balanceDomains);
 
         void initStats(AggregateStat* parentStat);
 
@@ -160,6 +169,7 @@ class ContentionSim : public GlobAlloc {
 #endif
 
     private:
+        void assignDomains();
         void simThreadLoop(uint32_t thid);
         void simulatePhaseThread(uint32_t thid);
 
@@ -30,6 +30,7 @@
 #include "decoder.h"
 #include "g_std/g_string.h"
 #include "stats.h"
+#include "zsim.h"
 
 struct BblInfo {
     uint32_t instrs;
@@ -66,12 +67,24 @@ class Core : public GlobAlloc {
     private:
         uint64_t lastUpdateCycles;
         uint64_t lastUpdateInstrs;
+        uint64_t seenShootdownCycles;
 
     protected:
         g_string name;
 
+        // Stall of the TLB shootdowns since the last call, see zinfo->tlbShootdownCycles
+        inline uint64_t takeShootdownStall() {
+            uint64_t total = zinfo->tlbShootdownCycles;
+            if (likely(total == seenShootdownCycles)) return 0;
+            uint64_t stall = total - seenShootdownCycles;
+            seenShootdownCycles = total;
+            return stall;
+        }
+        // Shootdowns while the core was not running do not stall it
+        void skipShootdowns() { seenShootdownCycles = zinfo->tlbShootdownCycles; }
+
     public:
-        explicit Core(g_string& _name) : lastUpdateCycles(0), lastUpdateInstrs(0), name(_name) {}
+        explicit Core(g_string& _name) : lastUpdateCycles(0), lastUpdateInstrs(0), seenShootdownCycles(0), name(_name) {}
 
         virtual uint64_t getInstrs() const = 0; // typically used to find out termination conditions or dumps
         virtual uint64_t getPhaseCycles() const = 0; // used by RDTSC faking --- we need to know how far along we are in the phase, but not the total number of phases
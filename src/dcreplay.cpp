@@ -0,0 +1,233 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Standalone DRAM cache trace replayer. Drives MemoryController (and its
+ * placement policies and DRAM backends) directly from a memory trace, without
+ * Pin, cores or caches. Accepts the traces written by sys.mem.enableTrace
+ * (mem_trace.bin, see mem_trace.h), the older raw mem-0trace.bin dumps, or
+ * HDF5 access traces written by TracingCache / read by AccessTraceReader.
+ *
+ * Only the bound phase is modeled: no event recorders are created, so DDR
+ * contention (the weave phase) is not simulated and latencies are zero-load.
+ */
+
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sstream>
+#include <string>
+#include "access_tracing.h"
+#include "config.h"
+#include "contention_sim.h"
+#include "dramsim_mem_ctrl.h"
+#include "event_recorder.h"
+#include "galloc.h"
+#include "log.h"
+#include "mc.h"
+#include "mem_trace.h"
+#include "memory_hierarchy.h"
+#include "stats.h"
+#include "zsim.h"
+
+GlobSimInfo* zinfo;
+
+/* The replayer never creates event recorders, so no timing events reach the
+ * weave phase. These definitions only satisfy the linker for the weave-phase
+ * paths of the DRAM models.
+ */
+void ContentionSim::enqueue(TimingEvent* ev, uint64_t cycle) { panic("dcreplay does not model the weave phase"); }
+void ContentionSim::enqueueSynced(TimingEvent* ev, uint64_t cycle) { panic("dcreplay does not model the weave phase"); }
+void ContentionSim::enqueueCrossing(CrossingEvent* ev, uint64_t cycle, uint32_t srcId, uint32_t srcDomain, uint32_t dstDomain, EventRecorder* evRec) {
+    panic("dcreplay does not model the weave phase");
+}
+
+/* Reader for the raw traces older versions of MemoryController dumped. The file starts with a
+ * 32-bit zero, followed by chunks of chunkLen line addresses and chunkLen
+ * 32-bit types (0 = load, 1 = dirty writeback). There are no timestamps.
+ */
+class RawTraceReader {
+    private:
+        static const uint32_t chunkLen = 10000;
+        FILE* f;
+        Address addrs[chunkLen];
+        uint32_t types[chunkLen];
+        uint32_t cur;
+        uint32_t max;
+
+    public:
+        explicit RawTraceReader(const char* fname) : cur(0), max(0) {
+            f = fopen(fname, "rb");
+            if (!f) panic("Could not open trace %s", fname);
+            uint32_t hdr;
+            if (fread(&hdr, sizeof(uint32_t), 1, f) != 1) panic("Trace %s is empty", fname);
+            nextChunk();
+        }
+
+        ~RawTraceReader() { fclose(f); }
+
+        inline bool empty() const { return cur == max; }
+
+        inline void read(Address& lineAddr, AccessType& type) {
+            assert(cur < max);
+            lineAddr = addrs[cur];
+            type = types[cur]? PUTX : GETS;
+            if (unlikely(++cur == max)) nextChunk();
+        }
+
+    private:
+        void nextChunk() {
+            cur = max = 0;
+            size_t n = fread(addrs, sizeof(Address), chunkLen, f);
+            if (n != chunkLen) return;  // partial chunks are never written
+            if (fread(types, sizeof(uint32_t), chunkLen, f) != chunkLen) return;
+            max = chunkLen;
+        }
+};
+
+static bool endsWith(const char* str, const char* suffix) {
+    size_t l = strlen(str), s = strlen(suffix);
+    return l >= s && strcmp(str + l - s, suffix) == 0;
+}
+
+int main(int argc, const char* argv[]) {
+    InitLog("[dcreplay] ");
+    if (argc < 3 || argc > 5) {
+        info("Replays a memory trace through the DRAM cache memory controllers");
+        info("Usage: %s <config> <trace (.h5 or .bin)> [<cycles between old raw trace requests> [<max requests>]]", argv[0]);
+        exit(1);
+    }
+
+    Config config(argv[1]);
+    const char* traceFile = argv[2];
+    uint64_t reqGap = (argc >= 4)? strtoul(argv[3], nullptr, 0) : 10;
+    uint64_t maxReqs = (argc >= 5)? strtoul(argv[4], nullptr, 0) : -1ul;
+
+    uint32_t gmSize = config.get<uint32_t>("sim.gmMBytes", (1<<10));
+    gm_init(((size_t)gmSize) << 20);
+
+    zinfo = gm_calloc<GlobSimInfo>();
+    zinfo->numCores = 1;
+    zinfo->numDomains = 1;
+    zinfo->lineSize = config.get<uint32_t>("sys.lineSize", 64);
+    zinfo->freqMHz = config.get<uint32_t>("sys.frequency", 2000);
+    zinfo->phaseLength = config.get<uint32_t>("sim.phaseLength", 10000);
+    zinfo->contentionSim = nullptr;
+    zinfo->eventRecorders = gm_calloc<EventRecorder*>(zinfo->numCores);  // all nullptr -> bound phase only
+
+    std::string memType = config.get<const char*>("sys.mem.type", "Simple");
+    if (memType != "DramCache") panic("dcreplay needs sys.mem.type = \"DramCache\", got %s", memType.c_str());
+    if (config.get<uint64_t>("sys.mem.mcdram.warmupInstrs", 0)) panic("dcreplay has no instructions, use sys.mem.mcdram.warmupRequests to warm up");
+
+    // Re-tracing converts any input into the current trace format. There is
+    // no writer thread here; producers write full blocks themselves.
+    if (config.get<bool>("sys.mem.enableTrace", false)) {
+        std::string outTrace = std::string(config.get<const char*>("sys.mem.traceDir", "./")) + "/mem_trace.bin";
+        char* inPath = realpath(traceFile, nullptr);
+        char* outPath = realpath(outTrace.c_str(), nullptr);
+        if (inPath && outPath && strcmp(inPath, outPath) == 0) panic("sys.mem.enableTrace would overwrite the input trace %s", traceFile);
+        free(inPath);
+        free(outPath);
+        zinfo->memTraceWriter = new MemTraceWriter(outTrace.c_str());
+    }
+
+    uint32_t memControllers = config.get<uint32_t>("sys.mem.controllers", 1);
+    assert(memControllers > 0);
+    g_vector<MemObject*> mems;
+    mems.resize(memControllers);
+    for (uint32_t i = 0; i < memControllers; i++) {
+        std::stringstream ss;
+        ss << "mem-" << i;
+        g_string name(ss.str().c_str());
+        mems[i] = new MemoryController(name, zinfo->freqMHz, 0, config);
+    }
+
+    // Controller traces hold controller-local addresses; HDF5 traces hold
+    // global line addresses, so split them as init.cpp does
+    bool memTrace = MemTraceReader::isMemTrace(traceFile);
+    bool rawTrace = !memTrace && endsWith(traceFile, ".bin");
+    MemObject* mem = mems[0];
+    if (!memTrace && !rawTrace && memControllers > 1 && config.get<bool>("sys.mem.splitAddrs", true)) {
+        mem = new SplitAddrMemory(mems, "mem-splitter", config);
+    }
+
+    AggregateStat* rootStat = new AggregateStat();
+    rootStat->init("root", "Stats");
+    for (uint32_t i = 0; i < memControllers; i++) mems[i]->initStats(rootStat);
+    rootStat->makeImmutable();
+    const char* statsFile = config.get<const char*>("sim.replayStats", "dcreplay.out");
+    StatsBackend* statsBackend = new TextBackend(statsFile, rootStat);
+    config.writeAndClose("dcreplay.cfg", false);
+
+    uint64_t numReqs = 0;
+    uint64_t numLoads = 0;
+    uint64_t totalLat = 0;
+    uint64_t curCycle = 0;
+    auto replay = [&](MemObject* target, Address lineAddr, AccessType type, uint64_t cycle, uint32_t childId) {
+        MESIState state = I;
+        MemReq req = {lineAddr, type, childId, &state, cycle, nullptr, I, 0 /*srcId*/, 0};
+        uint64_t respCycle = target->access(req);
+        if (IsGet(type)) {
+            totalLat += respCycle - cycle;
+            numLoads++;
+        }
+        zinfo->numPhases = cycle / zinfo->phaseLength;  // MD1 updates its load per phase
+        numReqs++;
+    };
+
+    if (memTrace) {
+        MemTraceReader tr(traceFile);
+        while (!tr.empty() && numReqs < maxReqs) {
+            MemTraceRecord rec = tr.read();
+            if (rec.ctrl >= memControllers) panic("Trace has requests for controller %d, config has %d", rec.ctrl, memControllers);
+            replay(mems[rec.ctrl], rec.lineAddr, rec.write? PUTX : GETS, rec.cycle, 0);
+            curCycle = std::max(curCycle, rec.cycle);
+        }
+    } else if (rawTrace) {
+        RawTraceReader tr(traceFile);
+        while (!tr.empty() && numReqs < maxReqs) {
+            Address lineAddr;
+            AccessType type;
+            tr.read(lineAddr, type);
+            replay(mem, lineAddr, type, curCycle, 0);
+            curCycle += reqGap;
+        }
+    } else {
+        AccessTraceReader tr(traceFile);
+        while (!tr.empty() && numReqs < maxReqs) {
+            AccessRecord acc = tr.read();
+            replay(mem, acc.lineAddr, acc.type, acc.reqCycle, acc.childId);
+            curCycle = acc.reqCycle;
+        }
+    }
+
+    statsBackend->dump(false);
+    if (zinfo->memTraceWriter) zinfo->memTraceWriter->finish();
+    // Controllers that never ended warmup save their checkpoint now
+    for (uint32_t i = 0; i < memControllers; i++) ((MemoryController*)mems[i])->saveCheckpoint();
+    info("Replayed %ld requests, %ld cycles, avg load latency %.2f cycles, stats in %s",
+            numReqs, curCycle, numLoads? ((double)totalLat)/numLoads : 0.0, statsFile);
+    return 0;
+}
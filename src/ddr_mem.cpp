@@ -159,6 +159,7 @@ DDRMemory::DDRMemory(uint32_t _lineSize, uint32_t _colSize, uint32_t _ranksPerCh
       controllerSysLatency(_controllerSysLatency), queueDepth(_queueDepth), rowHitLimit(_rowHitLimit),
       deferredWrites(_deferredWrites), closedPage(_closedPage), domain(_domain), name(_name)
 {
+    maxBulkRequests = 1;
     sysFreqKHz = 1000 * _sysFreqMHz;
     initTech(tech, time_scale);  // sets all tXX and memFreqKHz
 	tBL = _tBL;
@@ -220,8 +221,8 @@ DDRMemory::DDRMemory(uint32_t _lineSize, uint32_t _colSize, uint32_t _ranksPerCh
             name.c_str(), addrMapping, 63, rowShift, ilog2(colMask << colShift), colShift,
             ilog2(rankMask << rankShift), rankShift, ilog2(bankMask << bankShift), bankShift);
 
-    // Weave phase events
-    new RefreshEvent(this, memToSysCycle(tREFI), domain);
+    // Weave phase events (standalone users such as dcreplay have no weave phase)
+    if (zinfo->contentionSim) new RefreshEvent(this, memToSysCycle(tREFI), domain);
 
     nextSchedCycle = -1ul;
     nextSchedEvent = nullptr;
@@ -266,41 +267,70 @@ uint64_t DDRMemory::access(MemReq& req, int type, uint32_t data_size) {
         return req.cycle; //must return an absolute value, 0 latency
     } else {
         bool isWrite = (req.type == PUTX);
-		// TODO If length > 1 cacheline, add 4 cycle for each cacheline
-        uint64_t respCycle = req.cycle + (isWrite? minWrLatency : minRdLatency) + memToSysCycle(data_size - 1);
-        if (zinfo->eventRecorders[req.srcId]) {
-			// accessing multiple lines is modeled as multiple requests.
-			// All the requests can be processed in parallel.
-			//  
-            DDRMemoryAccEvent* memEv = new (zinfo->eventRecorders[req.srcId]) DDRMemoryAccEvent(this,
-                    isWrite, req.lineAddr, data_size, domain, preDelay, isWrite? postDelayWr : postDelayRd);
-			if (type == 0) // default. The only record. 
-            {
-            	memEv->setMinStartCycle(req.cycle);
-				TimingRecord tr = {req.lineAddr, req.cycle, respCycle, req.type, memEv, memEv};
-				assert(!zinfo->eventRecorders[req.srcId]->hasRecord());
-           	 	zinfo->eventRecorders[req.srcId]->pushRecord(tr);
-			} else if (type == 1) { // append the current event to the end of the previous one
-           	 	TimingRecord tr = zinfo->eventRecorders[req.srcId]->popRecord();
-            	memEv->setMinStartCycle(tr.reqCycle);
-				assert(tr.endEvent);
-				tr.endEvent->addChild(memEv, zinfo->eventRecorders[req.srcId]);
-				// XXX when to update respCycle 
-				//tr.respCycle = respCycle;
-				tr.type = req.type;
-				tr.endEvent = memEv;
-           	 	zinfo->eventRecorders[req.srcId]->pushRecord(tr);
-			} else if (type == 2) { 
-				// append the current event to the end of the previous one
-				// but the current event is not on the critical path
-           	 	TimingRecord tr = zinfo->eventRecorders[req.srcId]->popRecord();
-            	memEv->setMinStartCycle(tr.reqCycle);
-				assert(tr.endEvent);
-				tr.endEvent->addChild(memEv, zinfo->eventRecorders[req.srcId]);
-				//tr.respCycle = respCycle;
-				tr.type = req.type;
-           	 	zinfo->eventRecorders[req.srcId]->pushRecord(tr);
-			}
+        // Bulk accesses return the demanded line first
+        uint32_t lines = data_size / 4;
+        bool bulk = lines > 1 && data_size % 4 == 0 && maxBulkRequests > 1;
+        uint32_t critSize = bulk? 4 : data_size;
+        uint64_t respCycle = req.cycle + (isWrite? minWrLatency : minRdLatency) + memToSysCycle(critSize - 1);
+        EventRecorder* evRec = zinfo->eventRecorders[req.srcId];
+        if (evRec) {
+            uint32_t numReqs = bulk? std::min(lines, maxBulkRequests) : 1;
+            uint32_t reqLines = bulk? (lines + numReqs - 1) / numReqs : 0;
+            numReqs = bulk? (lines + reqLines - 1) / reqLines : 1;
+            Address blockBase = ((lines & (lines - 1)) == 0)? req.lineAddr & ~((Address)lines - 1) : req.lineAddr;
+            auto newEvent = [&](uint32_t i) {
+                uint32_t size = data_size;
+                Address addr = req.lineAddr;
+                if (bulk) {
+                    uint32_t first = i * reqLines;
+                    size = 4 * (std::min(first + reqLines, lines) - first);
+                    addr = blockBase + (req.lineAddr - blockBase + first) % lines;
+                }
+                return new (evRec) DDRMemoryAccEvent(this, isWrite, addr, size, domain, preDelay, isWrite? postDelayWr : postDelayRd);
+            };
+
+            // The first sub-request carries the demanded line
+            DDRMemoryAccEvent* memEv = newEvent(0);
+            TimingRecord tr;
+            TimingEvent* parent;
+			if (type == 0) { // default. The only record.
+                memEv->setMinStartCycle(req.cycle);
+                parent = memEv;
+                if (numReqs > 1) {
+                    // Sub-requests start together, as when chained off another access
+                    parent = new (evRec) DelayEvent(0);
+                    parent->setMinStartCycle(req.cycle);
+                    parent->addChild(memEv, evRec);
+                }
+                tr = {req.lineAddr, req.cycle, respCycle, req.type, parent, memEv};
+                assert(!evRec->hasRecord());
+			} else {
+                tr = evRec->popRecord();
+                assert(tr.endEvent);
+                memEv->setMinStartCycle(tr.reqCycle);
+                parent = (type == 3 && tr.offPathEvent)? tr.offPathEvent : tr.endEvent;
+                parent->addChild(memEv, evRec);
+                // XXX when to update respCycle
+                //tr.respCycle = respCycle;
+                tr.type = req.type;
+                if (type == 1) tr.endEvent = memEv;  // append to the critical path
+                else assert(type == 2 || type == 3);  // not on the critical path
+            }
+
+            // The chain continues when the whole access is done
+            TimingEvent* doneEv = memEv;
+            if (numReqs > 1) {
+                doneEv = new (evRec) DelayEvent(0);
+                memEv->addChild(doneEv, evRec);
+                for (uint32_t i = 1; i < numReqs; i++) {
+                    DDRMemoryAccEvent* ev = newEvent(i);
+                    ev->setMinStartCycle(memEv->getMinStartCycle());
+                    parent->addChild(ev, evRec);
+                    ev->addChild(doneEv, evRec);
+                }
+            }
+            tr.offPathEvent = doneEv;
+            evRec->pushRecord(tr);
         }
         //info("Access to %lx at %ld, %ld latency", req.lineAddr, req.cycle, minLatency);
         return respCycle;
@@ -327,6 +357,15 @@ DDRMemory::AddrLoc DDRMemory::mapLineAddr(Address lineAddr) {
     return l;
 }
 
+Address DDRMemory::rowLineAddr(uint64_t rowId, uint32_t col) const {
+    assert(col <= colMask);
+    Address bank = rowId % banksPerRank;
+    rowId /= banksPerRank;
+    Address rank = rowId % ranksPerChannel;
+    rowId /= ranksPerChannel;
+    return (rowId << rowShift) | (rank << rankShift) | (bank << bankShift) | (((Address)col) << colShift);
+}
+
 void DDRMemory::enqueue(DDRMemoryAccEvent* ev, uint64_t sysCycle) {
     uint64_t memCycle = sysToMemCycle(sysCycle);
     DEBUG("%ld: enqueue() addr 0x%lx wr %d", memCycle, ev->getAddr(), ev->isWrite());
@@ -210,6 +210,8 @@ class DDRMemory : public MemObject {
         uint32_t tRFC;   // Refresh to ACT (refresh leaves rows closed)
         uint32_t tREFI;  // Refresh interval
 
+        uint32_t maxBulkRequests;  // 1 -> bulk accesses are a single request
+
         // Address mapping information
         uint32_t colShift, colMask;
         uint32_t rankShift, rankMask;
@@ -270,10 +272,27 @@ class DDRMemory : public MemObject {
 
         // Bound phase interface
 		// data_size is the number of bursts with burst length = 16 bytes.
-		// A cacheline takes 4 bursts
+		// A cacheline takes 4 bursts.
+		// type 0: the first access of the request
+		// type 1: on the critical path, after the previous access
+		// type 2: off the critical path, starts a chain off the previous critical access
+		// type 3: off the critical path, after the last access of the chain
+		// A bulk access (several whole lines) is split into up to
+		// maxBulkRequests sub-requests to consecutive lines, which spread over
+		// banks and contend with other traffic. All sub-requests start
+		// together, whatever the type, and the access is done when all are.
+		// The demanded line (lineAddr) is issued first and is what a critical
+		// access waits for; the rest wrap around within the aligned block.
         uint64_t access(MemReq& req, int type, uint32_t data_size = 4);
+        void setMaxBulkRequests(uint32_t n) { maxBulkRequests = n; }
         uint64_t access(MemReq& req) { return access(req, 0, 4); };
 
+        // Inverse of the address mapping, for users that place data by DRAM row
+        // (e.g., the DRAM cache layout in MemoryController). Consecutive row ids
+        // go to different banks, then ranks.
+        uint32_t getRowLines() const { return colMask + 1; }
+        Address rowLineAddr(uint64_t rowId, uint32_t col) const;
+
         // Weave phase interface
         void enqueue(DDRMemoryAccEvent* ev, uint64_t cycle);
         void refresh(uint64_t sysCycle);
@@ -143,13 +143,15 @@ uint64_t DRAMSimMemory::access(MemReq& req, int type, uint32_t data_size) {
 				tr.endEvent = ev;
 			}	
        	 	zinfo->eventRecorders[req.srcId]->pushRecord(tr);
-		} else if (type == 2) { 
+		} else if (type == 2 || type == 3) { 
 			// append the current event to the end of the previous one
-			// but the current event is not on the critical path
+			// but the current event is not on the critical path.
+			// type 3 continues the last off-critical-path chain instead.
        	 	TimingRecord tr = zinfo->eventRecorders[req.srcId]->popRecord();
            	memEv->setMinStartCycle(tr.reqCycle);
 			assert(tr.endEvent);
-			tr.endEvent->addChild(memEv, zinfo->eventRecorders[req.srcId]);
+			TimingEvent * parent = (type == 3 && tr.offPathEvent)? tr.offPathEvent : tr.endEvent;
+			parent->addChild(memEv, zinfo->eventRecorders[req.srcId]);
 			DRAMSimAccEvent * last_ev = memEv;
 			for (uint32_t i = 1; data_size > i * 4; i++) {
         		DRAMSimAccEvent* ev = new (zinfo->eventRecorders[req.srcId]) DRAMSimAccEvent(this, isWrite, addr + 64 * i, domain);
@@ -163,6 +165,7 @@ uint64_t DRAMSimMemory::access(MemReq& req, int type, uint32_t data_size) {
 			}
 			//tr.respCycle = respCycle;
 			tr.type = req.type;
+			tr.offPathEvent = last_ev;
        	 	zinfo->eventRecorders[req.srcId]->pushRecord(tr);
 		}
 
@@ -43,6 +43,9 @@ public:
     AccessType type;
     TimingEvent* startEvent;
     TimingEvent* endEvent;
+    // Last event of the current off-critical-path chain (memory access type
+    // 3 appends to it, see DDRMemory::access); nullptr if none
+    TimingEvent* offPathEvent;
 
     bool isValid() const { return startEvent; }
     void clear() { startEvent = nullptr; }
@@ -29,10 +29,9 @@
 #include "bithacks.h"
 #include "cache.h"
 #include "galloc.h"
+#include "page_allocator.h"
 #include "zsim.h"
-#include "g_std/g_unordered_map.h"
-#include "g_std/g_unordered_set.h"
-#include "config.h"
+
 /* Extends Cache with an L0 direct-mapped cache, optimized to hell for hits
  *
  * L1 lookups are dominated by several kinds of overhead (grab the cache locks,
@@ -49,8 +48,9 @@ class FilterCache : public Cache {
             volatile Address rdAddr;
             volatile Address wrAddr;
             volatile uint64_t availCycle;
+            volatile Address pAddr;  // physical line of rdAddr, matched by invalidations
 
-            void clear() {wrAddr = 0; rdAddr = 0; availCycle = 0;}
+            void clear() {wrAddr = 0; rdAddr = 0; availCycle = 0; pAddr = -1L;}
         };
 
         //Replicates the most accessed line of each set in the cache
@@ -62,14 +62,17 @@ class FilterCache : public Cache {
 
         lock_t filterLock;
         uint64_t fGETSHit, fGETXHit;
-		// this is not an accurate tlb. It just randomize the page nums
-		bool _enable_tlb;
-		drand48_data _buffer;
-		g_unordered_map <Address, Address> _tlb;
-		g_unordered_set <Address> _exist_pgnum;
+
+        // Shared page allocator (sim.enableTLB), or nullptr to use virtual
+        // addresses. Translation keeps a line's offset within its page, so an
+        // invalidated physical line can only be in the sets that share that
+        // offset, idxStride apart.
+        PageAllocator* pageAlloc;
+        uint32_t idxStride;
+
     public:
         FilterCache(uint32_t _numSets, uint32_t _numLines, CC* _cc, CacheArray* _array,
-                ReplPolicy* _rp, uint32_t _accLat, uint32_t _invLat, g_string& _name, Config &config,g_string _cacheType)
+                ReplPolicy* _rp, uint32_t _accLat, uint32_t _invLat, g_string& _name, g_string _cacheType)
             : Cache(_numLines, _cc, _array, _rp, _accLat, _invLat, _name, _cacheType)
         {
             numSets = _numSets;
@@ -80,8 +83,8 @@ class FilterCache : public Cache {
             fGETSHit = fGETXHit = 0;
             srcId = -1;
             reqFlags = 0;
-			_enable_tlb = config.get<bool>("sim.enableTLB", false);
-			srand48_r((uint64_t)this, &_buffer);
+            pageAlloc = zinfo->pageAllocator;
+            idxStride = pageAlloc? MIN(numSets, 64u) : numSets;  // 64 lines per 4 KB page
         }
 
         void setSourceId(uint32_t id) {
@@ -134,25 +137,8 @@ class FilterCache : public Cache {
         }
 
         uint64_t replace(Address vLineAddr, uint32_t idx, bool isLoad, uint64_t curCycle) {
-			Address pLineAddr;
-			// page num = vLineAddr shifted by 6 bits. So it is shifted by 12 bits in total (4KB page size)
-			if (_enable_tlb) {
-				Address vpgnum = vLineAddr >> 6;
-				uint64_t pgnum;
-        	    futex_lock(&filterLock);
-				if (_tlb.find(vpgnum) == _tlb.end()) {
-					do {
-						int64_t rand;
-						lrand48_r(&_buffer, &rand);
-						pgnum = rand & 0x000fffffffffffff;
-					} while (_exist_pgnum.find(pgnum) != _exist_pgnum.end());
-					_tlb[vpgnum] = pgnum;
-					_exist_pgnum.insert( pgnum );
-				} else
-					pgnum = _tlb[vpgnum];
-				pLineAddr = procMask | (pgnum << 6) | (vLineAddr & 0x3f);
-			} else
-            	pLineAddr = procMask | vLineAddr;
+            Address pLineAddr = pageAlloc? pageAlloc->translate(procIdx, vLineAddr, srcId) : procMask | vLineAddr;
+            futex_lock(&filterLock);
             MESIState dummyState = MESIState::I;
             MemReq req = {pLineAddr, isLoad? GETS : GETX, 0, &dummyState, curCycle, &filterLock, dummyState, srcId, reqFlags};
             uint64_t respCycle  = access(req);
@@ -163,6 +149,7 @@ class FilterCache : public Cache {
             Address oldAddr = filterArray[idx].rdAddr;
             filterArray[idx].wrAddr = isLoad? -1L : vLineAddr;
             filterArray[idx].rdAddr = vLineAddr;
+            filterArray[idx].pAddr = pLineAddr;
 
             //For LSU simulation purposes, loads bypass stores even to the same line if there is no conflict,
             //(e.g., st to x, ld from x+8) and we implement store-load forwarding at the core.
@@ -173,13 +160,27 @@ class FilterCache : public Cache {
             return respCycle;
         }
 
+        // Page walk read of a physical line (see TLBHierarchy). Bypasses the
+        // filter array, which holds virtual lines.
+        uint64_t walk(Address pLineAddr, uint64_t curCycle) {
+            futex_lock(&filterLock);
+            MESIState dummyState = MESIState::I;
+            MemReq req = {pLineAddr, GETS, 0, &dummyState, curCycle, &filterLock, dummyState, srcId, reqFlags};
+            uint64_t respCycle = access(req);
+            futex_unlock(&filterLock);
+            return respCycle;
+        }
+
         uint64_t invalidate(const InvReq& req) {
             Cache::startInvalidate();  // grabs cache's downLock
             futex_lock(&filterLock);
-            uint32_t idx = req.lineAddr & setMask; //works because of how virtual<->physical is done...
-            if ((filterArray[idx].rdAddr | procMask) == req.lineAddr) { //FIXME: If another process calls invalidate(), procMask will not match even though we may be doing a capacity-induced invalidation!
-                filterArray[idx].wrAddr = -1L;
-                filterArray[idx].rdAddr = -1L;
+            for (uint32_t idx = req.lineAddr & (idxStride - 1); idx < numSets; idx += idxStride) {
+                if (filterArray[idx].pAddr == req.lineAddr) {
+                    filterArray[idx].wrAddr = -1L;
+                    filterArray[idx].rdAddr = -1L;
+                    filterArray[idx].pAddr = -1L;
+                    break;
+                }
             }
             uint64_t respCycle = Cache::finishInvalidate(req); // releases cache's downLock
             futex_unlock(&filterLock);
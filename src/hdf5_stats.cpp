@@ -37,6 +37,7 @@
 #include "galloc.h"
 #include "log.h"
 #include "stats.h"
+#include "stats_plan.h"
 #include "zsim.h"
 
 /** Implements the HDF5 backend. Creates one big table in the file, and writes one row per dump.
@@ -51,8 +52,9 @@ class HDF5BackendImpl : public GlobAlloc {
         bool skipVectors;
         bool sumRegularAggregates;
 
+        StatDumpPlan* plan; //compiled once, see stats_plan.h
+
         uint64_t* dataBuf; //buffered record data
-        uint64_t* curPtr; //points to next element to write in dump
         uint64_t recordSize; // in bytes
         uint32_t recordsPerWrite; //how many records to buffer; determines chunk size as well
 
@@ -63,41 +65,6 @@ class HDF5BackendImpl : public GlobAlloc {
             return skipVectors && dynamic_cast<VectorStat*>(s);
         }
 
-        // Dump the stats, inorder walk
-        void dumpWalk(Stat* s) {
-            if (skipStat(s)) return;
-            if (AggregateStat* as = dynamic_cast<AggregateStat*>(s)) {
-                if (as->isRegular() && sumRegularAggregates) {
-                    //Dump first record
-                    uint64_t* startPtr = curPtr;
-                    dumpWalk(as->get(0));
-                    uint64_t* tmpPtr = curPtr;
-                    uint32_t sz = tmpPtr - startPtr;
-                    //Dump others below, and add them up
-                    for (uint32_t i = 1; i < as->size(); i++) {
-                        dumpWalk(as->get(i));
-                        //Add record with previous ones
-                        assert(curPtr == tmpPtr + sz);
-                        for (uint32_t j = 0; j < sz; j++) startPtr[j] += tmpPtr[j];
-                        //Rewind
-                        curPtr = tmpPtr;
-                    }
-                } else {
-                    for (uint32_t i = 0; i < as->size(); i++) {
-                        dumpWalk(as->get(i));
-                    }
-                }
-            } else if (ScalarStat* ss = dynamic_cast<ScalarStat*>(s)) {
-                *(curPtr++) = ss->get();
-            } else if (VectorStat* vs = dynamic_cast<VectorStat*>(s)) {
-                for (uint32_t i = 0; i < vs->size(); i++) {
-                    *(curPtr++) = vs->count(i);
-                }
-            } else {
-                panic("Unrecognized stat type");
-            }
-        }
-
         //Note this is a local vector, b/c it's only used at initialization.
         std::vector<hid_t> uniqueTypes;
 
@@ -218,10 +185,11 @@ class HDF5BackendImpl : public GlobAlloc {
                     nullptr, 9 /*compression*/, nullptr);
             assert(hErrVal == 0);
 
+            plan = new StatDumpPlan(rootStat, skipVectors, sumRegularAggregates);
+            assert_msg(plan->size()*sizeof(uint64_t) == recordSize, "HDF5 (%s): dump plan has %d words, record has %ld bytes", filename, plan->size(), recordSize);
+
             size_t bufSize = recordsPerWrite*recordSize;
-            if (sumRegularAggregates) bufSize += recordSize; //conservatively add space for a record. See dumpWalk(), we bleed into the buffer a bit when dumping a regular aggregate.
             dataBuf = static_cast<uint64_t*>(gm_malloc(bufSize));
-            curPtr = dataBuf;
 
             bufferedRecords = 0;
 
@@ -233,11 +201,9 @@ class HDF5BackendImpl : public GlobAlloc {
 
         void dump(bool buffered) {
             // Copy stats to data buffer
-            dumpWalk(rootStat);
+            plan->dump(dataBuf + bufferedRecords*plan->size());
             bufferedRecords++;
 
-            assert_msg(dataBuf + bufferedRecords*recordSize/sizeof(uint64_t) == curPtr, "HDF5 (%s): %p + %d * %ld / %ld != %p", filename, dataBuf, bufferedRecords, recordSize, sizeof(uint64_t), curPtr);
-
             // Write to table if needed
             if (bufferedRecords == recordsPerWrite || !buffered) {
                 hid_t fileID = H5Fopen(filename, H5F_ACC_RDWR, H5P_DEFAULT);
@@ -249,7 +215,6 @@ class HDF5BackendImpl : public GlobAlloc {
 
                 //Rewind
                 bufferedRecords = 0;
-                curPtr = dataBuf;
             }
         }
 };
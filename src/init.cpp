@@ -50,7 +50,9 @@
 #include "locks.h"
 #include "log.h"
 #include "mem_ctrls.h"
+#include "mem_trace.h"
 #include "network.h"
+#include "page_allocator.h"
 #include "null_core.h"
 #include "ooo_core.h"
 #include "part_repl_policies.h"
@@ -68,12 +70,14 @@
 #include "str.h"
 #include "timing_cache.h"
 #include "timing_core.h"
+#include "tlb.h"
 #include "timing_event.h"
 #include "trace_driver.h"
 #include "tracing_cache.h"
 #include "virt/port_virtualizer.h"
 #include "weave_md1_mem.h" //validation, could be taken out...
 #include "mc.h"
+#include "os_placement.h"
 #include "zsim.h"
 
 extern void EndOfPhaseActions(); //in zsim.cpp
@@ -314,7 +318,7 @@ BaseCache* BuildCacheBank(Config& config, const string& prefix, g_string& name,
         //Filter cache optimization
         if (type != "Simple") panic("Terminal cache %s can only have type == Simple", name.c_str());
         if (arrayType != "SetAssoc" || hashType != "None" || replType != "LRU") panic("Invalid FilterCache config %s", name.c_str());
-        cache = new FilterCache(numSets, numLines, cc, array, rp, accLat, invLat, name, config, g_type);
+        cache = new FilterCache(numSets, numLines, cc, array, rp, accLat, invLat, name, g_type);
     }
 
 #if 0
@@ -482,6 +486,11 @@ static void InitSystem(Config& config) {
      */
 
     //Build the memory controllers
+    if (config.get<bool>("sys.mem.enableTrace", false)) {
+        string traceDir = config.get<const char*>("sys.mem.traceDir", "./");
+        zinfo->memTraceWriter = new MemTraceWriter((traceDir + "/mem_trace.bin").c_str());
+        PIN_SpawnInternalThread(MemTraceWriter::WriterThreadTrampoline, zinfo->memTraceWriter, 64*1024, nullptr);
+    }
     uint32_t memControllers = config.get<uint32_t>("sys.mem.controllers", 1);
     assert(memControllers > 0);
 
@@ -495,7 +504,17 @@ static void InitSystem(Config& config) {
         //uint32_t domain = nextDomain(); //i*zinfo->numDomains/memControllers;
         uint32_t domain = i*zinfo->numDomains/memControllers;
         mems[i] = BuildMemoryController(config, zinfo->lineSize, zinfo->freqMHz, domain, name);
-		info("mems[%d] is :%p, tlb is %p", i, mems[i], dynamic_cast<MemoryController *>(mems[i])->getTLB());
+		info("mems[%d] is :%p", i, mems[i]);
+    }
+
+    // Helpers for the HMA hot page selection
+    for (MemObject* mem : mems) {
+        MemoryController* mc = dynamic_cast<MemoryController*>(mem);
+        OSPlacementPolicy* osPolicy = mc? mc->getOSPlacementPolicy() : nullptr;
+        if (!osPolicy) continue;
+        for (uint32_t i = 0; i < osPolicy->getNumHelpers(); i++) {
+            PIN_SpawnInternalThread(OSPlacementPolicy::HelperThreadTrampoline, osPolicy, 1024*1024, nullptr);
+        }
     }
 
     if (memControllers > 1) {
@@ -507,6 +526,41 @@ static void InitSystem(Config& config) {
         }
     }
 
+    // Physical pages for the L1s; must exist before the caches are built
+    zinfo->pageAllocator = nullptr;
+    if (config.get<bool>("sim.enableTLB", false)) {
+        zinfo->pageAllocator = new PageAllocator(config);
+        zinfo->pageAllocator->initStats(zinfo->rootStat);
+    }
+
+    // DRAM cache warmup. Instruction-based warmup ends on the phase the
+    // aggregate instruction count reaches the target.
+    uint64_t dcWarmupInstrs = config.get<uint64_t>("sys.mem.mcdram.warmupInstrs", 0);
+    zinfo->dcWarmupInstrsDone = false;
+    if (dcWarmupInstrs) {
+        if (zinfo->traceDriven) panic("sys.mem.mcdram.warmupInstrs needs cores; use warmupRequests in trace-driven runs");
+        auto getInstrs = []() {
+            uint64_t instrs = 0;
+            for (uint32_t i = 0; i < zinfo->numCores; i++) instrs += zinfo->cores[i]->getInstrs();
+            return instrs;
+        };
+        auto endWarmup = []() {
+            info("DRAM cache warmup instructions reached");
+            zinfo->dcWarmupInstrsDone = true;
+        };
+        zinfo->eventQueue->insert(makeAdaptiveEvent(getInstrs, endWarmup, 0, dcWarmupInstrs, MAX_IPC*zinfo->phaseLength*zinfo->numCores));
+    }
+
+    zinfo->ffWarmupMem = nullptr;
+    if (config.get<bool>("sys.mem.mcdram.ffWarmup", false)) {
+        if (string(config.get<const char*>("sys.mem.type", "Simple")) != "DramCache") panic("sys.mem.mcdram.ffWarmup needs sys.mem.type = \"DramCache\"");
+        if (zinfo->ffReinstrument) panic("sys.mem.mcdram.ffWarmup needs memory accesses instrumented during fast-forward, disable sim.ffReinstrument");
+        uint32_t filterKB = config.get<uint32_t>("sys.mem.mcdram.ffWarmupFilterKB", 1024);
+        zinfo->ffWarmupFilterLines = filterKB*1024/zinfo->lineSize;
+        if (!isPow2(zinfo->ffWarmupFilterLines)) panic("sys.mem.mcdram.ffWarmupFilterKB must be a power of 2");
+        zinfo->ffWarmupMem = mems[0];
+    }
+
     // Build the caches
     vector<const char*> cacheGroupNames;
     config.subgroups("sys.caches", cacheGroupNames);
@@ -653,8 +707,7 @@ static void InitSystem(Config& config) {
                     if( temp_bank->DramCacheAware())
                     {
                         //info("setTLB for %s, line = %d", bank_name.c_str(), __LINE__);
-                        temp_bank->setMems(mems[0]);
-                        temp_bank->setMemCtrls(memControllers);
+                        temp_bank->setDramCaches(mems[0]);
                         //info("setTLB for %s, line = %d", bank_name.c_str(), __LINE__);
                     }
                 }
@@ -718,6 +771,9 @@ static void InitSystem(Config& config) {
 
                 if (!assignedCaches.count(icache)) panic("%s: Invalid icache parameter %s", group, icache.c_str());
                 if (!assignedCaches.count(dcache)) panic("%s: Invalid dcache parameter %s", group, dcache.c_str());
+                if (type == "Simple" && config.get<bool>("sys.tlbs.enable", false)) {
+                    warn("%s: Simple cores do not model data TLBs, sys.tlbs.enable has no effect on them", group);
+                }
 
                 for (uint32_t j = 0; j < cores; j++) {
                     stringstream ss;
@@ -746,18 +802,24 @@ static void InitSystem(Config& config) {
                     dc->setSourceId(coreIdx);
                     assignedCaches[dcache]++;
 
+                    //Data TLBs and page walks, on Timing and OOO cores
+                    TLBHierarchy* dtlb = nullptr;
+                    if (type != "Simple" && config.get<bool>("sys.tlbs.enable", false)) dtlb = new TLBHierarchy(config, name, coreIdx);
+
                     //Build the core
                     if (type == "Simple") {
                         core = new (&simpleCores[j]) SimpleCore(ic, dc, name);
                     } else if (type == "Timing") {
                         uint32_t domain = j*zinfo->numDomains/cores;
                         TimingCore* tcore = new (&timingCores[j]) TimingCore(ic, dc, domain, name);
+                        tcore->setDTLB(dtlb);
                         zinfo->eventRecorders[coreIdx] = tcore->getEventRecorder();
                         zinfo->eventRecorders[coreIdx]->setSourceId(coreIdx);
                         core = tcore;
                     } else {
                         assert(type == "OOO");
                         OOOCore* ocore = new (&oooCores[j]) OOOCore(ic, dc, name);
+                        ocore->setDTLB(dtlb);
                         zinfo->eventRecorders[coreIdx] = ocore->getEventRecorder();
                         zinfo->eventRecorders[coreIdx]->setSourceId(coreIdx);
                         core = ocore;
@@ -969,7 +1031,8 @@ void SimInit(const char* configFile, const char* outputDir, uint32_t shmid) {
 
     zinfo->numDomains = config.get<uint32_t>("sim.domains", 1);
     uint32_t numSimThreads = config.get<uint32_t>("sim.contentionThreads", MAX((uint32_t)1, zinfo->numDomains/2)); //gives a bit of parallelism, TODO tune
-    zinfo->contentionSim = new ContentionSim(zinfo->numDomains, numSimThreads);
+    bool balanceDomains = config.get<bool>("sim.balanceDomains", false); //reassign domains to contention threads every phase
+    zinfo->contentionSim = new ContentionSim(zinfo->numDomains, numSimThreads, balanceDomains);
     zinfo->contentionSim->initStats(zinfo->rootStat);
     zinfo->eventRecorders = gm_calloc<EventRecorder*>(zinfo->numCores);
 
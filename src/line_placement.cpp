@@ -1,23 +1,42 @@
 #include "line_placement.h"
 #include "mc.h"
+#include "mc_checkpoint.h"
 #include <stdlib.h>
 
 void
-LinePlacementPolicy::initialize(Config & config)
+LinePlacementPolicy::initialize(Config & config, uint32_t num_stripes)
 {
-   srand48_r(rand(), &_buffer);
+   _num_stripes = num_stripes;
+   _buffers = gm_calloc<StripeBuffer>(_num_stripes);
+   long seed = rand();
+   for (uint32_t i = 0; i < _num_stripes; i++)
+      srand48_r(seed + i, &_buffers[i].buffer);
    _sample_rate = config.get<double>("sys.mem.mcdram.sampleRate");
    _enable_replace = config.get<bool>("sys.mem.mcdram.enableReplace", true); 
 }
 
 bool 
-LinePlacementPolicy::handleCacheMiss(Way * current_tad)
+LinePlacementPolicy::handleCacheMiss(uint32_t stripe, bool valid)
 {
-	if (!current_tad->valid)
+	if (!valid)
 		return true;
 	if (!_enable_replace)
 		return false;
 	double f;
-    drand48_r(&_buffer, &f);
+    drand48_r(&_buffers[stripe].buffer, &f);
     return f < _sample_rate;
 }
+
+void
+LinePlacementPolicy::save(CheckpointWriter &w)
+{
+   for (uint32_t i = 0; i < _num_stripes; i++)
+      w.put(_buffers[i].buffer);
+}
+
+void
+LinePlacementPolicy::restore(CheckpointReader &r)
+{
+   for (uint32_t i = 0; i < _num_stripes; i++)
+      r.get(_buffers[i].buffer);
+}
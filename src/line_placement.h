@@ -2,21 +2,34 @@
 
 #include "config.h"
 #include "memory_hierarchy.h"
+#include "pad.h"
 
 using namespace std;
 
 class MemoryController;
-class Way;
+class CheckpointWriter;
+class CheckpointReader;
 
 class LinePlacementPolicy
 {
 public:
    LinePlacementPolicy() {}; 
-   void initialize(Config & config);
-   bool handleCacheMiss(Way * current_tad);
+   // num_stripes: set lock stripes of the controller
+   void initialize(Config & config, uint32_t num_stripes);
+   // valid: whether the set (Alloy is direct-mapped) holds a line; called
+   // under the set's lock stripe
+   bool handleCacheMiss(uint32_t stripe, bool valid);
+   void save(CheckpointWriter &w);
+   void restore(CheckpointReader &r);
    
 private:
-   drand48_data _buffer;
+   // One random stream per lock stripe
+   struct StripeBuffer {
+      drand48_data buffer;
+      PAD();
+   };
+   StripeBuffer * _buffers;
+   uint32_t _num_stripes;
    double _sample_rate;
    bool _enable_replace;
 };
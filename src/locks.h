@@ -185,6 +185,11 @@ static inline void futex_lock_nospin(volatile uint32_t* lock) {
     } while (c != 0);
 }
 
+// Never blocks; returns false if the lock is held
+static inline bool futex_trylock(volatile uint32_t* lock) {
+    return *lock == 0 && __sync_bool_compare_and_swap(lock, 0, 1);
+}
+
 #define BILLION (1000000000L)
 static inline bool futex_trylock_nospin_timeout(volatile uint32_t* lock, uint64_t timeoutNs) {
     if (*lock == 0 && __sync_bool_compare_and_swap(lock, 0, 1)) {
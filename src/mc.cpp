@@ -5,23 +5,23 @@
 #include "mem_ctrls.h"
 #include "dramsim_mem_ctrl.h"
 #include "ddr_mem.h"
+#include "event_recorder.h"
+#include "event_queue.h"
+#include "mem_trace.h"
 #include "zsim.h"
+#include <algorithm>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 MemoryController::MemoryController(g_string& name, uint32_t frequency, uint32_t domain, Config& config)
 	: _name (name)
 {
-	// Trace Related
-	_collect_trace = config.get<bool>("sys.mem.enableTrace", false);
-	if (_collect_trace && _name == "mem-0") {
-		_cur_trace_len = 0;
-		_max_trace_len = 10000;
-		_trace_dir = config.get<const char *>("sys.mem.traceDir", "./");
-		FILE * f = fopen((_trace_dir + g_string("/") + _name + g_string("trace.bin")).c_str(), "wb");
-		uint32_t num = 0;
-		fwrite(&num, sizeof(uint32_t), 1, f);
-		fclose(f);
-	    futex_init(&_lock);
-	}
+	// Trace Related. The writer is shared by all controllers (see init.cpp).
+	_trace_writer = zinfo->memTraceWriter;
+	if (_trace_writer)
+		_trace_id = _trace_writer->addController();
 	_sram_tag = config.get<bool>("sys.mem.sram_tag", false);
 	_llc_latency = config.get<uint32_t>("sys.caches.l3.latency");
 	double timing_scale = config.get<double>("sys.mem.dram_timing_scale", 1);
@@ -31,7 +31,8 @@ MemoryController::MemoryController(g_string& name, uint32_t frequency, uint32_t
 		_granularity = config.get<uint32_t>("sys.mem.mcdram.cache_granularity");
 		_num_ways = config.get<uint32_t>("sys.mem.mcdram.num_ways");
 		_mcdram_type = config.get<const char *>("sys.mem.mcdram.type", "Simple");
-		_cache_size = config.get<uint32_t>("sys.mem.mcdram.size", 128) * 1024 * 1024;
+		_cache_size = ((uint64_t) config.get<uint32_t>("sys.mem.mcdram.size", 128)) * 1024 * 1024;  // in MB
+		_sector_lines = _granularity / 64;  // not sectored
 	}
 	if (scheme == "AlloyCache") {
 		_scheme = AlloyCache;
@@ -46,15 +47,22 @@ MemoryController::MemoryController(g_string& name, uint32_t frequency, uint32_t
 		assert(_granularity == 4096);
 		assert(_num_ways == _cache_size / _granularity);
 		_scheme = HMA;
+		_os_quantum = config.get<uint32_t>("sys.mem.mcdram.os_quantum", 1000000);
+		assert(_os_quantum > 0);
 	} else if (scheme == "HybridCache") {
 		// 4KB page or 2MB page
 		assert(_granularity == 4096 || _granularity == 4096 * 512);
 		_scheme = HybridCache;
+		// one sector per page bit at most
+		_sector_lines = config.get<uint32_t>("sys.mem.mcdram.sector_size", _granularity) / 64;
+		assert(_sector_lines > 0 && (_sector_lines & (_sector_lines - 1)) == 0);
+		assert(_sector_lines <= _granularity / 64 && _sector_lines * 64 >= _granularity / 64);
 	} else if (scheme == "NoCache")
 		_scheme = NoCache;
  	else if (scheme == "CacheOnly")
 		_scheme = CacheOnly;
 	else if (scheme == "Tagless") {
+		assert(_granularity >= 4096);
 		_scheme = Tagless;
 		_next_evict_idx = 0;
 		_footprint_size = config.get<uint32_t>("sys.mem.mcdram.footprint_size");
@@ -64,11 +72,55 @@ MemoryController::MemoryController(g_string& name, uint32_t frequency, uint32_t
 		assert(false);
 	}
 
+	_fht = nullptr;
+	_line_placement_policy = nullptr;
+	_page_placement_policy = nullptr;
+	_os_placement_policy = nullptr;
+	_tag_buffer = nullptr;
+	_physical_layout = false;
+	_miss_predictor = nullptr;
+	if (_scheme == AlloyCache && !_sram_tag) {
+		uint32_t map_entries = config.get<uint32_t>("sys.mem.mcdram.map_entries", 0);
+		if (map_entries) {
+			_miss_predictor = (MissPredictor *) gm_malloc(sizeof(MissPredictor));
+			new (_miss_predictor) MissPredictor(zinfo->numCores, map_entries);
+		}
+	}
+	_wb_buffer = nullptr;
+	uint32_t wb_buffer_size = config.get<uint32_t>("sys.mem.mcdram.wb_buffer_size", 0);
+	_wb_cleaner = config.get<bool>("sys.mem.mcdram.wb_cleaner", false);
+	_wb_clean_ext_share = config.get<double>("sys.mem.mcdram.wb_clean_ext_share", 0.2);
+	if (wb_buffer_size) {
+		assert(_scheme == AlloyCache || _scheme == UnisonCache || _scheme == HybridCache || _scheme == Tagless);
+		_wb_buffer = (WriteBackBuffer *) gm_malloc(sizeof(WriteBackBuffer));
+		new (_wb_buffer) WriteBackBuffer(wb_buffer_size);
+	}
+	if (_wb_cleaner && !_wb_buffer)
+		panic("sys.mem.mcdram.wb_cleaner needs a write-back buffer (wb_buffer_size)");
+	futex_init(&_wb_lock);
+	if (_scheme == UnisonCache || _scheme == Tagless) {
+		assert(_footprint_size > 0 && _footprint_size <= 64);
+		uint32_t fht_entries = config.get<uint32_t>("sys.mem.mcdram.fht_entries", 0);
+		if (fht_entries) {
+			uint32_t region_bits = config.get<uint32_t>("sys.mem.mcdram.fht_region_bits", 4);
+			_fht = (FootprintHistoryTable *) gm_malloc(sizeof(FootprintHistoryTable));
+			new (_fht) FootprintHistoryTable(fht_entries, region_bits, _footprint_size);
+		}
+	}
+
 	g_string placement_scheme = config.get<const char *>("sys.mem.mcdram.placementPolicy", "LRU");
 	_bw_balance = config.get<bool>("sys.mem.bwBalance", false);
 	_ds_index = 0;
-	if (_bw_balance)
+	_ds_target = 0;
+	_bw_balance_target = config.get<double>("sys.mem.bwBalanceTarget", 0.8);
+	_bw_balance_step = config.get<double>("sys.mem.bwBalanceStep", 0.001);
+	_bw_balance_sets = config.get<uint32_t>("sys.mem.bwBalanceSetsPerAccess", 1);
+	futex_init(&_ds_lock);
+	if (_bw_balance) {
 		assert(_scheme == AlloyCache || _scheme == HybridCache);
+		assert(_bw_balance_target > 0 && _bw_balance_target < 1);
+		assert(_bw_balance_sets > 0);
+	}
 
 	// Configure the external Dram
 	g_string ext_dram_name = _name + g_string("-ext");
@@ -137,20 +189,38 @@ MemoryController::MemoryController(g_string& name, uint32_t frequency, uint32_t
 		_num_sets = _cache_size / _num_ways / _granularity;
 		if (_scheme == Tagless)
 			assert(_num_sets == 1);
-		_cache = (Set *) gm_malloc(sizeof(Set) * _num_sets);
-		for (uint64_t i = 0; i < _num_sets; i ++) {
-			_cache[i].ways = (Way *) gm_malloc(sizeof(Way) * _num_ways);
-			_cache[i].num_ways = _num_ways;
-			for (uint32_t j = 0; j < _num_ways; j++)
-	   			_cache[i].ways[j].valid = false;
+		_cache.init(_num_sets, _num_ways);
+		g_string layout = config.get<const char *>("sys.mem.mcdram.layout", "Linear");
+		if (layout == "Physical")
+			_physical_layout = true;
+		else if (layout != "Linear")
+			panic("Invalid MC-Dram layout %s", layout.c_str());
+		_mcdram_ddr = _mcdram_type == "DDR";
+		_mcdram_row_lines = _mcdram_ddr? ((DDRMemory *) _mcdram[0])->getRowLines()
+		                               : config.get<uint32_t>("sys.mem.mcdram.rowBytes", 2048) / 64;
+		assert(_mcdram_row_lines * 64 >= 72);
+		// Lock stripes and TLB shards
+		_num_set_locks = config.get<uint32_t>("sys.mem.mcdram.lockStripes", 64);
+		if (_num_set_locks > _num_sets)
+			_num_set_locks = _num_sets;
+		assert(_num_set_locks > 0);
+		_set_locks = (SetLock *) gm_malloc(sizeof(SetLock) * _num_set_locks);
+		_tlb = (PageTable *) gm_malloc(sizeof(PageTable) * _num_set_locks);
+		for (uint32_t i = 0; i < _num_set_locks; i++) {
+			futex_init(&_set_locks[i].lock);
+			new (&_tlb[i]) PageTable(_fht || isSectored());
 		}
+		_residency_queries = false;
+		// TLBEntry keeps the way in 32 bits; way _num_ways means not cached
+		assert(_num_ways < (1ul << 32));
+		futex_init(&_tag_buffer_lock);
 		if (_scheme == AlloyCache) {
 			_line_placement_policy = (LinePlacementPolicy *) gm_malloc(sizeof(LinePlacementPolicy));
 			new (_line_placement_policy) LinePlacementPolicy();
-   			_line_placement_policy->initialize(config);
+   			_line_placement_policy->initialize(config, _num_set_locks);
 		} else if (_scheme == HMA) {
 			_os_placement_policy = (OSPlacementPolicy *) gm_malloc(sizeof(OSPlacementPolicy));
-			new (_os_placement_policy) OSPlacementPolicy(this);
+			new (_os_placement_policy) OSPlacementPolicy(this, config.get<uint32_t>("sys.mem.mcdram.os_select_threads", 4));
 		} else if (_scheme == UnisonCache || _scheme == HybridCache ){
 			_page_placement_policy = (PagePlacementPolicy *) gm_malloc(sizeof(PagePlacementPolicy));
 			new (_page_placement_policy) PagePlacementPolicy(this);
@@ -160,7 +230,15 @@ MemoryController::MemoryController(g_string& name, uint32_t frequency, uint32_t
 	if (_scheme == HybridCache) {
 		_tag_buffer = (TagBuffer *) gm_malloc(sizeof(TagBuffer));
 		new (_tag_buffer) TagBuffer(config);
+		_tb_flush_threshold = config.get<double>("sys.mem.mcdram.tb_flush_threshold", 0.7);
+		_tb_flush_stall = config.get<bool>("sys.mem.mcdram.tb_flush_stall", false);
+		_tb_shootdown_latency = config.get<uint32_t>("sys.mem.mcdram.tb_shootdown_latency", 0);
+		assert(_tb_flush_threshold > 0 && _tb_flush_threshold <= 1);
 	}
+	_warmup_requests = config.get<uint64_t>("sys.mem.mcdram.warmupRequests", 0);
+	_warmup_instrs = config.get<uint64_t>("sys.mem.mcdram.warmupInstrs", 0);
+	bool ff_warmup = config.get<bool>("sys.mem.mcdram.ffWarmup", false);
+	_warmup = _warmup_requests || _warmup_instrs || ff_warmup;
  	// Stats
    _num_hit_per_step = 0;
    _num_miss_per_step = 0;
@@ -169,6 +247,890 @@ MemoryController::MemoryController(g_string& name, uint32_t frequency, uint32_t
    for (uint32_t i = 0; i < MAX_STEPS; i++)
       _miss_rate_trace[i] = 0;
    _num_requests = 0;
+
+	_save_checkpoint = config.get<const char *>("sys.mem.mcdram.saveCheckpoint", "");
+	_checkpoint_saved = false;
+	g_string load_checkpoint = config.get<const char *>("sys.mem.mcdram.loadCheckpoint", "");
+	if (!load_checkpoint.empty())
+		restoreCheckpoint(checkpointFile(load_checkpoint).c_str());
+}
+
+// NoCache: every request goes to off-package DRAM
+uint64_t
+MemoryController::accessNoCache(MemReq& req, bool functional)
+{
+	req.cycle = extDramAccess(req, 0, 4, functional);
+	_numLoadHit.atomicInc();
+	return req.cycle;
+}
+
+// CacheOnly: every request hits in MC-Dram
+uint64_t
+MemoryController::accessCacheOnly(MemReq& req, bool functional)
+{
+	Address address = req.lineAddr;
+	uint32_t mcdram_select = (address / 64) % _mcdram_per_mc;
+	Address mc_address = (address / 64 / _mcdram_per_mc * 64) | (address % 64);
+	req.lineAddr = mc_address;
+	req.cycle = mcdramAccess(mcdram_select, req, 0, 4, functional);
+	req.lineAddr = address;
+	_numLoadHit.atomicInc();
+	return req.cycle;
+}
+
+// The access path of the DRAM cache schemes. The front end does what they
+// share: it takes the set lock, counts hits and misses, and does the
+// per-request and global bookkeeping. The scheme's hooks, picked by
+// overloading on SchemeTag<Sch>, do the rest:
+// - probe finds the way the line is in (hit_way) and issues the tag probe.
+// - hit serves a hit from MC-Dram.
+// - miss serves a miss. Most schemes go through missPath, which calls place
+//   to pick a way, missRead for the off-package demand access, fill to bring
+//   the page into the way and evict to write back its victim.
+// The scheme and SRAM-tag tests are compile-time constants, so each
+// instantiation only keeps its own code.
+template <Scheme Sch, bool SramTag>
+uint64_t
+MemoryController::accessScheme(MemReq& req, uint64_t num_requests, bool functional)
+{
+	AccessState s(req, functional);
+	s.type = (req.type == GETS || req.type == GETX)? LOAD : STORE;
+	s.address = req.lineAddr;
+	s.mcdram_select = (s.address / 64) % _mcdram_per_mc;
+	s.mc_address = (s.address / 64 / _mcdram_per_mc * 64) | (s.address % 64);
+	s.tag = s.address / (_granularity / 64);
+	s.set_num = s.tag % _num_sets;
+	s.hit_way = _num_ways;
+	s.cur_cycle = req.cycle;
+	s.data_ready_cycle = req.cycle;
+	s.mc_bw = 0;
+	s.ext_bw = 0;
+	s.tlb_entry = nullptr;
+	s.counter_access = false;
+	s.hybrid_tag_probe = false;
+	s.parallel_ext = false;
+	s.parallel_ext_cycle = 0;
+	uint64_t step_length = _cache_size / 64 / 10;
+
+	lock_t * set_lock = &_set_locks[getLockStripe(s.set_num)].lock;
+	futex_lock(set_lock);
+	// _ds_index only rises past this set under its lock, but may drop at any time
+	s.ds_index = _ds_index;
+	s.tlb = &_tlb[getLockStripe(s.set_num)];
+
+	SchemeTag<Sch> sch;
+	probe<SramTag>(s, sch);
+	if (s.hit_way == _num_ways) {
+		s.cur_cycle = req.cycle;
+		__sync_fetch_and_add(&_num_miss_per_step, 1);
+		if (s.type == LOAD)
+			_numLoadMiss.atomicInc();
+		else
+			_numStoreMiss.atomicInc();
+		miss<SramTag>(s, sch);
+	} else {
+		assert(s.set_num >= s.ds_index);
+		__sync_fetch_and_add(&_num_hit_per_step, 1);
+		if (req.type == PUTX) {
+			_numStoreHit.atomicInc();
+			_cache.setDirty(s.set_num, s.hit_way);
+		}
+		else
+			_numLoadHit.atomicInc();
+		hit<SramTag>(s, sch);
+	}
+
+	// TODO. make this part work again.
+	if (s.counter_access && !SramTag) {
+		// TODO may not need the counter load if we can store freq info inside TAD
+		/////// model counter access in mcdram
+		// One counter read and one coutner write
+		assert(s.set_num >= s.ds_index);
+		_numCounterAccess.atomicInc();
+		MESIState state;
+		MemReq counter_req = {s.mc_address, GETS, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
+		mcdramAccess(s.mcdram_select, counter_req, 2, 2, functional);
+		counter_req.type = PUTX;
+		mcdramAccess(s.mcdram_select, counter_req, 2, 2, functional);
+		s.mc_bw += 4;
+		//////////////////////////////////////
+	}
+	if (_wb_buffer && !functional)
+		idleWriteBack<Sch>(req, s.set_num, s.hit_way, s.ext_bw == 0, s.mc_bw, s.ext_bw);
+	futex_unlock(set_lock);
+
+	if (!functional) {
+		__sync_fetch_and_add(&_mc_bw_per_step, s.mc_bw);
+		__sync_fetch_and_add(&_ext_bw_per_step, s.ext_bw);
+	}
+
+	// Slow path: global work below runs with all set locks held.
+	// TODO. Make the timing info here correct.
+	// TODO. should model system level stall
+	if (Sch == HMA && num_requests % _os_quantum == 0) {
+		lockAllSets();
+		uint64_t num_replace = remapPages(req, functional);
+		_numPlacement.atomicInc(num_replace);
+		unlockAllSets();
+	}
+
+	if (_bw_balance && _ds_index < _ds_target)
+		reclaimSets<Sch>(req, functional);
+	if (num_requests % step_length == 0)
+		endStep();
+
+	return s.data_ready_cycle;
+}
+
+// A miss of the schemes that place on demand. Returns the way the line was
+// placed in, or _num_ways if it was not cached.
+template <Scheme Sch, bool SramTag>
+uint32_t
+MemoryController::missPath(AccessState &s)
+{
+	SchemeTag<Sch> sch;
+	uint32_t replace_way = place<SramTag>(s, sch);
+	missRead<SramTag>(s, replace_way, sch);
+	if (replace_way >= _num_ways)
+		return replace_way;
+
+	if (_physical_layout)
+		mcdramLocate(s.set_num, replace_way, s.address, s.mcdram_select, s.mc_address, sch);
+	// lines of the page the fill brings in (page schemes)
+	uint64_t fetch_bitvec = fill<SramTag>(s, sch);
+	_numPlacement.atomicInc();
+	if (_cache.isValid(s.set_num, replace_way)) {
+		Address replaced_tag = _cache.getTag(s.set_num, replace_way);
+		// Alloy only creates entries here, on placement. A page-granularity
+		// victim was touched before, so it already has one.
+		bool inserted;
+		TLBEntry * replaced_entry = s.tlb->lookupOrInsert(replaced_tag, _num_ways, inserted);
+		assert(!inserted || _granularity < 4096);
+		PageTable::setWay(replaced_entry, _num_ways);
+		bool dirty = _cache.isDirty(s.set_num, replace_way);
+		if (dirty)
+			_numDirtyEviction.atomicInc();
+		else {
+			_numCleanEviction.atomicInc();
+			if (replaced_entry->cleaned)
+				_numCleanedVictims.atomicInc();
+		}
+		evict<SramTag>(s, replaced_tag, replaced_entry, dirty, sch);
+	}
+	_cache.fill(s.set_num, replace_way, s.tag, s.req.type == PUTX);
+	// The victim's insertion may have grown the table, so look the
+	// page up again rather than reuse s.tlb_entry.
+	bool inserted;
+	s.tlb_entry = s.tlb->lookupOrInsert(s.tag, _num_ways, inserted);
+	PageTable::setWay(s.tlb_entry, replace_way);
+	s.tlb_entry->cleaned = false;
+	// Page schemes track the page's lines from its fill on
+	if (Sch != AlloyCache) {
+		s.tlb_entry->touch_bitvec = 0;
+		s.tlb_entry->dirty_bitvec = 0;
+		if (s.tlb->hasFetchBits())
+			s.tlb->fetchBits(s.tlb_entry) = fetch_bitvec | (((uint64_t)1UL) << pageBit(s.address));
+		s.tlb_entry->trigger = pageBit(s.address);
+		touchLine(s.tlb_entry, s.address, s.type);
+	}
+	return replace_way;
+}
+
+// Looks the page up in the page table, which holds the way of every cached
+// page. With check_miss, a miss is checked against the tags of the set.
+template <Scheme Sch>
+void
+MemoryController::lookupPage(AccessState &s, bool check_miss)
+{
+	bool inserted;
+	s.tlb_entry = s.tlb->lookupOrInsert(s.tag, _num_ways, inserted);
+	if (inserted)
+		_numTouchedPages.atomicInc();
+	if (s.tlb_entry->way != _num_ways) {
+		s.hit_way = s.tlb_entry->way;
+		assert(_cache.isHit(s.set_num, s.hit_way, s.tag));
+	} else if (check_miss) {
+		for (uint32_t i = 0; i < _num_ways; i ++)
+			assert(!_cache.isHit(s.set_num, i, s.tag));
+	}
+	// Probes go to the way the page is in, or to the first way on a miss
+	if (_physical_layout)
+		mcdramLocate(s.set_num, (s.hit_way == _num_ways)? 0 : s.hit_way, s.address, s.mcdram_select, s.mc_address, SchemeTag<Sch>());
+}
+
+// Reads lines of the missing page from off-package DRAM, off the critical
+// path, and writes them to MC-Dram once they are read
+void
+MemoryController::loadPage(AccessState &s, uint32_t lines)
+{
+	MemReq &req = s.req;
+	MESIState state;
+	MemReq load_req = {s.tag * 64, GETS, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
+	extDramAccess(load_req, 2, lines * 4, s.functional);
+	s.ext_bw += lines * 4;
+	MemReq insert_req = {s.mc_address, PUTX, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
+	mcdramAccess(s.mcdram_select, insert_req, 3, lines * 4, s.functional);
+	s.mc_bw += lines * 4;
+}
+
+// Writes the tag of a placed page to MC-Dram, off the critical path
+void
+MemoryController::storeTag(AccessState &s)
+{
+	MemReq &req = s.req;
+	MESIState state;
+	MemReq tag_req = {s.mc_address, PUTX, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
+	mcdramAccess(s.mcdram_select, tag_req, 2, 2, s.functional);
+	s.mc_bw += 2;
+}
+
+// Accounts for how much of an evicted page was touched and dirtied.
+// Returns its dirty lines.
+uint32_t
+MemoryController::countEvictedLines(TLBEntry * entry)
+{
+	uint32_t touch_lines = __builtin_popcountll(entry->touch_bitvec);
+	uint32_t dirty_lines = __builtin_popcountll(entry->dirty_bitvec);
+	assert(touch_lines > 0);
+	assert(touch_lines <= 64);
+	assert(dirty_lines <= 64);
+	_numTouchedLines.atomicInc(touch_lines);
+	_numEvictedLines.atomicInc(dirty_lines);
+	_numNotTouchedLines.atomicInc(_granularity / 64 - touch_lines);
+	return dirty_lines;
+}
+
+// Footprint schemes (UnisonCache, Tagless): fetches the lines the history
+// table predicts the page will touch, or the default footprint without one.
+// Returns the lines fetched.
+uint64_t
+MemoryController::fetchFootprint(AccessState &s)
+{
+	uint64_t fetch_bitvec = ~0ul;
+	uint32_t lines = _footprint_size;
+	if (_fht) {
+		bool found;
+		fetch_bitvec = _fht->predict(s.tag, pageBit(s.address), found);
+		if (!found)
+			_numFHTMiss.atomicInc();
+		lines = __builtin_popcountll(fetch_bitvec);
+		_numFootprintLines.atomicInc(lines);
+	}
+	loadPage(s, lines);
+	return fetch_bitvec;
+}
+
+// Footprint schemes: under-fetch, where the footprint left the demanded line
+// off-package. A load fetches it now, as access type type; a write-back
+// simply fills it. Returns whether the line was fetched.
+bool
+MemoryController::underFetch(AccessState &s, uint32_t type)
+{
+	uint64_t bit = ((uint64_t)1UL) << pageBit(s.address);
+	if (!_fht || (s.tlb->fetchBits(s.tlb_entry) & bit))
+		return false;
+	s.tlb->fetchBits(s.tlb_entry) |= bit;
+	if (s.type != LOAD)
+		return false;
+	MemReq &req = s.req;
+	MESIState state;
+	_numUnderfetchLines.atomicInc();
+	req.cycle = extDramAccess(req, type, 4, s.functional);
+	s.ext_bw += 4;
+	MemReq insert_req = {s.mc_address, PUTX, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
+	mcdramAccess(s.mcdram_select, insert_req, 2, 4, s.functional);
+	s.mc_bw += 4;
+	return true;
+}
+
+// Footprint schemes: trains the history table with the victim's footprint,
+// and writes back its dirty lines
+void
+MemoryController::evictFootprint(AccessState &s, Address replaced_tag, TLBEntry * replaced_entry, bool dirty)
+{
+	uint32_t dirty_lines = countEvictedLines(replaced_entry);
+	if (_fht) {
+		_fht->train(replaced_tag, replaced_entry->trigger, replaced_entry->touch_bitvec);
+		_numOverfetchLines.atomicInc(__builtin_popcountll(s.tlb->fetchBits(replaced_entry) & ~replaced_entry->touch_bitvec));
+	}
+	if (!dirty) {
+		assert(dirty_lines == 0);
+		return;
+	}
+	assert(dirty_lines > 0);
+	// load the dirty lines from mcdram
+	MemReq &req = s.req;
+	MESIState state;
+	MemReq load_req = {s.mc_address, GETS, req.childId, &state, s.cur_cycle, req.childLock, req.initialState, req.srcId, req.flags};
+	uint64_t read_cycle = mcdramAccess(s.mcdram_select, load_req, 2, dirty_lines * 4, s.functional);
+	s.mc_bw += dirty_lines * 4;
+	// store them to ext dram, once they are read
+	s.ext_bw += writeBack(req, replaced_tag, replaced_tag * 64, dirty_lines * 4, 3, s.cur_cycle, read_cycle, s.functional);
+}
+
+// Tagless: updates the page's GIPT entry in off-package DRAM
+void
+MemoryController::updateGIPT(AccessState &s)
+{
+	MemReq &req = s.req;
+	MESIState state;
+	MemReq load_gipt_req = {s.tag * 64, GETS, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
+	MemReq store_gipt_req = {s.tag * 64, PUTS, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
+	extDramAccess(load_gipt_req, 2, 2, s.functional);
+	extDramAccess(store_gipt_req, 2, 2, s.functional);
+	s.ext_bw += 4;
+}
+
+// HybridCache: flushes the tag buffer once its occupancy passes
+// _tb_flush_threshold. Occupancy only grows between flushes, so read it
+// without the lock and check again under it.
+void
+MemoryController::checkTagBufferFlush(AccessState &s)
+{
+	if (_tag_buffer->getOccupancy() <= _tb_flush_threshold)
+		return;
+	futex_lock(&_tag_buffer_lock);
+	if (_tag_buffer->getOccupancy() > _tb_flush_threshold) {
+		uint64_t flush_done_cycle = flushTagBuffer(s.req, s.functional);
+		if (_tb_flush_stall && flush_done_cycle > s.data_ready_cycle)
+			s.data_ready_cycle = flush_done_cycle;
+	}
+	futex_unlock(&_tag_buffer_lock);
+}
+
+// Hooks shared by several schemes
+
+// Page schemes: the page table knows the way
+template <bool SramTag, Scheme Sch>
+void
+MemoryController::probe(AccessState &s, SchemeTag<Sch>)
+{
+	lookupPage<Sch>(s, true);
+}
+
+template <bool SramTag, Scheme Sch>
+void
+MemoryController::miss(AccessState &s, SchemeTag<Sch>)
+{
+	missPath<Sch, SramTag>(s);
+}
+
+// Page placement policy (UnisonCache)
+template <bool SramTag, Scheme Sch>
+uint32_t
+MemoryController::place(AccessState &s, SchemeTag<Sch>)
+{
+	if (s.set_num < s.ds_index)
+		return _num_ways;
+	return _page_placement_policy->handleCacheMiss(s.tag, s.type, s.set_num, s.counter_access);
+}
+
+/////// AlloyCache: direct-mapped lines, with the tag next to the data (TAD)
+
+template <bool SramTag>
+void
+MemoryController::probe(AccessState &s, SchemeTag<AlloyCache>)
+{
+	MemReq &req = s.req;
+	MESIState state;
+	if (_physical_layout)
+		mcdramLocate(s.set_num, 0, s.address, s.mcdram_select, s.mc_address, SchemeTag<AlloyCache>());
+	if (_cache.isHit(s.set_num, 0, s.tag) && s.set_num >= s.ds_index)
+		s.hit_way = 0;
+	if (s.type != LOAD || s.set_num < s.ds_index)
+		return;
+	///// mcdram TAD access
+	// Modeling TAD as 2 cachelines
+	if (SramTag) {
+		req.cycle += _llc_latency;
+	} else if (_miss_predictor && _miss_predictor->predictMiss(req.srcId, s.address)) {
+		// The off-package read and the TAD probe go out together.
+		// The one the data comes from is on the critical path; the
+		// other hangs off it.
+		bool miss = s.hit_way == _num_ways;
+		uint64_t start_cycle = req.cycle;
+		if (miss) {
+			uint32_t read_type = drainMissWriteBack(req, s.tag, 0, s.ext_bw, s.functional);
+			s.parallel_ext_cycle = extDramAccess(req, read_type, 4, s.functional);
+			s.parallel_ext = true;
+			s.ext_bw += 4;
+			_numMAPCorrect.atomicInc();
+		}
+		req.lineAddr = s.mc_address;
+		req.cycle = mcdramAccess(s.mcdram_select, req, miss? 2 : 0, 6, s.functional);
+		s.mc_bw += 6;
+		_numTagLoad.atomicInc();
+		req.lineAddr = s.address;
+		if (!miss) {
+			MemReq wasted_req = {s.address, GETS, req.childId, &state, start_cycle, req.childLock, req.initialState, req.srcId, req.flags};
+			extDramAccess(wasted_req, 2, 4, s.functional);
+			s.ext_bw += 4;
+			_numMAPFalseMiss.atomicInc();
+		}
+		_miss_predictor->train(req.srcId, s.address, miss);
+	} else {
+		req.lineAddr = s.mc_address;
+		req.cycle = mcdramAccess(s.mcdram_select, req, 0, 6, s.functional);
+		s.mc_bw += 6;
+		_numTagLoad.atomicInc();
+		req.lineAddr = s.address;
+		if (_miss_predictor) {
+			bool miss = s.hit_way == _num_ways;
+			if (miss)
+				_numMAPFalseHit.atomicInc();
+			else
+				_numMAPCorrect.atomicInc();
+			_miss_predictor->train(req.srcId, s.address, miss);
+		}
+	}
+}
+
+template <bool SramTag>
+void
+MemoryController::hit(AccessState &s, SchemeTag<AlloyCache>)
+{
+	MemReq &req = s.req;
+	MESIState state;
+	if (s.type == LOAD && SramTag) {
+		MemReq read_req = {s.mc_address, GETX, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
+		req.cycle = mcdramAccess(s.mcdram_select, read_req, 0, 4, s.functional);
+		s.mc_bw += 4;
+	}
+	if (s.type == STORE) {
+		// LLC dirty eviction hit
+		MemReq write_req = {s.mc_address, PUTX, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
+		req.cycle = mcdramAccess(s.mcdram_select, write_req, 0, 4, s.functional);
+		s.mc_bw += 4;
+	}
+	s.data_ready_cycle = req.cycle;
+}
+
+// Way 1 (= _num_ways) bypasses the cache
+template <bool SramTag>
+uint32_t
+MemoryController::place(AccessState &s, SchemeTag<AlloyCache>)
+{
+	bool place = false;
+	if (s.set_num >= s.ds_index)
+		place = _line_placement_policy->handleCacheMiss(getLockStripe(s.set_num), _cache.isValid(s.set_num, 0));
+	return place? 0 : 1;
+}
+
+template <bool SramTag>
+void
+MemoryController::missRead(AccessState &s, uint32_t replace_way, SchemeTag<AlloyCache>)
+{
+	MemReq &req = s.req;
+	MESIState state;
+	if (s.type == LOAD && s.parallel_ext) {
+		// issued with the TAD probe; the miss is known once both return
+		req.cycle = std::max(req.cycle, s.parallel_ext_cycle);
+	} else if (s.type == LOAD) {
+		uint32_t read_type = drainMissWriteBack(req, s.tag, (!SramTag && s.set_num >= s.ds_index)? 1 : 0, s.ext_bw, s.functional);
+		req.cycle = extDramAccess(req, read_type, 4, s.functional);
+		s.ext_bw += 4;
+	} else if (replace_way >= _num_ways) {
+		// no replacement
+		uint32_t write_type = drainMissWriteBack(req, s.tag, 0, s.ext_bw, s.functional);
+		req.cycle = extDramAccess(req, write_type, 4, s.functional);
+		s.ext_bw += 4;
+	} else {
+		MemReq load_req = {s.address, GETS, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
+		uint32_t read_type = drainMissWriteBack(load_req, s.tag, 0, s.ext_bw, s.functional);
+		req.cycle = extDramAccess(load_req, read_type, 4, s.functional);
+		s.ext_bw += 4;
+	}
+	s.data_ready_cycle = req.cycle;
+}
+
+template <bool SramTag>
+uint64_t
+MemoryController::fill(AccessState &s, SchemeTag<AlloyCache>)
+{
+	MemReq &req = s.req;
+	MESIState state;
+	MemReq insert_req = {s.mc_address, PUTX, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
+	uint32_t size = SramTag? 4 : 6;
+	mcdramAccess(s.mcdram_select, insert_req, 2, size, s.functional);
+	s.mc_bw += size;
+	_numTagStore.atomicInc();
+	return ~0ul;
+}
+
+template <bool SramTag>
+void
+MemoryController::evict(AccessState &s, Address replaced_tag, TLBEntry * replaced_entry, bool dirty, SchemeTag<AlloyCache>)
+{
+	if (!dirty)
+		return;
+	///////   store dirty line back to external dram
+	// Store starts after TAD is loaded.
+	// request not on critical path.
+	MemReq &req = s.req;
+	MESIState state;
+	if (s.type == STORE && SramTag) {
+		MemReq load_req = {s.mc_address, GETS, req.childId, &state, s.cur_cycle, req.childLock, req.initialState, req.srcId, req.flags};
+		req.cycle = mcdramAccess(s.mcdram_select, load_req, 2, 4, s.functional);
+		s.mc_bw += 4;
+	}
+	s.ext_bw += writeBack(req, replaced_tag, replaced_tag, 4, 2, s.cur_cycle, req.cycle, s.functional);
+}
+
+/////// UnisonCache: pages with footprints, tags in MC-Dram
+
+template <bool SramTag>
+void
+MemoryController::probe(AccessState &s, SchemeTag<UnisonCache>)
+{
+	/////////////////////////////
+	// TODO For UnisonCache
+	// should correctly model way accesses
+	/////////////////////////////
+	lookupPage<UnisonCache>(s, true);
+	MemReq &req = s.req;
+	MESIState state;
+	//// Tag and data access. For simplicity, use a single access.
+	if (s.type == LOAD) {
+		req.lineAddr = s.mc_address;
+		req.cycle = mcdramAccess(s.mcdram_select, req, 0, 6, s.functional);
+		s.mc_bw += 6;
+		_numTagLoad.atomicInc();
+		req.lineAddr = s.address;
+	} else {
+		assert(s.type == STORE);
+		MemReq tag_probe = {s.mc_address, GETS, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
+		req.cycle = mcdramAccess(s.mcdram_select, tag_probe, 0, 2, s.functional);
+		s.mc_bw += 2;
+		_numTagLoad.atomicInc();
+	}
+}
+
+template <bool SramTag>
+void
+MemoryController::hit(AccessState &s, SchemeTag<UnisonCache>)
+{
+	MemReq &req = s.req;
+	MESIState state;
+	if (s.type == STORE) {
+		// LLC dirty eviction hit
+		MemReq write_req = {s.mc_address, PUTX, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
+		req.cycle = mcdramAccess(s.mcdram_select, write_req, 1, 4, s.functional);
+		s.mc_bw += 4;
+	}
+	underFetch(s, 1);
+	s.data_ready_cycle = req.cycle;
+	_page_placement_policy->handleCacheHit(s.tag, s.type, s.set_num, s.counter_access, s.hit_way);
+	// Update LRU information for UnisonCache
+	MemReq tag_update_req = {s.mc_address, PUTX, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
+	mcdramAccess(s.mcdram_select, tag_update_req, 2, 2, s.functional);
+	s.mc_bw += 2;
+	_numTagStore.atomicInc();
+	touchLine(s.tlb_entry, s.address, s.type);
+}
+
+template <bool SramTag>
+void
+MemoryController::missRead(AccessState &s, uint32_t replace_way, SchemeTag<UnisonCache>)
+{
+	MemReq &req = s.req;
+	drainMissWriteBack(req, s.tag, 1, s.ext_bw, s.functional);
+	// A placed write-back supplies its own line
+	if (s.type == LOAD || replace_way >= _num_ways) {
+		req.cycle = extDramAccess(req, 1, 4, s.functional);
+		s.ext_bw += 4;
+	}
+	s.data_ready_cycle = req.cycle;
+}
+
+template <bool SramTag>
+uint64_t
+MemoryController::fill(AccessState &s, SchemeTag<UnisonCache>)
+{
+	uint64_t fetch_bitvec = fetchFootprint(s);
+	if (!SramTag)
+		storeTag(s);
+	_numTagStore.atomicInc();
+	return fetch_bitvec;
+}
+
+template <bool SramTag>
+void
+MemoryController::evict(AccessState &s, Address replaced_tag, TLBEntry * replaced_entry, bool dirty, SchemeTag<UnisonCache>)
+{
+	evictFootprint(s, replaced_tag, replaced_entry, dirty);
+}
+
+/////// HMA: pages placed by the OS every _os_quantum requests
+
+template <bool SramTag>
+void
+MemoryController::hit(AccessState &s, SchemeTag<HMA>)
+{
+	MemReq &req = s.req;
+	_os_placement_policy->handleCacheAccess(s.tlb_entry, s.type);
+	req.lineAddr = s.mc_address;
+	req.cycle = mcdramAccess(s.mcdram_select, req, 0, 4, s.functional);
+	s.mc_bw += 4;
+	req.lineAddr = s.address;
+	s.data_ready_cycle = req.cycle;
+}
+
+// Misses are never placed here, only by remapPages
+template <bool SramTag>
+void
+MemoryController::miss(AccessState &s, SchemeTag<HMA>)
+{
+	MemReq &req = s.req;
+	_os_placement_policy->handleCacheAccess(s.tlb_entry, s.type);
+	req.cycle = extDramAccess(req, 0, 4, s.functional);
+	s.ext_bw += 4;
+	s.data_ready_cycle = req.cycle;
+}
+
+/////// HybridCache: pages, with a tag buffer of recent remaps
+
+template <bool SramTag>
+void
+MemoryController::probe(AccessState &s, SchemeTag<HybridCache>)
+{
+	lookupPage<HybridCache>(s, true);
+	// whether needs to probe tag for HybridCache.
+	// need to do so for LLC dirty eviction and if the page is not in TB
+	// Read without the lock; a racing insert or flush only makes it stale.
+	if (s.type == STORE) {
+		bool tb_miss = _tag_buffer->existInTB(s.tag) == _tag_buffer->getNumWays();
+		if (tb_miss && s.set_num >= s.ds_index) {
+			_numTBDirtyMiss.atomicInc();
+			if (!SramTag)
+				s.hybrid_tag_probe = true;
+		} else
+			_numTBDirtyHit.atomicInc();
+	}
+	if (SramTag)
+		s.req.cycle += _llc_latency;
+}
+
+template <bool SramTag>
+void
+MemoryController::hit(AccessState &s, SchemeTag<HybridCache>)
+{
+	MemReq &req = s.req;
+	MESIState state;
+	_page_placement_policy->handleCacheHit(s.tag, s.type, s.set_num, s.counter_access, s.hit_way);
+
+	// Sectored HybridCache: a sector not yet in MC-Dram is filled now. A
+	// load gets its line from off-package DRAM first, and the fill hangs
+	// off that read. A write-back supplies its own line; its fill hangs off
+	// the demand access below.
+	bool sector_fill = isSectored() && (s.tlb->fetchBits(s.tlb_entry) & sectorBits(s.address)) != sectorBits(s.address);
+	bool sector_miss = false;
+	if (sector_fill) {
+		_numSectorFills.atomicInc();
+		s.tlb->fetchBits(s.tlb_entry) |= sectorBits(s.address);
+		if (s.type == LOAD) {
+			sector_miss = true;
+			req.cycle = extDramAccess(req, 0, 4, s.functional);
+			s.ext_bw += 4;
+			fillSector(req, s.address, s.mc_address, s.mcdram_select, s.mc_bw, s.ext_bw, s.functional);
+		}
+	}
+
+	if (!s.hybrid_tag_probe) {
+		if (!sector_miss) {
+			req.lineAddr = s.mc_address;
+			req.cycle = mcdramAccess(s.mcdram_select, req, 0, 4, s.functional);
+			s.mc_bw += 4;
+			req.lineAddr = s.address;
+		}
+		s.data_ready_cycle = req.cycle;
+		// Only a page not yet in the tag buffer needs the lock
+		if (s.type == LOAD && !_tag_buffer->touch(s.tag)) {
+			futex_lock(&_tag_buffer_lock);
+			if (_tag_buffer->canInsert(s.tag))
+				_tag_buffer->insert(s.tag, false);
+			futex_unlock(&_tag_buffer_lock);
+		}
+	} else {
+		assert(!SramTag);
+		MemReq tag_probe = {s.mc_address, GETS, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
+		req.cycle = mcdramAccess(s.mcdram_select, tag_probe, 0, 2, s.functional);
+		s.mc_bw += 2;
+		_numTagLoad.atomicInc();
+		req.lineAddr = s.mc_address;
+		req.cycle = mcdramAccess(s.mcdram_select, req, 1, 4, s.functional);
+		s.mc_bw += 4;
+		req.lineAddr = s.address;
+		s.data_ready_cycle = req.cycle;
+	}
+	touchLine(s.tlb_entry, s.address, s.type);
+	if (sector_fill && s.type == STORE)
+		fillSector(req, s.address, s.mc_address, s.mcdram_select, s.mc_bw, s.ext_bw, s.functional);
+	checkTagBufferFlush(s);
+}
+
+template <bool SramTag>
+void
+MemoryController::miss(AccessState &s, SchemeTag<HybridCache>)
+{
+	missPath<HybridCache, SramTag>(s);
+	checkTagBufferFlush(s);
+}
+
+// The placement policy only replaces a page if both remaps fit in the tag
+// buffer, so they are inserted under the same lock as the decision. The lock
+// is dropped before any DRAM access.
+template <bool SramTag>
+uint32_t
+MemoryController::place(AccessState &s, SchemeTag<HybridCache>)
+{
+	futex_lock(&_tag_buffer_lock);
+	uint32_t replace_way = _num_ways;
+	if (s.set_num >= s.ds_index)
+		replace_way = _page_placement_policy->handleCacheMiss(s.tag, s.type, s.set_num, s.counter_access);
+	if (replace_way < _num_ways && _cache.isValid(s.set_num, replace_way)) {
+		// Note that tag_buffer is not updated if placed into an invalid entry.
+		// this is like ignoring the initialization cost
+		Address replaced_tag = _cache.getTag(s.set_num, replace_way);
+		assert(_tag_buffer->canInsert(s.tag, replaced_tag));
+		_tag_buffer->insert(s.tag, true);
+		_tag_buffer->insert(replaced_tag, true);
+	} else if (replace_way >= _num_ways && s.type == LOAD && _tag_buffer->canInsert(s.tag)) {
+		// Miss but no replacement
+		_tag_buffer->insert(s.tag, false);
+	}
+	futex_unlock(&_tag_buffer_lock);
+	return replace_way;
+}
+
+template <bool SramTag>
+void
+MemoryController::missRead(AccessState &s, uint32_t replace_way, SchemeTag<HybridCache>)
+{
+	MemReq &req = s.req;
+	MESIState state;
+	if (s.hybrid_tag_probe) {
+		MemReq tag_probe = {s.mc_address, GETS, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
+		req.cycle = mcdramAccess(s.mcdram_select, tag_probe, 0, 2, s.functional);
+		s.mc_bw += 2;
+		drainMissWriteBack(req, s.tag, 1, s.ext_bw, s.functional);
+		req.cycle = extDramAccess(req, 1, 4, s.functional);
+		s.ext_bw += 4;
+		_numTagLoad.atomicInc();
+	} else {
+		uint32_t read_type = drainMissWriteBack(req, s.tag, 0, s.ext_bw, s.functional);
+		req.cycle = extDramAccess(req, read_type, 4, s.functional);
+		s.ext_bw += 4;
+	}
+	s.data_ready_cycle = req.cycle;
+}
+
+// Sectored pages only fetch the demanded sector
+template <bool SramTag>
+uint64_t
+MemoryController::fill(AccessState &s, SchemeTag<HybridCache>)
+{
+	uint64_t fetch_bitvec = ~0ul;
+	uint32_t lines = _granularity / 64;
+	if (isSectored()) {
+		lines = _sector_lines;
+		fetch_bitvec = sectorBits(s.address);
+	}
+	loadPage(s, lines);
+	if (!SramTag)
+		storeTag(s);
+	_numTagStore.atomicInc();
+	return fetch_bitvec;
+}
+
+template <bool SramTag>
+void
+MemoryController::evict(AccessState &s, Address replaced_tag, TLBEntry * replaced_entry, bool dirty, SchemeTag<HybridCache>)
+{
+	// The remaps went into the tag buffer with the placement decision
+	countEvictedLines(replaced_entry);
+	if (!dirty)
+		return;
+	// Sectored pages only write back their dirty sectors
+	uint64_t wb_lines = _granularity / 64;
+	if (isSectored()) {
+		wb_lines = dirtySectors(replaced_entry->dirty_bitvec) * _sector_lines;
+		assert(wb_lines > 0);
+	}
+	// load page from mcdram
+	MemReq &req = s.req;
+	MESIState state;
+	MemReq load_req = {s.mc_address, GETS, req.childId, &state, s.cur_cycle, req.childLock, req.initialState, req.srcId, req.flags};
+	uint64_t read_cycle = mcdramAccess(s.mcdram_select, load_req, 2, wb_lines * 4, s.functional);
+	s.mc_bw += wb_lines * 4;
+	// store page to ext dram, once it is read
+	s.ext_bw += writeBack(req, replaced_tag, replaced_tag * 64, wb_lines * 4, 3, s.cur_cycle, read_cycle, s.functional);
+}
+
+/////// Tagless: pages with footprints in a fully associative FIFO cache,
+/////// mapped by the GIPT
+
+// For Tagless, checking every way on a miss takes too much time
+template <bool SramTag>
+void
+MemoryController::probe(AccessState &s, SchemeTag<Tagless>)
+{
+	lookupPage<Tagless>(s, false);
+}
+
+template <bool SramTag>
+void
+MemoryController::hit(AccessState &s, SchemeTag<Tagless>)
+{
+	MemReq &req = s.req;
+	if (!underFetch(s, 0)) {
+		req.lineAddr = s.mc_address;
+		req.cycle = mcdramAccess(s.mcdram_select, req, 0, 4, s.functional);
+		s.mc_bw += 4;
+		req.lineAddr = s.address;
+	}
+	s.data_ready_cycle = req.cycle;
+	touchLine(s.tlb_entry, s.address, s.type);
+}
+
+// Every miss is placed, replacing the oldest page
+template <bool SramTag>
+uint32_t
+MemoryController::place(AccessState &s, SchemeTag<Tagless>)
+{
+	uint32_t replace_way = _next_evict_idx;
+	_next_evict_idx = (_next_evict_idx + 1) % _num_ways;
+	return replace_way;
+}
+
+template <bool SramTag>
+void
+MemoryController::missRead(AccessState &s, uint32_t replace_way, SchemeTag<Tagless>)
+{
+	MemReq &req = s.req;
+	assert(_ext_dram);
+	uint32_t read_type = drainMissWriteBack(req, s.tag, 0, s.ext_bw, s.functional);
+	req.cycle = extDramAccess(req, read_type, 4, s.functional);
+	s.ext_bw += 4;
+	s.data_ready_cycle = req.cycle;
+}
+
+template <bool SramTag>
+uint64_t
+MemoryController::fill(AccessState &s, SchemeTag<Tagless>)
+{
+	uint64_t fetch_bitvec = fetchFootprint(s);
+	updateGIPT(s);
+	_numTagStore.atomicInc();
+	return fetch_bitvec;
+}
+
+template <bool SramTag>
+void
+MemoryController::evict(AccessState &s, Address replaced_tag, TLBEntry * replaced_entry, bool dirty, SchemeTag<Tagless>)
+{
+	evictFootprint(s, replaced_tag, replaced_entry, dirty);
+	if (dirty)
+		updateGIPT(s);
 }
 
 uint64_t
@@ -189,592 +1151,514 @@ MemoryController::access(MemReq& req)
     }
 	if (req.type == PUTS)
 		return req.cycle;
-	futex_lock(&_lock);
 	// ignore clean LLC eviction
-    if (_collect_trace && _name == "mem-0") {
-        _address_trace[_cur_trace_len] = req.lineAddr;
-        _type_trace[_cur_trace_len] = (req.type == PUTX)? 1 : 0;
-        _cur_trace_len ++;
-        assert(_cur_trace_len <= _max_trace_len);
-        if (_cur_trace_len == _max_trace_len) {
-            FILE * f = fopen((_trace_dir + g_string("/") + _name + g_string("trace.bin")).c_str(), "ab");
-            fwrite(_address_trace, sizeof(Address), _max_trace_len, f);
-            fwrite(_type_trace, sizeof(uint32_t), _max_trace_len, f);
-            fclose(f);
-            _cur_trace_len = 0;
-        }
-    }
 
-	_num_requests ++;
-	if (_scheme == NoCache) {
-		///////   load from external dram
- 		req.cycle = _ext_dram->access(req, 0, 4);
-		_numLoadHit.inc();
-		futex_unlock(&_lock);
-		return req.cycle;
-		////////////////////////////////////
+	uint64_t num_requests = __sync_add_and_fetch(&_num_requests, 1);
+	// Functional accesses update the tags, page table and placement state, but
+	// make no timing-model calls and consume no bandwidth
+	bool functional = req.is(MemReq::WARMUP);
+	if (unlikely(_warmup) && !functional) {
+		bool reqs_done = _warmup_requests && num_requests > _warmup_requests;
+		bool instrs_done = _warmup_instrs && zinfo->dcWarmupInstrsDone;
+		if (reqs_done || instrs_done || (!_warmup_requests && !_warmup_instrs))
+			endWarmup(num_requests);
+		else
+			functional = true;
 	}
-	/////////////////////////////
-	// TODO For UnisonCache
-	// should correctly model way accesses
-	/////////////////////////////
+	if (functional)
+		_numWarmupRequests.atomicInc();
+	else if (_trace_writer)
+		_trace_writer->write({req.lineAddr, req.cycle, _trace_id, req.type == PUTX});
+
+	switch (_scheme) {
+		case NoCache:     return accessNoCache(req, functional);
+		case CacheOnly:   return accessCacheOnly(req, functional);
+		case AlloyCache:  return _sram_tag? accessScheme<AlloyCache, true>(req, num_requests, functional)
+		                                  : accessScheme<AlloyCache, false>(req, num_requests, functional);
+		case UnisonCache: return _sram_tag? accessScheme<UnisonCache, true>(req, num_requests, functional)
+		                                  : accessScheme<UnisonCache, false>(req, num_requests, functional);
+		case HMA:         return _sram_tag? accessScheme<HMA, true>(req, num_requests, functional)
+		                                  : accessScheme<HMA, false>(req, num_requests, functional);
+		case HybridCache: return _sram_tag? accessScheme<HybridCache, true>(req, num_requests, functional)
+		                                  : accessScheme<HybridCache, false>(req, num_requests, functional);
+		case Tagless:     return _sram_tag? accessScheme<Tagless, true>(req, num_requests, functional)
+		                                  : accessScheme<Tagless, false>(req, num_requests, functional);
+	}
+	panic("Unknown DRAM cache scheme %d", _scheme);
+}
 
+// The other lines of the sector are read from off-package DRAM and, once
+// read, written to MC-Dram. A load's demanded line came from the previous
+// access, so it is written with them; a write-back's line is written by the
+// demand access itself.
+void
+MemoryController::fillSector(MemReq& req, Address address, Address mc_address, uint32_t mcdram_select, uint64_t &mc_bw, uint64_t &ext_bw, bool functional)
+{
+	MESIState state;
 	ReqType type = (req.type == GETS || req.type == GETX)? LOAD : STORE;
-	Address address = req.lineAddr;
-	uint32_t mcdram_select = (address / 64) % _mcdram_per_mc;
-	Address mc_address = (address / 64 / _mcdram_per_mc * 64) | (address % 64);
-	//info("!!!!!!!!!!!In DramCache, address=0x%lx, _mcdram_per_mc=%d, mc_address=0x%lx\n", address, _mcdram_per_mc, mc_address);
-	Address tag = address / (_granularity / 64);
-	//info("!!!!!!!!!!!In DramCache address:0x%lx, tag: 0x%lx\n", address, tag);
-	uint64_t set_num = tag % _num_sets;
-	uint32_t hit_way = _num_ways;
-	//uint64_t orig_cycle = req.cycle;
-	uint64_t data_ready_cycle = req.cycle;
-    MESIState state;
-
-	if (_scheme == CacheOnly) {
-		///////   load from mcdram
-		req.lineAddr = mc_address;
- 		req.cycle = _mcdram[mcdram_select]->access(req, 0, 4);
-		req.lineAddr = address;
-		_numLoadHit.inc();
-		futex_unlock(&_lock);
-		return req.cycle;
-		////////////////////////////////////
+	if (_sector_lines > 1) {
+		MemReq load_req = {address - address % _sector_lines, GETS, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
+		extDramAccess(load_req, 2, (_sector_lines - 1) * 4, functional);
+		ext_bw += (_sector_lines - 1) * 4;
 	}
-	uint64_t step_length = _cache_size / 64 / 10;
+	uint32_t insert_lines = (type == LOAD)? _sector_lines : _sector_lines - 1;
+	if (insert_lines) {
+		MemReq insert_req = {mc_address, PUTX, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
+		mcdramAccess(mcdram_select, insert_req, (_sector_lines > 1)? 3 : 2, insert_lines * 4, functional);
+		mc_bw += insert_lines * 4;
+	}
+}
 
-	// whether needs to probe tag for HybridCache.
-	// need to do so for LLC dirty eviction and if the page is not in TB
-	bool hybrid_tag_probe = false;
-	if (_granularity >= 4096) {
-		if (_tlb.find(tag) == _tlb.end()){
-         	_tlb[tag] = TLBEntry {tag, _num_ways, 0, 0, 0};
-            _numTouchedPages.inc();
-        }
-		if (_tlb[tag].way != _num_ways) {
-			hit_way = _tlb[tag].way;
-			assert(_cache[set_num].ways[hit_way].valid && _cache[set_num].ways[hit_way].tag == tag);
-
-#if 0
-	//print tlb
-	if(_tlb.find(tag) != _tlb.end())
-	{
-        info("In DramCache, DramCache hit, access address is 0x%lx, tag is 0x%lx", req.lineAddr, tag);
+// Off-package write of a dirty victim, whose data is read out of MC-Dram by
+// ready_cycle. Without a write-back buffer it is issued now, as access type
+// type. Returns the off-package bursts issued now.
+uint64_t
+MemoryController::writeBack(MemReq& req, Address tag, Address addr, uint32_t size, uint32_t type, uint64_t cycle, uint64_t ready_cycle, bool functional)
+{
+	MESIState state;
+	if (!_wb_buffer || functional) {
+		MemReq wb_req = {addr, PUTX, req.childId, &state, cycle, req.childLock, req.initialState, req.srcId, req.flags};
+		extDramAccess(wb_req, type, size, functional);
+		return size;
+	}
+	uint64_t bursts = 0;
+	futex_lock(&_wb_lock);
+	if (_wb_buffer->full()) {
+		bursts += drainWriteBack(req, _wb_buffer->pop(), functional);
+		_numWBForcedDrains.atomicInc();
 	}
+	_wb_buffer->push({tag, addr, size, ready_cycle});
+	_numWBBuffered.atomicInc();
+	futex_unlock(&_wb_lock);
+	return bursts;
+}
 
-#endif
-		} else if (_scheme != Tagless) {
-			// for Tagless, this assertion takes too much time.
-			for (uint32_t i = 0; i < _num_ways; i ++)
-				assert(_cache[set_num].ways[i].tag != tag || !_cache[set_num].ways[i].valid);
-		}
+// Issues a buffered write-back off the critical path of req
+uint64_t
+MemoryController::drainWriteBack(MemReq& req, const WriteBackBuffer::Entry &e, bool functional)
+{
+	MESIState state;
+	MemReq wb_req = {e.addr, PUTX, req.childId, &state, std::max(req.cycle, e.ready_cycle), req.childLock, req.initialState, req.srcId, req.flags};
+	extDramAccess(wb_req, 2, e.size, functional);
+	return e.size;
+}
 
-		if (_scheme == UnisonCache) {
-			//// Tag and data access. For simplicity, use a single access.
-			if (type == LOAD) {
-				req.lineAddr = mc_address; //transMCAddressPage(set_num, 0); //mc_address;
-				req.cycle = _mcdram[mcdram_select]->access(req, 0, 6);
-				_mc_bw_per_step += 6;
-				_numTagLoad.inc();
-				req.lineAddr = address;
-			} else {
-				assert(type == STORE);
-	            MemReq tag_probe = {mc_address, GETS, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
-				req.cycle = _mcdram[mcdram_select]->access(tag_probe, 0, 2);
-				_mc_bw_per_step += 2;
-				_numTagLoad.inc();
-			}
-			///////////////////////////////
-		}
-		if (_scheme == HybridCache && type == STORE) {
-			if (_tag_buffer->existInTB(tag) == _tag_buffer->getNumWays() && set_num >= _ds_index) {
-				_numTBDirtyMiss.inc();
-				if (!_sram_tag)
-					hybrid_tag_probe = true;
-			} else
-				_numTBDirtyHit.inc();
-		}
-		if (_scheme == HybridCache && _sram_tag)
-			req.cycle += _llc_latency;
- 	}
-   	else {
-		assert(_scheme == AlloyCache);
-		if (_cache[set_num].ways[0].valid && _cache[set_num].ways[0].tag == tag && set_num >= _ds_index)
-			hit_way = 0;
-		if (type == LOAD && set_num >= _ds_index) {
-			///// mcdram TAD access
-			// Modeling TAD as 2 cachelines
-			if (_sram_tag) {
-				req.cycle += _llc_latency;
-/*				if (hit_way == 0) {
-					req.lineAddr = mc_address;
-					req.cycle = _mcdram[mcdram_select]->access(req, 0, 4);
-					_mc_bw_per_step += 4;
-					_numTagLoad.inc();
-					req.lineAddr = address;
-				}
-*/
-			} else {
-				req.lineAddr = mc_address;
-				req.cycle = _mcdram[mcdram_select]->access(req, 0, 6);
-				_mc_bw_per_step += 6;
-				_numTagLoad.inc();
-				req.lineAddr = address;
-			}
-			///////////////////////////////
-		}
-   	}
-	bool cache_hit = hit_way != _num_ways;
-
-	//orig_cycle = req.cycle;
-	// dram cache logic. Here, I'm assuming the 4 mcdram channels are
-	// organized centrally
-	bool counter_access = false;
-	// use the following state for requests, so that req.state is not changed
-	if (!cache_hit)
-	{
-		uint64_t cur_cycle = req.cycle;
-		_num_miss_per_step ++;
-		if (type == LOAD)
-			_numLoadMiss.inc();
-		else
-			_numStoreMiss.inc();
-
-		uint32_t replace_way = _num_ways;
-      	if (_scheme == AlloyCache) {
-			bool place = false;
-			if (set_num >= _ds_index)
-	         	place = _line_placement_policy->handleCacheMiss(&_cache[set_num].ways[0]);
-         	replace_way = place? 0 : 1;
-      	} else if (_scheme == HMA)
-         	_os_placement_policy->handleCacheAccess(tag, type);
-      	else if (_scheme == Tagless) {
-			replace_way = _next_evict_idx;
-			_next_evict_idx = (_next_evict_idx + 1) % _num_ways;
-		}
-		else {
-			if (set_num >= _ds_index)
-	        	replace_way = _page_placement_policy->handleCacheMiss(tag, type, set_num, &_cache[set_num], counter_access);
-		}
+// A miss reads its page back off-package. If the page's write-back is still
+// buffered, it goes out first, on the critical path as access type type, so
+// the read sees its data. Returns the access type of the read that follows.
+uint32_t
+MemoryController::drainMissWriteBack(MemReq& req, Address tag, uint32_t type, uint64_t &ext_bw, bool functional)
+{
+	if (!_wb_buffer || functional)
+		return type;
+	WriteBackBuffer::Entry e;
+	futex_lock(&_wb_lock);
+	bool buffered = _wb_buffer->take(tag, e);
+	futex_unlock(&_wb_lock);
+	if (!buffered)
+		return type;
+	MESIState state;
+	MemReq wb_req = {e.addr, PUTX, req.childId, &state, std::max(req.cycle, e.ready_cycle), req.childLock, req.initialState, req.srcId, req.flags};
+	req.cycle = extDramAccess(wb_req, type, e.size, false);
+	ext_bw += e.size;
+	_numWBMissDrains.atomicInc();
+	return 1;
+}
 
-		/////// load from external dram
-		if (_scheme == AlloyCache) {
-			if (type == LOAD) {
-				if (!_sram_tag && set_num >= _ds_index)
-					req.cycle = _ext_dram->access(req, 1, 4);
-				else
-					req.cycle = _ext_dram->access(req, 0, 4);
-				_ext_bw_per_step += 4;
-				data_ready_cycle = req.cycle;
-			} else if (type == STORE && replace_way >= _num_ways) {
-				// no replacement
-				req.cycle = _ext_dram->access(req, 0, 4);
-				_ext_bw_per_step += 4;
-				data_ready_cycle = req.cycle;
-			} else if (type == STORE) { // && replace_way < _num_ways)
-	            MemReq load_req = {address, GETS, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
-				req.cycle = _ext_dram->access(load_req, 0, 4);
-				_ext_bw_per_step += 4;
-				data_ready_cycle = req.cycle;
-			}
-		} else if (_scheme == HMA) {
-			req.cycle = _ext_dram->access(req, 0, 4);
-			_ext_bw_per_step += 4;
-			data_ready_cycle = req.cycle;
-		} else if (_scheme == UnisonCache) {
-			if (type == LOAD) {
-				req.cycle = _ext_dram->access(req, 1, 4);
-				_ext_bw_per_step += 4;
-			} else if (type == STORE && replace_way >= _num_ways) {
-				req.cycle = _ext_dram->access(req, 1, 4);
-				_ext_bw_per_step += 4;
-			}
-			data_ready_cycle = req.cycle;
-		} else if (_scheme == HybridCache) {
-			if (hybrid_tag_probe) {
-		        MemReq tag_probe = {mc_address, GETS, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
-				req.cycle = _mcdram[mcdram_select]->access(tag_probe, 0, 2);
-				_mc_bw_per_step += 2;
-				req.cycle = _ext_dram->access(req, 1, 4);
-				_ext_bw_per_step += 4;
-				_numTagLoad.inc();
-				data_ready_cycle = req.cycle;
-			} else {
-				req.cycle = _ext_dram->access(req, 0, 4);
-				_ext_bw_per_step += 4;
-				data_ready_cycle = req.cycle;
-			}
-		} else if (_scheme == Tagless) {
-			assert(_ext_dram);
-			req.cycle = _ext_dram->access(req, 0, 4);
-			_ext_bw_per_step += 4;
-			data_ready_cycle = req.cycle;
-		}
-		////////////////////////////////////
-
-		if (replace_way < _num_ways)
-      	{
-			///// mcdram replacement
-			// TODO update the address
-			if (_scheme == AlloyCache) {
-	            MemReq insert_req = {mc_address, PUTX, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
-				uint32_t size = _sram_tag? 4 : 6;
-				_mcdram[mcdram_select]->access(insert_req, 2, size);
-				_mc_bw_per_step += size;
-				_numTagStore.inc();
-			} else if (_scheme == UnisonCache || _scheme == HybridCache || _scheme == Tagless) {
-				uint32_t access_size = (_scheme == UnisonCache || _scheme == Tagless)? _footprint_size : (_granularity / 64);
-				// load page from ext dram
-		        MemReq load_req = {tag * 64, GETS, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
-				_ext_dram->access(load_req, 2, access_size*4);
-				_ext_bw_per_step += access_size * 4;
-				// store the page to mcdram
-		        MemReq insert_req = {mc_address, PUTX, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
-				_mcdram[mcdram_select]->access(insert_req, 2, access_size*4);
-				_mc_bw_per_step += access_size * 4;
-				if (_scheme == Tagless) {
-		        	MemReq load_gipt_req = {tag * 64, GETS, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
-		        	MemReq store_gipt_req = {tag * 64, PUTS, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
-					_ext_dram->access(load_gipt_req, 2, 2); // update GIPT
-					_ext_dram->access(store_gipt_req, 2, 2); // update GIPT
-					_ext_bw_per_step += 4;
-				} else if (!_sram_tag) {
-					_mcdram[mcdram_select]->access(insert_req, 2, 2); // store tag
-					_mc_bw_per_step += 2;
-				}
-				_numTagStore.inc();
-			}
-
-			///////////////////////////////
-			_numPlacement.inc();
-         	if (_cache[set_num].ways[replace_way].valid)
-			{
-				Address replaced_tag = _cache[set_num].ways[replace_way].tag;
-				// Note that tag_buffer is not updated if placed into an invalid entry.
-				// this is like ignoring the initialization cost
-				if (_scheme == HybridCache) {
-					// Update TagBuffer
-					//if (!_tag_buffer->canInsert(tag, replaced_tag)) {
-					//	printf("!!!!!!Occupancy = %f\n", _tag_buffer->getOccupancy());
-					//	_tag_buffer->clearTagBuffer();
-					//	_numTagBufferFlush.inc();
-					//}
-					//assert (_tag_buffer->canInsert(tag, replaced_tag));
-					assert(_tag_buffer->canInsert(tag, replaced_tag));
-					{
-						_tag_buffer->insert(tag, true);
-						_tag_buffer->insert(replaced_tag, true);
-					}
-					//else {
-					//	goto end;
-					//}
-				}
+// Runs at the end of each timed request, with its set lock held. If the
+// request made no off-package access, it drains the oldest write-back and
+// lets the cleaner write back the set's next victim, unless the request just
+// wrote it or off-package DRAM carries more than its share of recent traffic.
+template <Scheme Sch>
+void
+MemoryController::idleWriteBack(MemReq& req, uint64_t set_num, uint32_t hit_way, bool idle, uint64_t &mc_bw, uint64_t &ext_bw)
+{
+	// Drained writes hang off the request's timing record
+	EventRecorder * evRec = zinfo->eventRecorders[req.srcId];
+	if (evRec && !evRec->hasRecord())
+		return;
+	futex_lock(&_wb_lock);
+	_wbOccupancy.atomicInc(_wb_buffer->size());
+	if (idle && _wb_buffer->size()) {
+		ext_bw += drainWriteBack(req, _wb_buffer->pop(), false);
+		_numWBIdleDrains.atomicInc();
+	}
+	bool clean = idle && _wb_cleaner && _wb_buffer->size() < _wb_buffer->capacity() / 2;
+	futex_unlock(&_wb_lock);
+	uint64_t step_mc_bw = _mc_bw_per_step;
+	uint64_t step_ext_bw = _ext_bw_per_step;
+	if (step_ext_bw > _wb_clean_ext_share * (step_mc_bw + step_ext_bw))
+		clean = false;
+	if (!clean || set_num < _ds_index)
+		return;
 
-           		_tlb[replaced_tag].way = _num_ways;
-				// only used for UnisonCache
-				uint32_t unison_dirty_lines = __builtin_popcountll(_tlb[replaced_tag].dirty_bitvec) ;
-				uint32_t unison_touch_lines = __builtin_popcountll(_tlb[replaced_tag].touch_bitvec) ;
-				uint32_t untouch_lines = _granularity/64 - unison_touch_lines;
-				if (_scheme == UnisonCache || _scheme == Tagless || _scheme == HybridCache) {
-					assert(unison_touch_lines > 0);
-					assert(unison_touch_lines <= 64);
-					assert(unison_dirty_lines <= 64);
-					_numTouchedLines.inc(unison_touch_lines);
-					_numEvictedLines.inc(unison_dirty_lines);
-                    _numNotTouchedLines.inc(untouch_lines);
-				}
+	SchemeTag<Sch> sch;
+	uint32_t way = nextVictim(set_num, sch);
+	if (way >= _num_ways || (way == hit_way && req.type == PUTX) || !_cache.isValid(set_num, way) || !_cache.isDirty(set_num, way))
+		return;
+	Address victim_tag = _cache.getTag(set_num, way);
+	bool inserted;
+	TLBEntry * entry = _tlb[getLockStripe(set_num)].lookupOrInsert(victim_tag, _num_ways, inserted);
+	assert(!inserted || _granularity < 4096);
+	uint64_t lines = dirtyLines(entry, sch);
+	assert(lines > 0);
 
-				if (_cache[set_num].ways[replace_way].dirty) {
-					_numDirtyEviction.inc();
-					///////   store dirty line back to external dram
-					// Store starts after TAD is loaded.
-					// request not on critical path.
-					if (_scheme == AlloyCache) {
-						if (type == STORE) {
-							if (_sram_tag) {
-			        	    	MemReq load_req = {mc_address, GETS, req.childId, &state, cur_cycle, req.childLock, req.initialState, req.srcId, req.flags};
-								req.cycle = _mcdram[mcdram_select]->access(load_req, 2, 4);
-								_mc_bw_per_step += 4;
-								//_numTagLoad.inc();
-							}
-						}
-		        	    MemReq wb_req = {_cache[set_num].ways[replace_way].tag, PUTX, req.childId, &state, cur_cycle, req.childLock, req.initialState, req.srcId, req.flags};
-						_ext_dram->access(wb_req, 2, 4);
-						_ext_bw_per_step += 4;
-					} else if (_scheme == HybridCache) {
-						// load page from mcdram
-				        MemReq load_req = {mc_address, GETS, req.childId, &state, cur_cycle, req.childLock, req.initialState, req.srcId, req.flags};
-						_mcdram[mcdram_select]->access(load_req, 2, (_granularity / 64)*4);
-						_mc_bw_per_step += (_granularity / 64)*4;
-						// store page to ext dram
-						// TODO. this event should be appended under the one above.
-						// but they are parallel right now.
-	        	    	MemReq wb_req = {_cache[set_num].ways[replace_way].tag * 64, PUTX, req.childId, &state, cur_cycle, req.childLock, req.initialState, req.srcId, req.flags};
-						_ext_dram->access(wb_req, 2, (_granularity / 64) * 4);
-						_ext_bw_per_step += (_granularity / 64) * 4;
-					} else if (_scheme == UnisonCache || _scheme == Tagless) {
-						assert(unison_dirty_lines > 0);
-						// load page from mcdram
-						assert(unison_dirty_lines <= 64);
-				        MemReq load_req = {mc_address, GETS, req.childId, &state, cur_cycle, req.childLock, req.initialState, req.srcId, req.flags};
-						_mcdram[mcdram_select]->access(load_req, 2, unison_dirty_lines*4);
-						_mc_bw_per_step += unison_dirty_lines*4;
-						// store page to ext dram
-						// TODO. this event should be appended under the one above.
-						// but they are parallel right now.
-	        	    	MemReq wb_req = {_cache[set_num].ways[replace_way].tag * 64, PUTX, req.childId, &state, cur_cycle, req.childLock, req.initialState, req.srcId, req.flags};
-						_ext_dram->access(wb_req, 2, unison_dirty_lines*4);
-						_ext_bw_per_step += unison_dirty_lines*4;
-						if (_scheme == Tagless) {
-				        	MemReq load_gipt_req = {tag * 64, GETS, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
-				        	MemReq store_gipt_req = {tag * 64, PUTS, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
-							_ext_dram->access(load_gipt_req, 2, 2); // update GIPT
-							_ext_dram->access(store_gipt_req, 2, 2); // update GIPT
-							_ext_bw_per_step += 4;
-						}
-					}
-
-					/////////////////////////////
-            	} else {
-					_numCleanEviction.inc();
-					 if (_scheme == UnisonCache || _scheme == Tagless)
-						assert(unison_dirty_lines == 0);
-				}
-         	}
-         	_cache[set_num].ways[replace_way].valid = true;
-			_cache[set_num].ways[replace_way].tag = tag;
-         	_cache[set_num].ways[replace_way].dirty = (req.type == PUTX);
-         	_tlb[tag].way = replace_way;
-			if (_scheme == UnisonCache || _scheme == Tagless || _scheme == HybridCache) {
-				uint64_t bit = (address - tag * 64) ;
-				assert(bit < 64 && bit >= 0);
-				bit = ((uint64_t)1UL) << bit;
-				_tlb[tag].touch_bitvec = 0;
-				_tlb[tag].dirty_bitvec = 0;
-				_tlb[tag].touch_bitvec |= bit;
-				if (type == STORE)
-					_tlb[tag].dirty_bitvec |= bit;
-			}
-      	} else {
-			// Miss but no replacement
-			if (_scheme == HybridCache)
-				if (type == LOAD && _tag_buffer->canInsert(tag))
-					_tag_buffer->insert(tag, false);
-			assert(_scheme != Tagless)
-		}
-	} else { // cache_hit == true
-		assert(set_num >= _ds_index);
-		if (_scheme == AlloyCache) {
-			if (type == LOAD && _sram_tag) {
-		        MemReq read_req = {mc_address, GETX, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
-				req.cycle = _mcdram[mcdram_select]->access(read_req, 0, 4);
-				_mc_bw_per_step += 4;
-			}
-			if (type == STORE) {
-				// LLC dirty eviction hit
-		        MemReq write_req = {mc_address, PUTX, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
-				req.cycle = _mcdram[mcdram_select]->access(write_req, 0, 4);
-				_mc_bw_per_step += 4;
-			}
-		} else if (_scheme == UnisonCache && type == STORE)	{
-			// LLC dirty eviction hit
-	        MemReq write_req = {mc_address, PUTX, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
-			req.cycle = _mcdram[mcdram_select]->access(write_req, 1, 4);
-			_mc_bw_per_step += 4;
-		}
-		if (_scheme == AlloyCache || _scheme == UnisonCache)
-			data_ready_cycle = req.cycle;
-		_num_hit_per_step ++;
-      	if (_scheme == HMA)
-        	_os_placement_policy->handleCacheAccess(tag, type);
-      	else if (_scheme == HybridCache || _scheme == UnisonCache) {
-	       	_page_placement_policy->handleCacheHit(tag, type, set_num, &_cache[set_num], counter_access, hit_way);
-		}
+	Address victim_addr = blockAddress(victim_tag, sch);
+	uint32_t mcdram_select = (victim_addr / 64) % _mcdram_per_mc;
+	Address mc_address = (victim_addr / 64 / _mcdram_per_mc * 64) | (victim_addr % 64);
+	if (_physical_layout)
+		mcdramLocate(set_num, way, victim_addr, mcdram_select, mc_address, sch);
+	MESIState state;
+	MemReq load_req = {mc_address, GETS, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
+	uint64_t read_cycle = mcdramAccess(mcdram_select, load_req, 2, lines * 4, false);
+	mc_bw += lines * 4;
+	_cache.clearDirty(set_num, way);
+	entry->dirty_bitvec = 0;
+	entry->cleaned = true;
+	_numCleanerWritebacks.atomicInc();
+	ext_bw += writeBack(req, victim_tag, victim_addr, lines * 4, 2, req.cycle, read_cycle, false);
+}
 
+// Page schemes: the placement policy's next victim
+template <Scheme Sch>
+uint32_t
+MemoryController::nextVictim(uint64_t set, SchemeTag<Sch>)
+{
+	return _page_placement_policy->peekVictim(set);
+}
 
-		if (req.type == PUTX) {
-			_numStoreHit.inc();
-			_cache[set_num].ways[hit_way].dirty = true;
-		}
-		else
-			_numLoadHit.inc();
-
-		if (_scheme == HybridCache) {
-			if (!hybrid_tag_probe) {
-				req.lineAddr = mc_address;
-				req.cycle = _mcdram[mcdram_select]->access(req, 0, 4);
-				_mc_bw_per_step += 4;
-				req.lineAddr = address;
-				data_ready_cycle = req.cycle;
-				if (type == LOAD && _tag_buffer->canInsert(tag)){
-					_tag_buffer->insert(tag, false);}
-
-                uint64_t bit = (address - tag * 64);
-                assert(bit < 64 && bit >= 0);
-                bit = ((uint64_t)1UL) << bit;
-                _tlb[tag].touch_bitvec |= bit;
-                if (type == STORE)
-                    _tlb[tag].dirty_bitvec |= bit;
-            } else {
-				assert(!_sram_tag);
-	            MemReq tag_probe = {mc_address, GETS, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
-				req.cycle = _mcdram[mcdram_select]->access(tag_probe, 0, 2);
-				_mc_bw_per_step += 2;
-				_numTagLoad.inc();
-				req.lineAddr = mc_address;
-				req.cycle = _mcdram[mcdram_select]->access(req, 1, 4);
-				_mc_bw_per_step += 4;
-				req.lineAddr = address;
-				data_ready_cycle = req.cycle;
-
-                uint64_t bit = (address - tag * 64);
-                assert(bit < 64 && bit >= 0);
-                bit = ((uint64_t)1UL) << bit;
-                _tlb[tag].touch_bitvec |= bit;
-                if (type == STORE)
-                    _tlb[tag].dirty_bitvec |= bit;
-			}
+// Sectored pages only write back their dirty sectors
+uint64_t
+MemoryController::dirtyLines(TLBEntry * entry, SchemeTag<HybridCache>)
+{
+	assert(entry);
+	return isSectored()? dirtySectors(entry->dirty_bitvec) * _sector_lines : _granularity / 64;
+}
+
+// Halves a per-step counter that other requests may be adding to, and
+// returns the new value.
+static uint64_t
+halveCounter(uint64_t &counter)
+{
+	uint64_t old_value = counter;
+	while (!__sync_bool_compare_and_swap(&counter, old_value, old_value / 2))
+		old_value = counter;
+	return old_value / 2;
+}
+
+// Runs every step_length requests: ages the per-step hit/miss and bandwidth
+// counters and, with BATMAN, retargets _ds_index.
+void
+MemoryController::endStep()
+{
+	halveCounter(_num_hit_per_step);
+	halveCounter(_num_miss_per_step);
+	uint64_t mc_bw = halveCounter(_mc_bw_per_step);
+	uint64_t ext_bw = halveCounter(_ext_bw_per_step);
+	if (_bw_balance && mc_bw + ext_bw > 0) {
+		// adjust _ds_index	based on mc vs. ext dram bandwidth.
+		// The larger the gap between ratios, the more _ds_index changes.
+		double ratio = 1.0 * mc_bw / (mc_bw + ext_bw);
+		uint64_t index_step = _num_sets * _bw_balance_step; // in terms of the number of sets
+		int64_t delta_index = (ratio - _bw_balance_target > -0.02 && ratio - _bw_balance_target < 0.02)?
+				0 : index_step * (ratio - _bw_balance_target) / 0.01;
+		futex_lock(&_ds_lock);
+		int64_t target = (int64_t)_ds_index + delta_index;
+		_ds_target = (target <= 0)? 0 : std::min((uint64_t)target, _num_sets);
+		// Sets below _ds_index were emptied when they were reclaimed
+		if (_ds_target < _ds_index)
+			_ds_index = _ds_target;
+		futex_unlock(&_ds_lock);
+	}
+}
+
+// BATMAN: raises _ds_index by up to _bw_balance_sets sets towards _ds_target.
+// The dirty ways of each set are written back off the critical path of req,
+// then all its ways are invalidated. Called without locks held; skipped if
+// another request is already reclaiming.
+template <Scheme Sch>
+void
+MemoryController::reclaimSets(MemReq& req, bool functional)
+{
+	// The writes hang off the request's timing record
+	EventRecorder * evRec = zinfo->eventRecorders[req.srcId];
+	if (!functional && evRec && !evRec->hasRecord())
+		return;
+	if (!futex_trylock(&_ds_lock))
+		return;
+	uint64_t mc_bw = 0;
+	uint64_t ext_bw = 0;
+	for (uint32_t i = 0; i < _bw_balance_sets && _ds_index < _ds_target; i++) {
+		uint64_t set = _ds_index;
+		lock_t * set_lock = &_set_locks[getLockStripe(set)].lock;
+		futex_lock(set_lock);
+		reclaimSet(req, set, functional, mc_bw, ext_bw, SchemeTag<Sch>());
+		// Requests that were waiting for the set now bypass it
+		_ds_index = set + 1;
+		futex_unlock(set_lock);
+		_numRebalanceSets.atomicInc();
+	}
+	futex_unlock(&_ds_lock);
+	if (!functional) {
+		__sync_fetch_and_add(&_mc_bw_per_step, mc_bw);
+		__sync_fetch_and_add(&_ext_bw_per_step, ext_bw);
+	}
+}
+
+template <Scheme Sch>
+void
+MemoryController::reclaimSet(MemReq& req, uint64_t set, bool functional, uint64_t &mc_bw, uint64_t &ext_bw, SchemeTag<Sch>)
+{
+	reclaimWays<Sch>(req, set, functional, mc_bw, ext_bw);
+}
+
+// The set's pages are remapped to off-package DRAM, which the tag buffer
+// records like any other remap
+void
+MemoryController::reclaimSet(MemReq& req, uint64_t set, bool functional, uint64_t &mc_bw, uint64_t &ext_bw, SchemeTag<HybridCache>)
+{
+	futex_lock(&_tag_buffer_lock);
+	reclaimWays<HybridCache>(req, set, functional, mc_bw, ext_bw);
+	_page_placement_policy->flushChunk(set);
+	futex_unlock(&_tag_buffer_lock);
+}
+
+void
+MemoryController::reclaimWay(MemReq& req, Address tag, bool functional, SchemeTag<HybridCache>)
+{
+	if (!_tag_buffer->canInsert(tag))
+		flushTagBuffer(req, functional);
+	assert(_tag_buffer->canInsert(tag));
+	_tag_buffer->insert(tag, true);
+}
+
+// Writes back the dirty ways of the set and invalidates all of them. Caller
+// holds the set lock.
+template <Scheme Sch>
+void
+MemoryController::reclaimWays(MemReq& req, uint64_t set, bool functional, uint64_t &mc_bw, uint64_t &ext_bw)
+{
+	SchemeTag<Sch> sch;
+	MESIState state;
+	for (uint32_t way = 0; way < _num_ways; way ++) {
+		if (!_cache.isValid(set, way))
+			continue;
+		Address meta_tag = _cache.getTag(set, way);
+		TLBEntry * entry = _tlb[getLockStripe(set)].lookup(meta_tag);
+		if (_cache.isDirty(set, way)) {
+			uint64_t lines = dirtyLines(entry, sch);
+			Address addr = blockAddress(meta_tag, sch);
+			uint32_t mcdram_select = (addr / 64) % _mcdram_per_mc;
+			Address mc_address = (addr / 64 / _mcdram_per_mc * 64) | (addr % 64);
+			if (_physical_layout)
+				mcdramLocate(set, way, addr, mcdram_select, mc_address, sch);
+			MemReq load_req = {mc_address, GETS, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
+			uint64_t read_cycle = mcdramAccess(mcdram_select, load_req, 2, lines * 4, functional);
+			mc_bw += lines * 4;
+			ext_bw += writeBack(req, meta_tag, addr, lines * 4, 3, req.cycle, read_cycle, functional);
+			_numRebalanceWritebacks.atomicInc();
+			_numRebalanceBytes.atomicInc(lines * 64);
 		}
-		else if (_scheme == Tagless) {
-			req.lineAddr = mc_address;
-			req.cycle = _mcdram[mcdram_select]->access(req, 0, 4);
-			_mc_bw_per_step += 4;
-			req.lineAddr = address;
-			data_ready_cycle = req.cycle;
-
-			uint64_t bit = (address - tag * 64);
-            //info("Address:0x%lx, bit:%ld, tag:0x%lx, address-tag*64:%ld", address, bit, tag, address-tag*64);
-			assert(bit < 64 && bit >= 0);
-			bit = ((uint64_t)1UL) << bit;
-			_tlb[tag].touch_bitvec |= bit;
-			if (type == STORE)
-				_tlb[tag].dirty_bitvec |= bit;
+		// Lock-free residency queries must not see the line any more
+		if (entry)
+			PageTable::setWay(entry, _num_ways);
+		reclaimWay(req, meta_tag, functional, sch);
+		_cache.invalidate(set, way);
+	}
+}
+
+// HMA epoch end. Hot pages not in MC-Dram take the free ways first, then the
+// ways of cached pages that are no longer hot. Each move copies the page in
+// from off-package DRAM and, if the evicted page is dirty, copies it back
+// first. The copies are off the critical path of the request that ends the
+// epoch.
+uint64_t
+MemoryController::remapPages(MemReq& req, bool functional)
+{
+	assert(_num_sets == 1);
+	PageTable &tlb = _tlb[0];
+	g_vector<TLBEntry *> hot;
+	_os_placement_policy->selectHotPages(&tlb, hot);
+
+	// Ways held by hot pages stay put
+	g_vector<bool> keep(_num_ways, false);
+	for (TLBEntry * page : hot)
+		if (page->way != _num_ways)
+			keep[page->way] = true;
+
+	MESIState state;
+	uint64_t page_bw = (_granularity / 64) * 4;
+	uint64_t mc_bw = 0;
+	uint64_t ext_bw = 0;
+	uint64_t num_moves = 0;
+	uint32_t next_way = 0;
+	for (TLBEntry * page : hot) {
+		if (page->way != _num_ways)
+			continue;
+		// Invalid ways first, then any way not kept
+		uint32_t way = _cache.getEmptyWay(0);
+		if (way == _num_ways) {
+			while (keep[next_way] || !_cache.isValid(0, next_way))
+				next_way ++;
+			way = next_way;
 		}
+		keep[way] = true;
+		uint32_t frame_mc;
+		Address frame_address;
+		if (_physical_layout)
+			mcdramLocate(0, way, 0, frame_mc, frame_address, SchemeTag<HMA>());
 
-		//// data access
-		if (_scheme == HMA) {
-			req.lineAddr = mc_address; //transMCAddressPage(set_num, hit_way); //mc_address;
-			req.cycle = _mcdram[mcdram_select]->access(req, 0, 4);
-			_mc_bw_per_step += 4;
-			req.lineAddr = address;
-			data_ready_cycle = req.cycle;
+		if (_cache.isValid(0, way)) {
+			Address victim = _cache.getTag(0, way);
+			PageTable::setWay(tlb.lookup(victim), _num_ways);
+			if (_cache.isDirty(0, way)) {
+				if (!_physical_layout) {
+					frame_mc = victim % _mcdram_per_mc;
+					frame_address = victim / _mcdram_per_mc * 64;
+				}
+				MemReq load_req = {frame_address, GETS, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
+				mcdramAccess(frame_mc, load_req, 2, page_bw, functional);
+				MemReq wb_req = {victim * 64, PUTX, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
+				extDramAccess(wb_req, 3, page_bw, functional);
+				mc_bw += page_bw;
+				ext_bw += page_bw;
+				_numDirtyEviction.atomicInc();
+			} else
+				_numCleanEviction.atomicInc();
 		}
-		if (_scheme == UnisonCache) {
-			// Update LRU information for UnisonCache
-		    MemReq tag_update_req = {mc_address, PUTX, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
-			_mcdram[mcdram_select]->access(tag_update_req, 2, 2);
-			_mc_bw_per_step += 2;
-			_numTagStore.inc();
-			uint64_t bit = (address - tag * 64);
-			assert(bit < 64 && bit >= 0);
-			bit = ((uint64_t)1UL) << bit;
-			_tlb[tag].touch_bitvec |= bit;
-			if (type == STORE)
-				_tlb[tag].dirty_bitvec |= bit;
+
+		MemReq load_req = {page->tag * 64, GETS, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
+		extDramAccess(load_req, 2, page_bw, functional);
+		if (!_physical_layout) {
+			frame_mc = page->tag % _mcdram_per_mc;
+			frame_address = page->tag / _mcdram_per_mc * 64;
 		}
-		///////////////////////////////
+		MemReq fill_req = {frame_address, PUTX, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
+		mcdramAccess(frame_mc, fill_req, 3, page_bw, functional);
+		mc_bw += page_bw;
+		ext_bw += page_bw;
+		_cache.fill(0, way, page->tag, false);
+		PageTable::setWay(page, way);
+		num_moves ++;
 	}
-//end:
-	// TODO. make this part work again.
-	if (counter_access && !_sram_tag) {
-		// TODO may not need the counter load if we can store freq info inside TAD
-		/////// model counter access in mcdram
-		// One counter read and one coutner write
-		assert(set_num >= _ds_index);
-		_numCounterAccess.inc();
-        MemReq counter_req = {mc_address, GETS, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
-		_mcdram[mcdram_select]->access(counter_req, 2, 2);
-		counter_req.type = PUTX;
-		_mcdram[mcdram_select]->access(counter_req, 2, 2);
-		_mc_bw_per_step += 4;
-		//////////////////////////////////////
+	if (!functional) {
+		// Requests that already dropped their set lock may be adding theirs
+		__sync_fetch_and_add(&_mc_bw_per_step, mc_bw);
+		__sync_fetch_and_add(&_ext_bw_per_step, ext_bw);
 	}
-	if (_scheme == HybridCache && _tag_buffer->getOccupancy() > 0.7) {
-		printf("[Tag Buffer FLUSH] occupancy = %f\n", _tag_buffer->getOccupancy());
-		_tag_buffer->clearTagBuffer();
-		_tag_buffer->setClearTime(req.cycle);
-		_numTagBufferFlush.inc();
+	return num_moves;
+}
+
+// The OS rewrites the PTEs of all remapped pages and shoots down the stale
+// TLB entries. This is an approximate traffic model: the controller only
+// knows physical page tags, not the virtual pages that map them, so PTEs are
+// 8-byte entries indexed by page tag in a region of their own (PTE_LINES),
+// above any data line. Remaps of neighboring pages share a line and are
+// batched into a single read-modify-write. Returns the cycle the PTE updates
+// complete. With _tb_flush_stall, every core then takes the shootdown. A
+// functional flush only clears the tag buffer.
+// Caller holds _tag_buffer_lock.
+uint64_t
+MemoryController::flushTagBuffer(MemReq& req, bool functional)
+{
+	g_vector<Address> pte_lines;
+	if (!functional)
+		_tag_buffer->forEachRemap([&](Address tag) { pte_lines.push_back(PTE_LINES + tag / 8); });
+	std::sort(pte_lines.begin(), pte_lines.end());
+	pte_lines.erase(std::unique(pte_lines.begin(), pte_lines.end()), pte_lines.end());
+
+	// Not on the requester's critical path; the stall, if any, is charged by the caller
+	uint64_t done_cycle = req.cycle;
+	MESIState state;
+	for (Address line : pte_lines) {
+		MemReq load_req = {line, GETS, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
+		uint64_t load_done = extDramAccess(load_req, 2, 4, functional);
+		// The store writes back what the load read
+		MemReq store_req = {line, PUTX, req.childId, &state, load_done, req.childLock, req.initialState, req.srcId, req.flags};
+		uint64_t store_done = extDramAccess(store_req, 3, 4, functional);
+		done_cycle = std::max(done_cycle, store_done);
 	}
+	uint64_t shootdown_cycles = functional? 0 : _tb_shootdown_latency;
+	if (_tb_flush_stall && shootdown_cycles)
+		__sync_fetch_and_add(&zinfo->tlbShootdownCycles, shootdown_cycles);
+	__sync_fetch_and_add(&_ext_bw_per_step, pte_lines.size() * 8);
 
-	// TODO. Make the timing info here correct.
-	// TODO. should model system level stall
-	if (_scheme == HMA && _num_requests % _os_quantum == 0) {
-      	uint64_t num_replace = _os_placement_policy->remapPages();
-		_numPlacement.inc(num_replace * 2);
-   	}
-
-	if (_num_requests % step_length == 0)
-	{
-		_num_hit_per_step /= 2;
-		_num_miss_per_step /= 2;
-		_mc_bw_per_step /= 2;
-		_ext_bw_per_step /= 2;
-		if (_bw_balance && _mc_bw_per_step + _ext_bw_per_step > 0) {
-			// adjust _ds_index	based on mc vs. ext dram bandwidth.
-			double ratio = 1.0 * _mc_bw_per_step / (_mc_bw_per_step + _ext_bw_per_step);
-			double target_ratio = 0.8;  // because mc_bw = 4 * ext_bw
-
-			// the larger the gap between ratios, the more _ds_index changes.
-			// _ds_index changes in the granualrity of 1/1000 dram cache capacity.
-			// 1% in the ratio difference leads to 1/1000 _ds_index change.
-			// 300 is arbitrarily chosen.
-			// XXX XXX XXX
-			// 1000 is only used for graph500 and pagerank.
-			//uint64_t index_step = _num_sets / 300; // in terms of the number of sets
-			uint64_t index_step = _num_sets / 1000; // in terms of the number of sets
-			int64_t delta_index = (ratio - target_ratio > -0.02 && ratio - target_ratio < 0.02)?
-					0 : index_step * (ratio - target_ratio) / 0.01;
-			printf("ratio = %f\n", ratio);
-			if (delta_index > 0) {
-				// _ds_index will increase. All dirty data between _ds_index and _ds_index + delta_index
-				// should be written back to external dram.
-				// For Alloy cache, this is relatively easy.
-				// For Hybrid, we need to update tag buffer as well...
-				for (uint32_t mc = 0; mc < _mcdram_per_mc; mc ++) {
-					for (uint64_t set = _ds_index; set < (uint64_t)(_ds_index + delta_index); set ++) {
-						if (set >= _num_sets) break;
-						for (uint32_t way = 0; way < _num_ways; way ++)	 {
-							Way &meta = _cache[set].ways[way];
-							if (meta.valid && meta.dirty) {
-								// should write back to external dram.
-						        MemReq load_req = {meta.tag * 64, GETS, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
-								_mcdram[mc]->access(load_req, 2, (_granularity / 64)*4);
-						        MemReq wb_req = {meta.tag * 64, GETS, req.childId, &state, req.cycle, req.childLock, req.initialState, req.srcId, req.flags};
-								_ext_dram->access(wb_req, 2, (_granularity / 64)*4);
-								_ext_bw_per_step += (_granularity / 64)*4;
-								_mc_bw_per_step += (_granularity / 64)*4;
-							}
-							if (_scheme == HybridCache && meta.valid) {
-				           		_tlb[meta.tag].way = _num_ways;
-								// for Hybrid cache, should insert to tag buffer as well.
-								if (!_tag_buffer->canInsert(meta.tag)) {
-									printf("Rebalance. [Tag Buffer FLUSH] occupancy = %f\n", _tag_buffer->getOccupancy());
-									_tag_buffer->clearTagBuffer();
-									_tag_buffer->setClearTime(req.cycle);
-									_numTagBufferFlush.inc();
-								}
-								assert(_tag_buffer->canInsert(meta.tag));
-								_tag_buffer->insert(meta.tag, true);
-							}
-							meta.valid = false;
-							meta.dirty = false;
-						}
-						if (_scheme == HybridCache)
-							_page_placement_policy->flushChunk(set);
-					}
-				}
-			}
-			_ds_index = ((int64_t)_ds_index + delta_index <= 0)? 0 : _ds_index + delta_index;
-			printf("_ds_index = %ld/%ld\n", _ds_index, _num_sets);
-		}
+	_numTagBufferFlush.atomicInc();
+	_numTBFlushEntries.atomicInc(_tag_buffer->getNumRemaps());
+	_numTBFlushCycles.atomicInc(done_cycle - req.cycle + shootdown_cycles);
+	_numTBFlushBytes.atomicInc(pte_lines.size() * 2 * 64);
+	_tag_buffer->clearTagBuffer();
+	_tag_buffer->setClearTime(req.cycle);
+	return done_cycle;
+}
+
+// Leaves functional warmup. The event counters so far only describe the
+// warmup, so they start over; the footprint (touched pages) is kept.
+void
+MemoryController::endWarmup(uint64_t num_requests)
+{
+	if (!__sync_bool_compare_and_swap(&_warmup, true, false))
+		return;
+	Counter * counters[] = {&_numPlacement, &_numCleanEviction, &_numDirtyEviction,
+		&_numLoadHit, &_numLoadMiss, &_numStoreHit, &_numStoreMiss, &_numCounterAccess,
+		&_numTagLoad, &_numTagStore, &_numTagBufferFlush, &_numTBFlushEntries,
+		&_numTBFlushCycles, &_numTBFlushBytes, &_numTBDirtyHit, &_numTBDirtyMiss,
+		&_numTouchedLines, &_numEvictedLines, &_numNotTouchedLines, &_numFootprintLines,
+		&_numOverfetchLines, &_numUnderfetchLines, &_numFHTMiss, &_numSectorFills,
+		&_numMAPCorrect, &_numMAPFalseMiss, &_numMAPFalseHit, &_numRebalanceSets,
+		&_numRebalanceWritebacks, &_numRebalanceBytes, &_numWBBuffered, &_numWBIdleDrains,
+		&_numWBForcedDrains, &_numWBMissDrains, &_numCleanerWritebacks, &_numCleanedVictims};
+	for (Counter * c : counters)
+		c->set(0);
+	info("%s: DRAM cache warmup done after %ld requests", getName(), num_requests - 1);
+	saveCheckpoint();
+}
+
+class FreeRetiredTablesEvent : public Event {
+	private:
+		MemoryController * mc;
+	public:
+		explicit FreeRetiredTablesEvent(MemoryController * _mc) : Event(1), mc(_mc) {}
+		void callback() { mc->freeRetiredTables(); }
+};
+
+void
+MemoryController::enableResidencyQueries()
+{
+	if (_scheme == NoCache || _scheme == CacheOnly || _residency_queries)
+		return;
+	_residency_queries = true;
+	for (uint32_t i = 0; i < _num_set_locks; i++)
+		_tlb[i].keepRetired();
+	zinfo->eventQueue->insert(new FreeRetiredTablesEvent(this));
+}
+
+void
+MemoryController::freeRetiredTables()
+{
+	// Fast-forwarded threads may still insert pages (ffWarmup)
+	for (uint32_t i = 0; i < _num_set_locks; i++) {
+		futex_lock(&_set_locks[i].lock);
+		_tlb[i].freeRetired();
+		futex_unlock(&_set_locks[i].lock);
 	}
+}
 
+void
+MemoryController::lockAllSets()
+{
+	// Always in stripe order, so concurrent slow paths cannot deadlock
+	for (uint32_t i = 0; i < _num_set_locks; i++)
+		futex_lock(&_set_locks[i].lock);
+	futex_lock(&_tag_buffer_lock);
+}
 
- 	futex_unlock(&_lock);
-	//uint64_t latency = req.cycle - orig_cycle;
-	//req.cycle = orig_cycle;
-	return data_ready_cycle; //req.cycle + latency;
+void
+MemoryController::unlockAllSets()
+{
+	futex_unlock(&_tag_buffer_lock);
+	for (uint32_t i = 0; i < _num_set_locks; i++)
+		futex_unlock(&_set_locks[i].lock);
 }
 
 DDRMemory*
@@ -801,6 +1685,9 @@ MemoryController::BuildDDRMemory(Config& config, uint32_t frequency,
 
     auto mem = (DDRMemory *) gm_malloc(sizeof(DDRMemory));
 	new (mem) DDRMemory(zinfo->lineSize, pageSize, ranksPerChannel, banksPerRank, frequency, tech, addrMapping, controllerLatency, queueDepth, maxRowHits, deferWrites, closedPage, domain, name, tBL, timing_scale);
+	// Page fills and write-backs are split into this many sub-requests
+	// (1 = one request per transfer)
+	mem->setMaxBulkRequests(config.get<uint32_t>(prefix + "bulkRequests", 1));
     return mem;
 }
 
@@ -822,6 +1709,9 @@ MemoryController::initStats(AggregateStat* parentStat)
 	_numTagLoad.init("tagLoad", "Number of tag loads"); memStats->append(&_numTagLoad);
 	_numTagStore.init("tagStore", "Number of tag stores"); memStats->append(&_numTagStore);
 	_numTagBufferFlush.init("tagBufferFlush", "Number of tag buffer flushes"); memStats->append(&_numTagBufferFlush);
+	_numTBFlushEntries.init("tbFlushEntries", "Remapped pages written back to the page table by flushes"); memStats->append(&_numTBFlushEntries);
+	_numTBFlushCycles.init("tbFlushCycles", "Cycles spent in tag buffer flushes (PTE updates and shootdown)"); memStats->append(&_numTBFlushCycles);
+	_numTBFlushBytes.init("tbFlushBytes", "Off-package DRAM bytes moved for PTE updates"); memStats->append(&_numTBFlushBytes);
 
 	_numTBDirtyHit.init("TBDirtyHit", "Tag buffer hits (LLC dirty evict)"); memStats->append(&_numTBDirtyHit);
 	_numTBDirtyMiss.init("TBDirtyMiss", "Tag buffer misses (LLC dirty evict)"); memStats->append(&_numTBDirtyMiss);
@@ -830,7 +1720,52 @@ MemoryController::initStats(AggregateStat* parentStat)
 	_numEvictedLines.init("totalEvictLines", "total # of evicted lines in UnisonCache"); memStats->append(&_numEvictedLines);
 
 	_numTouchedPages.init("totalTouchedPages", "Number of pages touched"); memStats->append(&_numTouchedPages);
+	_numWarmupRequests.init("warmupReqs", "Functional-only requests (warmup)"); memStats->append(&_numWarmupRequests);
 	_numNotTouchedLines.init("totalNotTouchLines", "total # of never touched lines in HybridCache"); memStats->append(&_numNotTouchedLines);
+	if (_scheme == HybridCache && isSectored()) {
+		_numSectorFills.init("sectorFills", "Sectors filled on demand into cached pages"); memStats->append(&_numSectorFills);
+	}
+	if (_miss_predictor) {
+		_numMAPCorrect.init("mapCorrect", "Correct miss predictions"); memStats->append(&_numMAPCorrect);
+		_numMAPFalseMiss.init("mapFalseMiss", "Predicted misses that hit (wasted 64B off-package reads)"); memStats->append(&_numMAPFalseMiss);
+		_numMAPFalseHit.init("mapFalseHit", "Predicted hits that missed (serialized off-package reads)"); memStats->append(&_numMAPFalseHit);
+	}
+	if (_bw_balance) {
+		_numRebalanceSets.init("rebalanceSets", "Sets reclaimed from the DRAM cache by BATMAN"); memStats->append(&_numRebalanceSets);
+		_numRebalanceWritebacks.init("rebalanceWritebacks", "Dirty ways written back by BATMAN"); memStats->append(&_numRebalanceWritebacks);
+		_numRebalanceBytes.init("rebalanceBytes", "Bytes written back by BATMAN"); memStats->append(&_numRebalanceBytes);
+		auto dsIndexStat = makeLambdaStat([this]() { return _ds_index; });
+		dsIndexStat->init("dsIndex", "Sets below this one are not cached (BATMAN)"); memStats->append(dsIndexStat);
+	}
+	if (_wb_buffer) {
+		_numWBBuffered.init("wbBuffered", "Dirty victim write-backs put in the write-back buffer"); memStats->append(&_numWBBuffered);
+		_numWBIdleDrains.init("wbIdleDrains", "Write-backs drained by requests without off-package accesses"); memStats->append(&_numWBIdleDrains);
+		_numWBForcedDrains.init("wbForcedDrains", "Write-backs drained because the buffer was full"); memStats->append(&_numWBForcedDrains);
+		_numWBMissDrains.init("wbMissDrains", "Write-backs drained by a miss to their page"); memStats->append(&_numWBMissDrains);
+		_wbOccupancy.init("wbOccupancy", "Write-back buffer occupancy seen by timed requests", _wb_buffer->capacity() + 1); memStats->append(&_wbOccupancy);
+		if (_wb_cleaner) {
+			_numCleanerWritebacks.init("cleanerWritebacks", "Dirty victims written back early by the cleaner"); memStats->append(&_numCleanerWritebacks);
+			_numCleanedVictims.init("cleanedVictims", "Clean evictions of victims the cleaner wrote back"); memStats->append(&_numCleanedVictims);
+		}
+	}
+	if (_fht) {
+		_numFootprintLines.init("fpFetchLines", "Lines fetched by footprint fills"); memStats->append(&_numFootprintLines);
+		_numOverfetchLines.init("fpOverfetch", "Fetched lines evicted untouched"); memStats->append(&_numOverfetchLines);
+		_numUnderfetchLines.init("fpUnderfetch", "Loads to cached pages that missed the footprint"); memStats->append(&_numUnderfetchLines);
+		_numFHTMiss.init("fhtMiss", "Fills without a footprint history entry"); memStats->append(&_numFHTMiss);
+	}
+	if (_scheme != NoCache && _scheme != CacheOnly) {
+		auto tlbBytes = [this]() {
+			uint64_t bytes = 0;
+			for (uint32_t i = 0; i < _num_set_locks; i++)
+				bytes += _tlb[i].getMemUsage();
+			return bytes;
+		};
+		auto tlbBytesStat = makeLambdaStat(tlbBytes);
+		tlbBytesStat->init("tlbBytes", "Host memory used by the page table"); memStats->append(tlbBytesStat);
+		auto tagBytesStat = makeLambdaStat([this]() { return _cache.getMemUsage(); });
+		tagBytesStat->init("tagBytes", "Host memory reserved for the MC-Dram tag store"); memStats->append(tagBytesStat);
+	}
 
 	_ext_dram->initStats(memStats);
 	for (uint32_t i = 0; i < _mcdram_per_mc; i++)
@@ -840,71 +1775,158 @@ MemoryController::initStats(AggregateStat* parentStat)
 }
 
 
-Address
-MemoryController::transMCAddress(Address mc_addr)
+// TADs never straddle rows
+void
+MemoryController::mcdramLocate(uint64_t set, uint32_t way, Address line_addr, uint32_t &mc, Address &mc_addr, SchemeTag<AlloyCache>)
 {
-	// 28 lines per DRAM row (2048 KB row)
-	uint64_t num_lines_per_mc = 128*1024*1024 / 2048 * 28;
-	uint64_t set = mc_addr % num_lines_per_mc;
-	return set / 28 * 32 + set % 28;
+	uint64_t tads_per_row = _mcdram_row_lines * 64 / 72;
+	mc = set % _mcdram_per_mc;
+	uint64_t tad = set / _mcdram_per_mc;
+	uint64_t row = tad / tads_per_row;
+	uint64_t col = (tad % tads_per_row) * 72 / 64;
+	mc_addr = _mcdram_ddr? ((DDRMemory *) _mcdram[mc])->rowLineAddr(row, col) : row * _mcdram_row_lines + col;
 }
 
-Address
-MemoryController::transMCAddressPage(uint64_t set_num, uint32_t way_num)
+// Page schemes: each way is a page frame
+template <Scheme Sch>
+void
+MemoryController::mcdramLocate(uint64_t set, uint32_t way, Address line_addr, uint32_t &mc, Address &mc_addr, SchemeTag<Sch>)
+{
+	uint64_t frame_lines = _granularity / 64;
+	uint64_t frame;
+	if (_num_sets >= _mcdram_per_mc) {
+		mc = set % _mcdram_per_mc;
+		frame = set / _mcdram_per_mc * _num_ways + way;
+	} else {
+		uint64_t global_frame = set * _num_ways + way;
+		mc = global_frame % _mcdram_per_mc;
+		frame = global_frame / _mcdram_per_mc;
+	}
+	uint64_t line = frame * frame_lines + line_addr % frame_lines;
+	uint64_t row = line / _mcdram_row_lines;
+	uint64_t col = line % _mcdram_row_lines;
+	mc_addr = _mcdram_ddr? ((DDRMemory *) _mcdram[mc])->rowLineAddr(row, col) : row * _mcdram_row_lines + col;
+}
+
+void
+TagArray::init(uint64_t num_sets, uint32_t num_ways)
 {
-	return (_num_ways * set_num + way_num) * _granularity;
+	_num_sets = num_sets;
+	_num_ways = num_ways;
+	_num_words = (num_sets * num_ways + 63) / 64;
+	_tags = (Address *) gm_malloc(sizeof(Address) * num_sets * num_ways);
+	_valid = (uint64_t *) gm_malloc(sizeof(uint64_t) * _num_words);
+	_dirty = (uint64_t *) gm_malloc(sizeof(uint64_t) * _num_words);
+	memset(_valid, 0, sizeof(uint64_t) * _num_words);
+	memset(_dirty, 0, sizeof(uint64_t) * _num_words);
+}
+
+uint32_t
+TagArray::getEmptyWay(uint64_t set) const
+{
+	// Scan the set's valid bits a word at a time
+	uint64_t begin = idx(set, 0);
+	uint64_t end = begin + _num_ways;
+	for (uint64_t i = begin; i < end; ) {
+		uint64_t bits = std::min<uint64_t>(64 - i % 64, end - i);
+		uint64_t free = ~__atomic_load_n(&_valid[i / 64], __ATOMIC_RELAXED) >> (i % 64);
+		if (bits < 64)
+			free &= (1ul << bits) - 1;
+		if (free)
+			return i - begin + __builtin_ctzll(free);
+		i += bits;
+	}
+	return _num_ways;
 }
 
 TagBuffer::TagBuffer(Config & config)
 {
 	uint32_t tb_size = config.get<uint32_t>("sys.mem.mcdram.tag_buffer_size", 1024);
-	_num_ways = 8;
 	_num_sets = tb_size / _num_ways;
-	_entry_occupied = 0;
-	_tag_buffer = (TagBufferEntry **) gm_malloc(sizeof(TagBufferEntry *) * _num_sets);
-	//_tag_buffer = new TagBufferEntry * [_num_sets];
-	for (uint32_t i = 0; i < _num_sets; i++) {
-		_tag_buffer[i] = (TagBufferEntry *) gm_malloc(sizeof(TagBufferEntry) * _num_ways);
-		//_tag_buffer[i] = new TagBufferEntry [_num_ways];
-		for (uint32_t j = 0; j < _num_ways; j ++) {
-			_tag_buffer[i][j].remap = false;
-			_tag_buffer[i][j].tag = 0;
-			_tag_buffer[i][j].lru = j;
-		}
+	assert(_num_sets > 0);
+	_tags = (Address *) gm_malloc(sizeof(Address) * _num_sets * _num_ways);
+	_lru = (uint8_t *) gm_malloc(sizeof(uint8_t) * _num_sets * _num_ways);
+	_remap = (uint8_t *) gm_malloc(sizeof(uint8_t) * _num_sets);
+	clearTagBuffer();
+	_last_clear_time = 0;
+}
+
+FootprintHistoryTable::FootprintHistoryTable(uint32_t num_entries, uint32_t region_bits, uint32_t default_size)
+	: _region_bits(region_bits), _default_size(default_size)
+{
+	assert(num_entries >= 2 && (num_entries & (num_entries - 1)) == 0);
+	assert(default_size > 0 && default_size <= 64);
+	_shift = 64 - __builtin_ctz(num_entries);
+	_entries = (Entry *) gm_malloc(sizeof(Entry) * num_entries);
+	for (uint32_t i = 0; i < num_entries; i++)
+		_entries[i] = Entry {(Address) -1, 0};
+	futex_init(&_lock);
+}
+
+uint64_t
+FootprintHistoryTable::predict(Address tag, uint32_t trigger, bool &found)
+{
+	assert(trigger < 64);
+	Address k = key(tag, trigger);
+	futex_lock(&_lock);
+	Entry &e = _entries[index(k)];
+	found = e.key == k;
+	uint64_t footprint = e.footprint;
+	futex_unlock(&_lock);
+	if (!found) {
+		uint32_t start = trigger / _default_size * _default_size;
+		footprint = (_default_size == 64)? ~0ul : (((uint64_t)1UL << _default_size) - 1) << start;
 	}
+	return footprint | ((uint64_t)1UL << trigger);
 }
 
-uint32_t
-TagBuffer::existInTB(Address tag)
+void
+FootprintHistoryTable::train(Address tag, uint32_t trigger, uint64_t footprint)
 {
-	uint32_t set_num = tag % _num_sets;
-	for (uint32_t i = 0; i < _num_ways; i++)
-		if (_tag_buffer[set_num][i].tag == tag) {
-			//printf("existInTB\n");
-			return i;
-		}
-	return _num_ways;
+	Address k = key(tag, trigger);
+	futex_lock(&_lock);
+	Entry &e = _entries[index(k)];
+	e.key = k;
+	e.footprint = footprint;
+	futex_unlock(&_lock);
 }
 
-bool
-TagBuffer::canInsert(Address tag)
+MissPredictor::MissPredictor(uint32_t num_cores, uint32_t entries_per_core)
+	: _num_cores(num_cores), _entries_per_core(entries_per_core)
 {
-#if 1
-	uint32_t num = 0;
-	for (uint32_t i = 0; i < _num_sets; i++)
-		for (uint32_t j = 0; j < _num_ways; j++)
-			if (_tag_buffer[i][j].remap)
-				num ++;
-	assert(num == _entry_occupied);
-#endif
+	assert(num_cores > 0);
+	assert(entries_per_core >= 2 && (entries_per_core & (entries_per_core - 1)) == 0);
+	_shift = 64 - __builtin_ctz(entries_per_core);
+	_counters = (uint8_t *) gm_malloc(num_cores * entries_per_core);
+	// weakly predict hits
+	memset(_counters, 3, num_cores * entries_per_core);
+}
 
-	uint32_t set_num = tag % _num_sets;
-	//printf("tag_buffer=%#lx, set_num=%d, tag_buffer[set_num]=%#lx, num_ways=%d\n",
-	//	(uint64_t)_tag_buffer, set_num, (uint64_t)_tag_buffer[set_num], _num_ways);
+WriteBackBuffer::WriteBackBuffer(uint32_t num_entries)
+	: _num_entries(num_entries), _size(0)
+{
+	assert(num_entries > 0);
+	_entries = (Entry *) gm_malloc(sizeof(Entry) * num_entries);
+}
+
+uint32_t
+TagBuffer::matchWays(uint32_t set_num, Address tag)
+{
+	const Address * tags = &_tags[set_num * _num_ways];
+	uint32_t match = 0;
+#ifdef __SSE2__
+	// SSE2 has no 64-bit compare; a lane matches if both of its halves do.
+	__m128i key = _mm_set1_epi64x(tag);
+	for (uint32_t i = 0; i < _num_ways; i += 2) {
+		__m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) &tags[i]), key);
+		eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+		match |= _mm_movemask_pd(_mm_castsi128_pd(eq)) << i;
+	}
+#else
 	for (uint32_t i = 0; i < _num_ways; i++)
-		if (!_tag_buffer[set_num][i].remap || _tag_buffer[set_num][i].tag == tag)
-			return true;
-	return false;
+		match |= (tags[i] == tag) << i;
+#endif
+	return match;
 }
 
 bool
@@ -915,13 +1937,8 @@ TagBuffer::canInsert(Address tag1, Address tag2)
 	if (set_num1 != set_num2)
 		return canInsert(tag1) && canInsert(tag2);
 	else {
-		uint32_t num = 0;
-		for (uint32_t i = 0; i < _num_ways; i++)
-			if (!_tag_buffer[set_num1][i].remap
-				|| _tag_buffer[set_num1][i].tag == tag1
-				|| _tag_buffer[set_num1][i].tag == tag2)
-				num ++;
-		return num >= 2;
+		uint8_t usable = ~_remap[set_num1] | matchWays(set_num1, tag1) | matchWays(set_num1, tag2);
+		return __builtin_popcount(usable) >= 2;
 	}
 }
 
@@ -930,69 +1947,98 @@ TagBuffer::insert(Address tag, bool remap)
 {
 	uint32_t set_num = tag % _num_sets;
 	uint32_t exist_way = existInTB(tag);
-#if 1
-	for (uint32_t i = 0; i < _num_ways; i++)
-		for (uint32_t j = i+1; j < _num_ways; j++) {
-			//if (_tag_buffer[set_num][i].tag != 0 && _tag_buffer[set_num][i].tag == _tag_buffer[set_num][j].tag) {
-			//	for (uint32_t k = 0; k < _num_ways; k++)
-			//		printf("_tag_buffer[%d][%d]: tag=%ld, remap=%d\n",
-			//			set_num, k, _tag_buffer[set_num][k].tag, _tag_buffer[set_num][k].remap);
-			//}
-			assert(_tag_buffer[set_num][i].tag != _tag_buffer[set_num][j].tag
-				  || _tag_buffer[set_num][i].tag == 0);
-		}
-#endif
+	Address * tags = &_tags[set_num * _num_ways];
+	uint8_t * lru = &_lru[set_num * _num_ways];
 	if (exist_way < _num_ways) {
 		// the tag already exists in the Tag Buffer
-		assert(tag == _tag_buffer[set_num][exist_way].tag);
+		assert(tag == tags[exist_way]);
 		if (remap) {
-			if (!_tag_buffer[set_num][exist_way].remap)
+			if (!(_remap[set_num] & (1 << exist_way)))
 				_entry_occupied ++;
-			_tag_buffer[set_num][exist_way].remap = true;
-		} else if (!_tag_buffer[set_num][exist_way].remap)
+			_remap[set_num] |= 1 << exist_way;
+		} else if (!(_remap[set_num] & (1 << exist_way)))
 			updateLRU(set_num, exist_way);
+		checkConsistency(set_num);
 		return;
 	}
 
 	uint32_t max_lru = 0;
 	uint32_t replace_way = _num_ways;
 	for (uint32_t i = 0; i < _num_ways; i++) {
-		if (!_tag_buffer[set_num][i].remap && _tag_buffer[set_num][i].lru >= max_lru) {
-			max_lru = _tag_buffer[set_num][i].lru;
+		if (!(_remap[set_num] & (1 << i)) && lru[i] >= max_lru) {
+			max_lru = lru[i];
 			replace_way = i;
 		}
 	}
 	assert(replace_way != _num_ways);
-	_tag_buffer[set_num][replace_way].tag = tag;
-	_tag_buffer[set_num][replace_way].remap = remap;
+	tags[replace_way] = tag;
 	if (!remap) {
 		//printf("\tset=%d way=%d, insert. no remap\n", set_num, replace_way);
 		updateLRU(set_num, replace_way);
 	} else {
 		//printf("set=%d way=%d, insert\n", set_num, replace_way);
+		_remap[set_num] |= 1 << replace_way;
 		_entry_occupied ++;
 	}
+	checkConsistency(set_num);
+}
+
+// Lock-free: refreshes the LRU position of a tag that is not remapped.
+// A racing insert or flush can leave the order of the unremapped ways stale,
+// but never changes a tag or remap bit here.
+bool
+TagBuffer::touch(Address tag)
+{
+	uint32_t set_num = tag % _num_sets;
+	uint32_t way = existInTB(tag);
+	if (way == _num_ways)
+		return false;
+	uint8_t * lru = &_lru[set_num * _num_ways];
+	uint8_t remap = _remap[set_num];
+	if (!(remap & (1 << way))) {
+		for (uint32_t i = 0; i < _num_ways; i++)
+			if (!(remap & (1 << i)) && lru[i] < lru[way])
+				lru[i] ++;
+		lru[way] = 0;
+	}
+	return true;
 }
 
 void
 TagBuffer::updateLRU(uint32_t set_num, uint32_t way)
 {
-	assert(!_tag_buffer[set_num][way].remap);
+	uint8_t * lru = &_lru[set_num * _num_ways];
+	assert(!(_remap[set_num] & (1 << way)));
 	for (uint32_t i = 0; i < _num_ways; i++)
-		if (!_tag_buffer[set_num][i].remap && _tag_buffer[set_num][i].lru < _tag_buffer[set_num][way].lru)
-			_tag_buffer[set_num][i].lru ++;
-	_tag_buffer[set_num][way].lru = 0;
+		if (!(_remap[set_num] & (1 << i)) && lru[i] < lru[way])
+			lru[i] ++;
+	lru[way] = 0;
+}
+
+// Debug-only: the occupancy count must match the remap bits, and a tag may
+// only be in a set once. Both checks used to run on every access.
+void
+TagBuffer::checkConsistency(uint32_t set_num)
+{
+#ifdef DEBUG_TAG_BUFFER
+	uint32_t num = 0;
+	for (uint32_t i = 0; i < _num_sets; i++)
+		num += __builtin_popcount(_remap[i]);
+	assert(num == _entry_occupied);
+	Address * tags = &_tags[set_num * _num_ways];
+	for (uint32_t i = 0; i < _num_ways; i++)
+		for (uint32_t j = i+1; j < _num_ways; j++)
+			assert(tags[i] != tags[j] || tags[i] == 0);
+#endif
 }
 
 void
 TagBuffer::clearTagBuffer()
 {
 	_entry_occupied = 0;
-	for (uint32_t i = 0; i < _num_sets; i++) {
-		for (uint32_t j = 0; j < _num_ways; j ++) {
-			_tag_buffer[i][j].remap = false;
-			_tag_buffer[i][j].tag = 0;
-			_tag_buffer[i][j].lru = j;
-		}
-	}
+	memset(_tags, 0, sizeof(Address) * _num_sets * _num_ways);
+	memset(_remap, 0, sizeof(uint8_t) * _num_sets);
+	for (uint32_t i = 0; i < _num_sets; i++)
+		for (uint32_t j = 0; j < _num_ways; j ++)
+			_lru[i * _num_ways + j] = j;
 }
@@ -5,11 +5,17 @@
 #include "g_std/g_string.h"
 #include "memory_hierarchy.h"
 #include <string>
+#include <string.h>
+#include "pad.h"
+#include "page_table.h"
 #include "stats.h"
-#include "g_std/g_unordered_map.h"
 
 #define MAX_STEPS 10000
 
+class CheckpointWriter;
+class CheckpointReader;
+struct CheckpointGeometry;
+
 enum ReqType
 {
 	LOAD = 0,
@@ -27,77 +33,228 @@ enum Scheme
    Tagless
 };
 
-class Way
+// MC-Dram tag store, kept flat: the tags of all ways are one set-major array,
+// and the valid and dirty bits are packed into bitmaps with the same indexing.
+// Only the bitmaps are cleared at construction; a tag is never read unless
+// its valid bit is set, so the tag array is left untouched and its pages are
+// only backed by memory as ways fill. Neighboring sets share bitmap words but
+// may belong to different lock stripes, so the bits are updated atomically.
+class TagArray
 {
 public:
-   Address tag;
-   bool valid;
-   bool dirty;
-};
+	void init(uint64_t num_sets, uint32_t num_ways);
+
+	Address getTag(uint64_t set, uint32_t way) const { return _tags[idx(set, way)]; };
+	bool isValid(uint64_t set, uint32_t way) const { return getBit(_valid, idx(set, way)); };
+	bool isDirty(uint64_t set, uint32_t way) const { return getBit(_dirty, idx(set, way)); };
+	bool isHit(uint64_t set, uint32_t way, Address tag) const {
+		return isValid(set, way) && getTag(set, way) == tag;
+	};
+
+	void fill(uint64_t set, uint32_t way, Address tag, bool dirty) {
+		uint64_t i = idx(set, way);
+		_tags[i] = tag;
+		setBit(_valid, i, true);
+		setBit(_dirty, i, dirty);
+	};
+	void invalidate(uint64_t set, uint32_t way) {
+		uint64_t i = idx(set, way);
+		setBit(_valid, i, false);
+		setBit(_dirty, i, false);
+	};
+	void setDirty(uint64_t set, uint32_t way) { setBit(_dirty, idx(set, way), true); };
+	void clearDirty(uint64_t set, uint32_t way) { setBit(_dirty, idx(set, way), false); };
+
+	// First invalid way of the set, or num_ways if it is full
+	uint32_t getEmptyWay(uint64_t set) const;
+	bool hasEmptyWay(uint64_t set) const { return getEmptyWay(set) < _num_ways; };
+
+	uint64_t getMemUsage() const {
+		return _num_sets * _num_ways * sizeof(Address) + 2 * _num_words * sizeof(uint64_t);
+	};
+
+	// Only the tags of valid ways are saved
+	void save(CheckpointWriter &w);
+	void restore(CheckpointReader &r);
 
-class Set
-{
-public:
-   Way * ways;
-   uint32_t num_ways;
-
-   uint32_t getEmptyWay()
-   {
-      for (uint32_t i = 0; i < num_ways; i++)
-         if (!ways[i].valid)
-            return i;
-      return num_ways;
-   };
-   bool hasEmptyWay() { return getEmptyWay() < num_ways; };
+private:
+	uint64_t idx(uint64_t set, uint32_t way) const { return set * _num_ways + way; };
+	static bool getBit(const uint64_t * bits, uint64_t i) {
+		return (__atomic_load_n(&bits[i / 64], __ATOMIC_RELAXED) >> (i % 64)) & 1;
+	};
+	static void setBit(uint64_t * bits, uint64_t i, bool value) {
+		uint64_t mask = 1ul << (i % 64);
+		if (value)
+			__atomic_fetch_or(&bits[i / 64], mask, __ATOMIC_RELAXED);
+		else
+			__atomic_fetch_and(&bits[i / 64], ~mask, __ATOMIC_RELAXED);
+	};
+
+	Address * _tags;   // _num_sets x _num_ways
+	uint64_t * _valid; // one bit per way
+	uint64_t * _dirty; // one bit per way
+	uint64_t _num_words;
+	uint64_t _num_sets;
+	uint32_t _num_ways;
 };
 
 // Not modeling all details of the tag buffer.
-class TagBufferEntry
-{
-public:
-	Address tag;
-	bool remap;
-	uint32_t lru;
-};
-
+// Stored as struct-of-arrays: the 8 tags of a set are contiguous, so a lookup
+// compares them all at once and returns a bitmask of matching ways. Per set,
+// remap bits are kept as a way mask and LRU ranks as bytes. Tag 0 marks an
+// unused entry, as in the original model. Build with -DDEBUG_TAG_BUFFER to
+// re-check the occupancy count and tag uniqueness on every update.
 class TagBuffer : public GlobAlloc {
 public:
 	TagBuffer(Config &config);
 	// return: exists in tag buffer or not.
-	uint32_t existInTB(Address tag);
+	uint32_t existInTB(Address tag) {
+		uint32_t match = matchWays(tag % _num_sets, tag);
+		return match? __builtin_ctz(match) : _num_ways;
+	};
 	uint32_t getNumWays() { return _num_ways; };
 
 	// return: if the address can be inserted to tag buffer or not.
-	bool canInsert(Address tag);
+	bool canInsert(Address tag) {
+		uint32_t set_num = tag % _num_sets;
+		return (uint8_t)(~_remap[set_num] | matchWays(set_num, tag)) != 0;
+	};
 	bool canInsert(Address tag1, Address tag2);
 	void insert(Address tag, bool remap);
+	// A load hit: returns whether tag is buffered, refreshing its LRU
+	// position. Needs no lock.
+	bool touch(Address tag);
 	double getOccupancy() { return 1.0 * _entry_occupied / _num_ways / _num_sets; };
+	uint32_t getNumRemaps() { return _entry_occupied; };
+	// Calls f(tag) for every remapped entry, i.e. every pending PTE update
+	template <typename F> void forEachRemap(F f) {
+		for (uint32_t i = 0; i < _num_sets; i++)
+			for (uint32_t mask = _remap[i]; mask; mask &= mask - 1)
+				f(_tags[i * _num_ways + __builtin_ctz(mask)]);
+	};
 	void clearTagBuffer();
+	void save(CheckpointWriter &w);
+	void restore(CheckpointReader &r);
 	void setClearTime(uint64_t time) { _last_clear_time = time; };
 	uint64_t getClearTime() { return _last_clear_time; };
 private:
+	static const uint32_t _num_ways = 8;
+	// bit i set if way i of the set holds tag
+	uint32_t matchWays(uint32_t set_num, Address tag);
 	void updateLRU(uint32_t set_num, uint32_t way);
-	TagBufferEntry ** _tag_buffer;
-	uint32_t _num_ways;
+	void checkConsistency(uint32_t set_num);
+	Address * _tags;  // _num_sets x _num_ways
+	uint8_t * _lru;   // _num_sets x _num_ways
+	uint8_t * _remap; // one way mask per set
 	uint32_t _num_sets;
 	uint32_t _entry_occupied;
 	uint64_t _last_clear_time;
 };
 
-class TLBEntry
-{
+// Footprint History Table (UnisonCache, Tagless). Predicts which lines of a
+// page are touched while it is cached from the footprints of evicted pages,
+// so a fill only fetches those. Requests reach the controller without a PC,
+// so entries are indexed by the trigger line (the one that missed) and the
+// page's address region instead. Direct-mapped; an entry holds the last
+// footprint trained into it. Without an entry, predict() returns the aligned
+// window of default_size lines around the trigger.
+class FootprintHistoryTable : public GlobAlloc {
+public:
+	FootprintHistoryTable(uint32_t num_entries, uint32_t region_bits, uint32_t default_size);
+	// Always includes the trigger line
+	uint64_t predict(Address tag, uint32_t trigger, bool &found);
+	void train(Address tag, uint32_t trigger, uint64_t footprint);
+	void save(CheckpointWriter &w);
+	void restore(CheckpointReader &r);
+private:
+	struct Entry {
+		Address key;  // -1 if empty
+		uint64_t footprint;
+	};
+	Address key(Address tag, uint32_t trigger) { return ((tag >> _region_bits) << 6) | trigger; };
+	uint32_t index(Address key) { return (key * 0x9E3779B97F4A7C15ul) >> _shift; };
+	Entry * _entries;
+	uint32_t _shift;  // 64 - log2(entries)
+	uint32_t _region_bits;
+	uint32_t _default_size;
+	lock_t _lock;
+};
+
+// MAP-I style miss predictor for Alloy Cache (Qureshi and Loh, MICRO 2012).
+// Each core has a table of 3-bit saturating counters; a counter at 4 or
+// above predicts a miss. MAP-I indexes the table by the load's PC, which
+// requests do not carry, so it is indexed by the line's 4KB region instead.
+// Counters are updated without a lock; a lost update only delays training.
+class MissPredictor : public GlobAlloc {
+public:
+	MissPredictor(uint32_t num_cores, uint32_t entries_per_core);
+	bool predictMiss(uint32_t core, Address line_addr) { return counter(core, line_addr) >= 4; };
+	void save(CheckpointWriter &w);
+	void restore(CheckpointReader &r);
+	void train(uint32_t core, Address line_addr, bool miss) {
+		uint8_t &c = counter(core, line_addr);
+		if (miss && c < 7)
+			c ++;
+		else if (!miss && c > 0)
+			c --;
+	};
+private:
+	uint8_t &counter(uint32_t core, Address line_addr) {
+		uint32_t idx = ((line_addr >> 6) * 0x9E3779B97F4A7C15ul) >> _shift;
+		return _counters[(core % _num_cores) * _entries_per_core + idx];
+	};
+	uint8_t * _counters;
+	uint32_t _num_cores;
+	uint32_t _entries_per_core;
+	uint32_t _shift;  // 64 - log2(entries_per_core)
+};
+
+// Off-package writes of dirty victims waiting to be issued, oldest first.
+// Entries are few, so they are kept in order in a flat array.
+class WriteBackBuffer : public GlobAlloc {
 public:
-   uint64_t tag;
-   uint64_t way;
-   uint64_t count; // for OS based placement policy
-
-   // the following two are only for UnisonCache
-   // due to space cosntraint, it is not feasible to keep one bit for each line,
-   // so we use 1 bit for 4 lines.
-   uint64_t touch_bitvec; // whether a line is touched in a page
-   uint64_t dirty_bitvec; // whether a line is dirty in page
+	struct Entry {
+		Address tag;           // victim page (line for Alloy Cache)
+		Address addr;          // first line written
+		uint32_t size;         // in bursts
+		uint64_t ready_cycle;  // when the data has been read out of MC-Dram
+	};
+	WriteBackBuffer(uint32_t num_entries);
+	uint32_t size() const { return _size; };
+	uint32_t capacity() const { return _num_entries; };
+	bool full() const { return _size == _num_entries; };
+	void push(const Entry &e) { assert(!full()); _entries[_size++] = e; };
+	Entry pop() { return remove(0); };
+	// Removes the entry of a victim page, if it is buffered
+	bool take(Address tag, Entry &e) {
+		for (uint32_t i = 0; i < _size; i++)
+			if (_entries[i].tag == tag) {
+				e = remove(i);
+				return true;
+			}
+		return false;
+	};
+private:
+	Entry remove(uint32_t i) {
+		assert(i < _size);
+		Entry e = _entries[i];
+		memmove(&_entries[i], &_entries[i + 1], (_size - i - 1) * sizeof(Entry));
+		_size --;
+		return e;
+	};
+	Entry * _entries;
+	uint32_t _num_entries;
+	uint32_t _size;
 };
 
+// One lock stripe of the functional state. Padded to avoid false sharing.
+struct SetLock
+{
+	lock_t lock;
+	PAD_SZ(sizeof(lock_t));
+};
+
+class MemTraceWriter;
 class LinePlacementPolicy;
 class PagePlacementPolicy;
 class OSPlacementPolicy;
@@ -112,13 +269,8 @@ private:
 	g_string _name;
 
 	// Trace related code
-	lock_t _lock;
-	bool _collect_trace;
-	g_string _trace_dir;
-	Address _address_trace[10000];
-	uint32_t _type_trace[10000];
-	uint32_t _cur_trace_len;
-	uint32_t _max_trace_len;
+	MemTraceWriter * _trace_writer;  // nullptr unless sys.mem.enableTrace
+	uint32_t _trace_id;
 
 	// External Dram Configuration
 	MemObject *	_ext_dram;
@@ -136,9 +288,29 @@ public:
         return ((double) _num_miss_per_step / (_num_miss_per_step + _num_hit_per_step));
     };
    	Scheme getScheme()      { return _scheme; };
-   	Set * getSets()         { return _cache; };
-   	g_unordered_map<Address, TLBEntry> * getTLB() { return &_tlb; };
+   	TagArray * getTags()    { return &_cache; };
+	// The lock stripe of a set. Placement policies keep per-stripe state,
+	// which the stripe's lock protects.
+	uint32_t getLockStripe(uint64_t set_num) { return set_num % _num_set_locks; };
+	uint32_t getNumSetLocks() { return _num_set_locks; };
+	// Whether the line (a controller-local address) is cached in MC-Dram.
+	// Lock-free, so it can be called from any thread without the set locks;
+	// the answer may be stale by the time the caller uses it.
+	bool isResident(Address lineAddr) {
+		if (_scheme == NoCache) return false;
+		if (_scheme == CacheOnly) return true;
+		Address tag = lineAddr / (_granularity / 64);
+		return _tlb[getLockStripe(tag % _num_sets)].getWay(tag, _num_ways) != _num_ways;
+	};
+	// Called by every cache that uses isResident(). From then on, page table
+	// arrays replaced by a grow are only freed at the end of each phase,
+	// when no bound-phase thread can be probing them.
+	void enableResidencyQueries();
+	// Frees the retired page table arrays. Takes the set locks.
+	void freeRetiredTables();
 	TagBuffer * getTagBuffer() { return _tag_buffer; };
+	// HMA only, nullptr otherwise
+	OSPlacementPolicy * getOSPlacementPolicy() { return _os_placement_policy; };
     double getRecentBWRatio() {
         if(_mc_bw_per_step + _ext_bw_per_step > 0)
             return (1.0 * _mc_bw_per_step / (_mc_bw_per_step + _ext_bw_per_step));
@@ -149,13 +321,37 @@ public:
 	uint64_t getGranularity() { return _granularity; };
 
 private:
-	// For Alloy Cache.
-	Address transMCAddress(Address mc_addr);
-	// For Page Granularity Cache
-	Address transMCAddressPage(uint64_t set_num, uint32_t way_num);
+	// Fine-grained locking. Each set (and the TLB entries of the pages mapping
+	// to it) is protected by one stripe. Global work (tag buffer flush,
+	// BATMAN rebalance, HMA remap) takes all stripes in order.
+	void lockAllSets();
+	void unlockAllSets();
+	SetLock * _set_locks;
+	uint32_t _num_set_locks;
+	// Protects the tag buffer, which is shared by all sets. Taken after a set
+	// lock, and only while tags or remap bits change: by a placement and its
+	// remaps, a load that brings a new page in, and a flush.
+	lock_t _tag_buffer_lock;
+
+	// Where cached data lives in MC-Dram. With the linear layout
+	// (sys.mem.mcdram.layout = "Linear"), a line goes to the location its
+	// address maps to, wherever it is cached. With "Physical", mcdramLocate
+	// (a scheme hook, below) maps (set, way, line in page) to a DRAM row and
+	// column:
+	// - Alloy: 72B TADs packed into rows, so tag and data are one access.
+	// - Page schemes: each way holds a page frame, and a frame's lines are
+	//   consecutive in the row. If there are enough sets, a set's frames
+	//   sit together on one channel; otherwise frames are striped across
+	//   channels. Tags and counters are accessed in the row of the data
+	//   they describe.
+	// Rows have _mcdram_row_lines lines: the DDR row size, or
+	// sys.mem.mcdram.rowBytes for other MC-Dram models.
+	bool _physical_layout;
+	bool _mcdram_ddr;
+	uint64_t _mcdram_row_lines;
 
 	// For Tagless.
-	// For Tagless, we don't use "Set * _cache;" as other schemes. Instead, we use the following
+	// For Tagless, we don't use "TagArray _cache;" as other schemes. Instead, we use the following
 	// structure to model a fully associative cache with FIFO replacement
 	//vector<Address> _idx_to_address;
 	uint64_t _next_evict_idx;
@@ -166,25 +362,137 @@ private:
 	uint64_t _num_ways;
 	uint64_t _cache_size;  // in Bytes
 	uint64_t _num_sets;
-	Set * _cache;
+	TagArray _cache;
 	LinePlacementPolicy * _line_placement_policy;
 	PagePlacementPolicy * _page_placement_policy;
 	OSPlacementPolicy * _os_placement_policy;
 	uint64_t _num_requests;
 	Scheme _scheme;
 	TagBuffer * _tag_buffer;
-
-	// For HybridCache
+	// Tag buffer flush (HybridCache). Flushes once occupancy exceeds the
+	// threshold; the PTE updates go to off-package DRAM. With
+	// _tb_flush_stall, the triggering request waits for them, and the
+	// shootdown stalls every core for _tb_shootdown_latency cycles.
+	uint64_t flushTagBuffer(MemReq& req, bool functional);
+	// First line of the modeled PTE region, clear of any data line
+	static const Address PTE_LINES = 1ul << 46;
+	double _tb_flush_threshold;
+	bool _tb_flush_stall;
+	uint32_t _tb_shootdown_latency;
+
+	// For UnisonCache and Tagless. With an FHT (sys.mem.mcdram.fht_entries > 0)
+	// fills fetch the predicted footprint; without one they fetch
+	// _footprint_size lines and later accesses never miss in the page.
 	uint32_t _footprint_size;
+	FootprintHistoryTable * _fht;
+
+	// Alloy Cache: on a predicted miss, the off-package read is issued in
+	// parallel with the TAD probe (sys.mem.mcdram.map_entries, 0 = off).
+	MissPredictor * _miss_predictor;
+
+	// Write-back buffer (sys.mem.mcdram.wb_buffer_size entries, 0 = off).
+	// Dirty victims are still read out of MC-Dram on the miss, but their
+	// off-package writes wait here. One is drained by each request that
+	// makes no off-package access, and the oldest when an eviction finds the
+	// buffer full. A miss to a buffered page drains its write first. With
+	// _wb_cleaner, requests without off-package accesses also write back
+	// the set's next victim if it is dirty, while the buffer is under half
+	// full and off-package DRAM has carried at most _wb_clean_ext_share of
+	// the recent traffic.
+	WriteBackBuffer * _wb_buffer;
+	lock_t _wb_lock;
+	bool _wb_cleaner;
+	double _wb_clean_ext_share;
+	uint64_t writeBack(MemReq& req, Address tag, Address addr, uint32_t size, uint32_t type, uint64_t cycle, uint64_t ready_cycle, bool functional);
+	uint64_t drainWriteBack(MemReq& req, const WriteBackBuffer::Entry &e, bool functional);
+	uint32_t drainMissWriteBack(MemReq& req, Address tag, uint32_t type, uint64_t &ext_bw, bool functional);
+
+	// Index of a line's bit in the per-page touch/dirty/fetch vectors. In
+	// pages over 4KB, a bit covers several lines.
+	uint32_t pageBit(Address line_addr) { return (line_addr % (_granularity / 64)) * 64 / (_granularity / 64); };
+	// Marks a line of the page touched, and dirty if it is written back
+	void touchLine(TLBEntry * entry, Address line_addr, ReqType type) {
+		uint32_t bit = pageBit(line_addr);
+		assert(bit < 64);
+		entry->touch_bitvec |= ((uint64_t)1UL) << bit;
+		if (type == STORE)
+			entry->dirty_bitvec |= ((uint64_t)1UL) << bit;
+	};
+
+	// Sectored HybridCache (sys.mem.mcdram.sector_size < page size). Fills
+	// bring only the demanded sector, other sectors are filled when first
+	// accessed, and evictions write back only dirty sectors. The page's
+	// fetch bits (PageTable::fetchBits) hold the valid sectors and
+	// dirty_bitvec the dirty ones.
+	uint64_t _sector_lines;
+	bool isSectored() { return _sector_lines < _granularity / 64; };
+	uint32_t sectorPageBits() { return _sector_lines * 64 / (_granularity / 64); };
+	uint64_t sectorMask() { return (sectorPageBits() == 64)? ~0ul : ((uint64_t)1UL << sectorPageBits()) - 1; };
+	// The page bits of the line's sector
+	uint64_t sectorBits(Address line_addr) {
+		return sectorMask() << (pageBit(line_addr) / sectorPageBits() * sectorPageBits());
+	};
+	uint32_t dirtySectors(uint64_t dirty_bitvec) {
+		uint32_t n = 0;
+		for (uint32_t i = 0; i < 64; i += sectorPageBits())
+			if ((dirty_bitvec >> i) & sectorMask())
+				n ++;
+		return n;
+	};
+	// Fills the rest of the line's sector, off the critical path of the last access
+	void fillSector(MemReq& req, Address address, Address mc_address, uint32_t mcdram_select, uint64_t &mc_bw, uint64_t &ext_bw, bool functional);
+
+	// Functional warmup. Until the controller has seen _warmup_requests
+	// requests or the simulation has run _warmup_instrs instructions,
+	// whichever comes first (0 disables a limit), accesses are functional.
+	// Requests flagged MemReq::WARMUP (fast-forward) are always functional.
+	volatile bool _warmup;
+	uint64_t _warmup_requests;
+	uint64_t _warmup_instrs;
+	void endWarmup(uint64_t num_requests);
+
+	// Checkpoints of the functional state (see mc_checkpoint.h). With
+	// sys.mem.mcdram.saveCheckpoint, one is written when warmup ends or on
+	// saveCheckpoint(); sys.mem.mcdram.loadCheckpoint restores one at
+	// construction. Both name a path prefix; each controller uses
+	// <prefix>.<name>.ckpt.
+	g_string _save_checkpoint;
+	bool _checkpoint_saved;
+	g_string checkpointFile(const g_string &prefix) { return prefix + "." + _name + ".ckpt"; };
+	void getCheckpointGeometry(CheckpointGeometry &g);
+	void restoreCheckpoint(const char * fname);
+
+	// Timing model accesses. Functional accesses take no time.
+	uint64_t mcdramAccess(uint32_t mc, MemReq& req, uint32_t type, uint32_t size, bool functional) {
+		return functional? req.cycle : _mcdram[mc]->access(req, type, size);
+	};
+	uint64_t extDramAccess(MemReq& req, uint32_t type, uint32_t size, bool functional) {
+		return functional? req.cycle : _ext_dram->access(req, type, size);
+	};
 
 	// Balance in- and off-package DRAM bandwidth.
 	// From "BATMAN: Maximizing Bandwidth Utilization of Hybrid Memory Systems"
+	// Sets below _ds_index are not cached. Each step moves _ds_target by
+	// _bw_balance_step of the sets per 1% that the MC-Dram share of traffic
+	// is off _bw_balance_target. Lowering _ds_index takes effect at once;
+	// raising it reclaims up to _bw_balance_sets sets per request. Both
+	// move under _ds_lock, which is taken before any set lock.
 	bool _bw_balance;
 	uint64_t _ds_index;
-
-	// TLB Hack
-	g_unordered_map <Address, TLBEntry> _tlb;
+	uint64_t _ds_target;
+	double _bw_balance_target;
+	double _bw_balance_step;
+	uint32_t _bw_balance_sets;
+	lock_t _ds_lock;
+
+	// TLB Hack. One page table per lock stripe.
+	PageTable * _tlb;
+	bool _residency_queries;
+	// HMA epoch, in requests. At the end of each epoch the OS moves the
+	// hottest pages into MC-Dram; returns the number of pages moved.
+	// Caller holds all set locks.
 	uint64_t _os_quantum;
+	uint64_t remapPages(MemReq& req, bool functional);
 
     // Stats
 	Counter _numPlacement;
@@ -200,6 +508,9 @@ private:
 	Counter _numTagStore;
 	// For HybridCache
 	Counter _numTagBufferFlush;
+	Counter _numTBFlushEntries;
+	Counter _numTBFlushCycles;
+	Counter _numTBFlushBytes;
 	Counter _numTBDirtyHit;
 	Counter _numTBDirtyMiss;
 	// For UnisonCache
@@ -208,7 +519,27 @@ private:
 
     // For HybridCache
 	Counter _numNotTouchedLines;
+	// Footprint prediction (UnisonCache, Tagless)
+	Counter _numFootprintLines;
+	Counter _numOverfetchLines;
+	Counter _numUnderfetchLines;
+	Counter _numFHTMiss;
+	Counter _numSectorFills;
+	Counter _numMAPCorrect;
+	Counter _numMAPFalseMiss;
+	Counter _numMAPFalseHit;
+	Counter _numRebalanceSets;
+	Counter _numRebalanceWritebacks;
+	Counter _numRebalanceBytes;
+	Counter _numWBBuffered;
+	Counter _numWBIdleDrains;
+	Counter _numWBForcedDrains;
+	Counter _numWBMissDrains;
+	Counter _numCleanerWritebacks;
+	Counter _numCleanedVictims;
+	VectorCounter _wbOccupancy;
 	Counter _numTouchedPages;
+	Counter _numWarmupRequests;
 
 	uint64_t _num_hit_per_step;
    	uint64_t _num_miss_per_step;
@@ -221,11 +552,115 @@ private:
 	// to model the SRAM tag
 	bool 	_sram_tag;
 	uint32_t _llc_latency;
+	// access() handles what all schemes share (tracing, warmup), then
+	// dispatches to the instantiation for _scheme and _sram_tag
+	uint64_t accessNoCache(MemReq& req, bool functional);
+	uint64_t accessCacheOnly(MemReq& req, bool functional);
+	template <Scheme Sch, bool SramTag>
+	uint64_t accessScheme(MemReq& req, uint64_t num_requests, bool functional);
+	void endStep();
+
+	// A request as it goes through the steps of accessScheme
+	struct AccessState {
+		MemReq &req;
+		bool functional;
+		ReqType type;
+		Address address;
+		Address tag;
+		uint64_t set_num;
+		uint64_t ds_index;       // _ds_index when the set lock was taken
+		uint32_t mcdram_select;
+		Address mc_address;
+		uint32_t hit_way;        // _num_ways on a miss
+		uint64_t cur_cycle;      // when a miss was found
+		uint64_t data_ready_cycle;
+		uint64_t mc_bw;          // bandwidth consumed, folded into the per-step counters at the end
+		uint64_t ext_bw;
+		PageTable * tlb;         // the set's stripe of the page table
+		TLBEntry * tlb_entry;    // the page's entry; page schemes only
+		bool counter_access;
+		bool hybrid_tag_probe;   // HybridCache: a write-back missed the tag buffer
+		bool parallel_ext;       // AlloyCache: off-package read issued with the TAD probe
+		uint64_t parallel_ext_cycle;
+		AccessState(MemReq &_req, bool _functional) : req(_req), functional(_functional) {};
+	};
+	// Per-scheme hooks of accessScheme, overloaded on SchemeTag<Sch>. The
+	// templated versions serve the schemes without an overload of their own.
+	template <Scheme Sch> struct SchemeTag {};
+	template <bool SramTag, Scheme Sch> void probe(AccessState &s, SchemeTag<Sch>);
+	template <bool SramTag> void probe(AccessState &s, SchemeTag<AlloyCache>);
+	template <bool SramTag> void probe(AccessState &s, SchemeTag<UnisonCache>);
+	template <bool SramTag> void probe(AccessState &s, SchemeTag<HybridCache>);
+	template <bool SramTag> void probe(AccessState &s, SchemeTag<Tagless>);
+	template <bool SramTag> void hit(AccessState &s, SchemeTag<AlloyCache>);
+	template <bool SramTag> void hit(AccessState &s, SchemeTag<UnisonCache>);
+	template <bool SramTag> void hit(AccessState &s, SchemeTag<HMA>);
+	template <bool SramTag> void hit(AccessState &s, SchemeTag<HybridCache>);
+	template <bool SramTag> void hit(AccessState &s, SchemeTag<Tagless>);
+	template <bool SramTag, Scheme Sch> void miss(AccessState &s, SchemeTag<Sch>);
+	template <bool SramTag> void miss(AccessState &s, SchemeTag<HMA>);
+	template <bool SramTag> void miss(AccessState &s, SchemeTag<HybridCache>);
+	// Steps of missPath: the way to place the line in (_num_ways if none),
+	// the off-package demand access, the fill of the way (returns the lines
+	// it brings in) and the eviction of its valid victim
+	template <Scheme Sch, bool SramTag> uint32_t missPath(AccessState &s);
+	template <bool SramTag, Scheme Sch> uint32_t place(AccessState &s, SchemeTag<Sch>);
+	template <bool SramTag> uint32_t place(AccessState &s, SchemeTag<AlloyCache>);
+	template <bool SramTag> uint32_t place(AccessState &s, SchemeTag<HybridCache>);
+	template <bool SramTag> uint32_t place(AccessState &s, SchemeTag<Tagless>);
+	template <bool SramTag> void missRead(AccessState &s, uint32_t replace_way, SchemeTag<AlloyCache>);
+	template <bool SramTag> void missRead(AccessState &s, uint32_t replace_way, SchemeTag<UnisonCache>);
+	template <bool SramTag> void missRead(AccessState &s, uint32_t replace_way, SchemeTag<HybridCache>);
+	template <bool SramTag> void missRead(AccessState &s, uint32_t replace_way, SchemeTag<Tagless>);
+	template <bool SramTag> uint64_t fill(AccessState &s, SchemeTag<AlloyCache>);
+	template <bool SramTag> uint64_t fill(AccessState &s, SchemeTag<UnisonCache>);
+	template <bool SramTag> uint64_t fill(AccessState &s, SchemeTag<HybridCache>);
+	template <bool SramTag> uint64_t fill(AccessState &s, SchemeTag<Tagless>);
+	template <bool SramTag> void evict(AccessState &s, Address replaced_tag, TLBEntry * replaced_entry, bool dirty, SchemeTag<AlloyCache>);
+	template <bool SramTag> void evict(AccessState &s, Address replaced_tag, TLBEntry * replaced_entry, bool dirty, SchemeTag<UnisonCache>);
+	template <bool SramTag> void evict(AccessState &s, Address replaced_tag, TLBEntry * replaced_entry, bool dirty, SchemeTag<HybridCache>);
+	template <bool SramTag> void evict(AccessState &s, Address replaced_tag, TLBEntry * replaced_entry, bool dirty, SchemeTag<Tagless>);
+	// Steps several schemes share
+	template <Scheme Sch> void lookupPage(AccessState &s, bool check_miss);
+	void loadPage(AccessState &s, uint32_t lines);
+	void storeTag(AccessState &s);
+	uint32_t countEvictedLines(TLBEntry * entry);
+	uint64_t fetchFootprint(AccessState &s);
+	bool underFetch(AccessState &s, uint32_t type);
+	void evictFootprint(AccessState &s, Address replaced_tag, TLBEntry * replaced_entry, bool dirty);
+	void updateGIPT(AccessState &s);
+	void checkTagBufferFlush(AccessState &s);
+	// Scheme hooks outside the access path: the physical MC-Dram location
+	// of a line, and the steps of the write-back cleaner (idleWriteBack)
+	// and of BATMAN (reclaimSets) that differ by scheme. A victim is
+	// addressed by its first line (blockAddress) and writes back dirtyLines
+	// lines. reclaimSet empties one set, calling reclaimWay on each valid way.
+	void mcdramLocate(uint64_t set, uint32_t way, Address line_addr, uint32_t &mc, Address &mc_addr, SchemeTag<AlloyCache>);
+	template <Scheme Sch> void mcdramLocate(uint64_t set, uint32_t way, Address line_addr, uint32_t &mc, Address &mc_addr, SchemeTag<Sch>);
+	template <Scheme Sch> void idleWriteBack(MemReq& req, uint64_t set_num, uint32_t hit_way, bool idle, uint64_t &mc_bw, uint64_t &ext_bw);
+	// Alloy Cache is direct-mapped, Tagless evicts in FIFO order
+	uint32_t nextVictim(uint64_t set, SchemeTag<AlloyCache>) { return 0; };
+	uint32_t nextVictim(uint64_t set, SchemeTag<Tagless>) { return _next_evict_idx; };
+	template <Scheme Sch> uint32_t nextVictim(uint64_t set, SchemeTag<Sch>);
+	Address blockAddress(Address tag, SchemeTag<AlloyCache>) { return tag; };
+	template <Scheme Sch> Address blockAddress(Address tag, SchemeTag<Sch>) { return tag * 64; };
+	uint64_t dirtyLines(TLBEntry * entry, SchemeTag<AlloyCache>) { return 1; };
+	uint64_t dirtyLines(TLBEntry * entry, SchemeTag<HybridCache>);
+	template <Scheme Sch> uint64_t dirtyLines(TLBEntry * entry, SchemeTag<Sch>) { return __builtin_popcountll(entry->dirty_bitvec); };
+	template <Scheme Sch> void reclaimSets(MemReq& req, bool functional);
+	void reclaimSet(MemReq& req, uint64_t set, bool functional, uint64_t &mc_bw, uint64_t &ext_bw, SchemeTag<HybridCache>);
+	template <Scheme Sch> void reclaimSet(MemReq& req, uint64_t set, bool functional, uint64_t &mc_bw, uint64_t &ext_bw, SchemeTag<Sch>);
+	template <Scheme Sch> void reclaimWays(MemReq& req, uint64_t set, bool functional, uint64_t &mc_bw, uint64_t &ext_bw);
+	void reclaimWay(MemReq& req, Address tag, bool functional, SchemeTag<HybridCache>);
+	template <Scheme Sch> void reclaimWay(MemReq& req, Address tag, bool functional, SchemeTag<Sch>) {};
 public:
 	MemoryController(g_string& name, uint32_t frequency, uint32_t domain, Config& config);
 	uint64_t access(MemReq& req);
 	const char * getName() { return _name.c_str(); };
 	void initStats(AggregateStat* parentStat);
+	// Writes the checkpoint, unless there is no saveCheckpoint path or it
+	// was already written. Takes all set locks.
+	void saveCheckpoint();
 	// Use glob mem
 	//using GlobAlloc::operator new;
 	//using GlobAlloc::operator delete;
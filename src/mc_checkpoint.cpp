@@ -0,0 +1,315 @@
+#include "mc_checkpoint.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "log.h"
+#include "mc.h"
+#include "page_placement.h"
+#include "line_placement.h"
+
+static const uint64_t headerBytes = 8 + sizeof(uint32_t);  // magic, version
+
+void
+CheckpointWriter::write(const char * fname)
+{
+	uint64_t size = headerBytes;
+	for (const Section &s : _sections)
+		size += sizeof(uint64_t) + s.bytes;
+	int fd = open(fname, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		panic("Could not create checkpoint %s", fname);
+	if (ftruncate(fd, size) != 0)
+		panic("Could not size checkpoint %s to %ld bytes", fname, size);
+	uint8_t * p = (uint8_t *) mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED)
+		panic("Could not map checkpoint %s", fname);
+	close(fd);
+
+	uint32_t version = MC_CHECKPOINT_VERSION;
+	memcpy(p, MC_CHECKPOINT_MAGIC, 8);
+	memcpy(p + 8, &version, sizeof(version));
+	uint64_t pos = headerBytes;
+	for (const Section &s : _sections) {
+		memcpy(p + pos, &s.bytes, sizeof(uint64_t));
+		pos += sizeof(uint64_t);
+		memcpy(p + pos, s.data, s.bytes);
+		pos += s.bytes;
+	}
+	assert(pos == size);
+	munmap(p, size);
+}
+
+CheckpointReader::CheckpointReader(const char * fname)
+	: _fname(fname), _pos(headerBytes), _section(0)
+{
+	int fd = open(fname, O_RDONLY);
+	if (fd < 0)
+		panic("Could not open checkpoint %s", fname);
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (uint64_t) st.st_size < headerBytes)
+		panic("%s is not a DRAM cache checkpoint", fname);
+	_size = st.st_size;
+	_data = (const uint8_t *) mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (_data == MAP_FAILED)
+		panic("Could not map checkpoint %s", fname);
+	close(fd);
+	if (memcmp(_data, MC_CHECKPOINT_MAGIC, 8) != 0)
+		panic("%s is not a DRAM cache checkpoint", fname);
+	uint32_t version;
+	memcpy(&version, _data + 8, sizeof(version));
+	if (version != MC_CHECKPOINT_VERSION)
+		panic("Checkpoint %s has format version %d, this build reads version %d", fname, version, MC_CHECKPOINT_VERSION);
+}
+
+CheckpointReader::~CheckpointReader()
+{
+	munmap((void *) _data, _size);
+}
+
+uint64_t
+CheckpointReader::peek()
+{
+	if (_pos + sizeof(uint64_t) > _size)
+		panic("Checkpoint %s is truncated (section %d)", _fname, _section);
+	uint64_t bytes;
+	memcpy(&bytes, _data + _pos, sizeof(uint64_t));
+	return bytes;
+}
+
+const void *
+CheckpointReader::map(uint64_t bytes)
+{
+	uint64_t saved = peek();
+	if (saved != bytes)
+		panic("Checkpoint %s does not match the configuration: section %d has %ld bytes, expected %ld",
+				_fname, _section, saved, bytes);
+	if (_pos + sizeof(uint64_t) + bytes > _size)
+		panic("Checkpoint %s is truncated (section %d)", _fname, _section);
+	const void * data = _data + _pos + sizeof(uint64_t);
+	_pos += sizeof(uint64_t) + bytes;
+	_section ++;
+	return data;
+}
+
+void
+CheckpointReader::get(void * data, uint64_t bytes)
+{
+	memcpy(data, map(bytes), bytes);
+}
+
+void
+CheckpointReader::finish()
+{
+	if (_pos != _size)
+		panic("Checkpoint %s has %ld bytes left after section %d", _fname, _size - _pos, _section);
+}
+
+/* MemoryController */
+
+void
+MemoryController::getCheckpointGeometry(CheckpointGeometry &g)
+{
+	memset(&g, 0, sizeof(g));  // padding is written out too
+	g.scheme = _scheme;
+	g.placement = _page_placement_policy? _page_placement_policy->get_placement_policy() : (uint32_t) -1;
+	g.granularity = _granularity;
+	g.num_ways = _num_ways;
+	g.num_sets = _num_sets;
+	g.num_set_locks = _num_set_locks;
+	g.sector_lines = _sector_lines;
+	g.has_fht = _fht != nullptr;
+	g.has_miss_predictor = _miss_predictor != nullptr;
+}
+
+void
+MemoryController::saveCheckpoint()
+{
+	if (_save_checkpoint.empty() || _checkpoint_saved)
+		return;
+	g_string fname = checkpointFile(_save_checkpoint);
+	// Lock order is _ds_lock, then sets (see reclaimSets)
+	futex_lock(&_ds_lock);
+	lockAllSets();
+	CheckpointWriter w;
+	CheckpointGeometry g;
+	getCheckpointGeometry(g);
+	w.put(g);
+	w.put(_num_requests);
+	w.put(_next_evict_idx);
+	w.put(_ds_index);
+	w.put(_ds_target);
+	w.put(_num_hit_per_step);
+	w.put(_num_miss_per_step);
+	w.put(_mc_bw_per_step);
+	w.put(_ext_bw_per_step);
+	if (_scheme != NoCache) {
+		_cache.save(w);
+		for (uint32_t i = 0; i < _num_set_locks; i++)
+			_tlb[i].save(w);
+	}
+	if (_line_placement_policy)
+		_line_placement_policy->save(w);
+	if (_page_placement_policy)
+		_page_placement_policy->save(w);
+	if (_tag_buffer)
+		_tag_buffer->save(w);
+	if (_fht)
+		_fht->save(w);
+	if (_miss_predictor)
+		_miss_predictor->save(w);
+	w.write(fname.c_str());
+	_checkpoint_saved = true;
+	unlockAllSets();
+	futex_unlock(&_ds_lock);
+	info("%s: saved DRAM cache checkpoint %s after %ld requests", getName(), fname.c_str(), _num_requests);
+}
+
+void
+MemoryController::restoreCheckpoint(const char * fname)
+{
+	CheckpointReader r(fname);
+	CheckpointGeometry saved, cur;
+	r.get(saved);
+	getCheckpointGeometry(cur);
+#define CHECK_GEOMETRY(field) \
+	if (saved.field != cur.field) \
+		panic("%s: checkpoint %s has " #field " %ld, the configuration has %ld", \
+				getName(), fname, (uint64_t) saved.field, (uint64_t) cur.field);
+	CHECK_GEOMETRY(scheme);
+	CHECK_GEOMETRY(placement);
+	CHECK_GEOMETRY(granularity);
+	CHECK_GEOMETRY(num_ways);
+	CHECK_GEOMETRY(num_sets);
+	CHECK_GEOMETRY(num_set_locks);
+	CHECK_GEOMETRY(sector_lines);
+	CHECK_GEOMETRY(has_fht);
+	CHECK_GEOMETRY(has_miss_predictor);
+#undef CHECK_GEOMETRY
+	r.get(_num_requests);
+	r.get(_next_evict_idx);
+	r.get(_ds_index);
+	r.get(_ds_target);
+	r.get(_num_hit_per_step);
+	r.get(_num_miss_per_step);
+	r.get(_mc_bw_per_step);
+	r.get(_ext_bw_per_step);
+	if (_scheme != NoCache) {
+		_cache.restore(r);
+		for (uint32_t i = 0; i < _num_set_locks; i++)
+			_tlb[i].restore(r);
+	}
+	if (_line_placement_policy)
+		_line_placement_policy->restore(r);
+	if (_page_placement_policy)
+		_page_placement_policy->restore(r);
+	if (_tag_buffer)
+		_tag_buffer->restore(r);
+	if (_fht)
+		_fht->restore(r);
+	if (_miss_predictor)
+		_miss_predictor->restore(r);
+	r.finish();
+	info("%s: restored DRAM cache checkpoint %s, taken after %ld requests", getName(), fname, _num_requests);
+}
+
+/* Functional state of the controller's parts */
+
+void
+TagArray::save(CheckpointWriter &w)
+{
+	w.put(_valid, _num_words * sizeof(uint64_t));
+	w.put(_dirty, _num_words * sizeof(uint64_t));
+	uint64_t num_valid = 0;
+	for (uint64_t i = 0; i < _num_words; i++)
+		num_valid += __builtin_popcountll(_valid[i]);
+	Address * tags = (Address *) w.alloc(num_valid * sizeof(Address));
+	for (uint64_t i = 0; i < _num_words; i++)
+		for (uint64_t mask = _valid[i]; mask; mask &= mask - 1)
+			*tags++ = _tags[i * 64 + __builtin_ctzll(mask)];
+}
+
+void
+TagArray::restore(CheckpointReader &r)
+{
+	r.get(_valid, _num_words * sizeof(uint64_t));
+	r.get(_dirty, _num_words * sizeof(uint64_t));
+	uint64_t num_valid = 0;
+	for (uint64_t i = 0; i < _num_words; i++)
+		num_valid += __builtin_popcountll(_valid[i]);
+	// Only the tags of valid ways are touched, so the rest stay unbacked
+	const Address * tags = (const Address *) r.map(num_valid * sizeof(Address));
+	for (uint64_t i = 0; i < _num_words; i++)
+		for (uint64_t mask = _valid[i]; mask; mask &= mask - 1)
+			_tags[i * 64 + __builtin_ctzll(mask)] = *tags++;
+}
+
+void
+PageTable::save(CheckpointWriter &w)
+{
+	w.put(_size);
+	w.put(_slots->capacity);
+	w.put(_slots->entries, _slots->capacity * sizeof(TLBEntry));
+	if (_fetch_bits)
+		w.put(_slots->fetch, _slots->capacity * sizeof(uint64_t));
+}
+
+void
+PageTable::restore(CheckpointReader &r)
+{
+	r.get(_size);
+	uint64_t capacity;
+	r.get(capacity);
+	Slots * s = allocate(capacity);
+	r.get(s->entries, capacity * sizeof(TLBEntry));
+	if (_fetch_bits)
+		r.get(s->fetch, capacity * sizeof(uint64_t));
+	Slots * old = _slots;
+	__atomic_store_n(&_slots, s, __ATOMIC_RELEASE);
+	retire(old);
+}
+
+void
+TagBuffer::save(CheckpointWriter &w)
+{
+	w.put(_tags, sizeof(Address) * _num_sets * _num_ways);
+	w.put(_lru, sizeof(uint8_t) * _num_sets * _num_ways);
+	w.put(_remap, sizeof(uint8_t) * _num_sets);
+	w.put(_entry_occupied);
+	w.put(_last_clear_time);
+}
+
+void
+TagBuffer::restore(CheckpointReader &r)
+{
+	r.get(_tags, sizeof(Address) * _num_sets * _num_ways);
+	r.get(_lru, sizeof(uint8_t) * _num_sets * _num_ways);
+	r.get(_remap, sizeof(uint8_t) * _num_sets);
+	r.get(_entry_occupied);
+	r.get(_last_clear_time);
+}
+
+void
+FootprintHistoryTable::save(CheckpointWriter &w)
+{
+	w.put(_entries, sizeof(Entry) << (64 - _shift));
+}
+
+void
+FootprintHistoryTable::restore(CheckpointReader &r)
+{
+	r.get(_entries, sizeof(Entry) << (64 - _shift));
+}
+
+void
+MissPredictor::save(CheckpointWriter &w)
+{
+	w.put(_counters, _num_cores * _entries_per_core);
+}
+
+void
+MissPredictor::restore(CheckpointReader &r)
+{
+	r.get(_counters, _num_cores * _entries_per_core);
+}
@@ -0,0 +1,74 @@
+#ifndef MC_CHECKPOINT_H_
+#define MC_CHECKPOINT_H_
+
+#include <stdint.h>
+#include <vector>
+
+// Snapshot of a DRAM cache controller's functional state: tags, page table,
+// placement, tag buffer and predictor state (see
+// MemoryController::saveCheckpoint). A file is a magic string and format
+// version, followed by sections in a fixed order. Each section starts with
+// its size, so a file from a different geometry or format fails on the first
+// section that does not fit. Files are written and read through mmap.
+
+#define MC_CHECKPOINT_MAGIC "DCCKPT\0\0"
+// Bump whenever a section is added, removed or changes layout
+#define MC_CHECKPOINT_VERSION 3
+
+class CheckpointWriter {
+public:
+	// The data is copied by write(), so it must not change until then
+	void put(const void * data, uint64_t bytes) { _sections.push_back({data, bytes}); };
+	template <typename T> void put(const T &v) { put(&v, sizeof(T)); };
+	// A section held by the writer, for data that must be packed first
+	void * alloc(uint64_t bytes) {
+		_owned.emplace_back(bytes);
+		put(_owned.back().data(), bytes);
+		return _owned.back().data();
+	};
+	void write(const char * fname);
+private:
+	struct Section {
+		const void * data;
+		uint64_t bytes;
+	};
+	std::vector<Section> _sections;
+	std::vector<std::vector<uint8_t>> _owned;
+};
+
+class CheckpointReader {
+public:
+	explicit CheckpointReader(const char * fname);
+	~CheckpointReader();
+	// Size of the next section
+	uint64_t peek();
+	// Reads the next section, which must be exactly bytes long
+	void get(void * data, uint64_t bytes);
+	template <typename T> void get(T &v) { get(&v, sizeof(T)); };
+	// Like get(), but returns the section in place. Valid while the reader is.
+	const void * map(uint64_t bytes);
+	// Panics if sections are left
+	void finish();
+private:
+	const char * _fname;
+	const uint8_t * _data;
+	uint64_t _size;
+	uint64_t _pos;
+	uint32_t _section;
+};
+
+// Geometry and scheme of the controller a checkpoint was taken from. A
+// checkpoint only restores into a controller with the same values.
+struct CheckpointGeometry {
+	uint32_t scheme;
+	uint32_t placement;  // PagePlacementPolicy::RepScheme, or -1
+	uint64_t granularity;
+	uint64_t num_ways;
+	uint64_t num_sets;
+	uint64_t num_set_locks;
+	uint64_t sector_lines;
+	uint32_t has_fht;
+	uint32_t has_miss_predictor;
+};
+
+#endif  // MC_CHECKPOINT_H_
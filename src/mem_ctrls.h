@@ -53,6 +53,8 @@ class SimpleMemory : public MemObject {
 		Chunk * temp;
     public:
         uint64_t access(MemReq& req);
+        // Fixed latency, so the transfer size and event chaining do not matter
+        uint64_t access(MemReq& req, int type, uint32_t data_size) { return access(req); }
         const char* getName() {return name.c_str();}
         SimpleMemory(uint32_t _latency, g_string& _name, Config& config);
 };
@@ -102,6 +104,8 @@ class MD1Memory : public MemObject {
 
         //uint32_t access(Address lineAddr, AccessType type, uint32_t childId, MESIState* state /*both input and output*/, MESIState initialState, lock_t* childLock);
         uint64_t access(MemReq& req);
+        // Multi-line transfers are charged as a single request
+        uint64_t access(MemReq& req, int type, uint32_t data_size) { return access(req); }
 
         const char* getName() {return name.c_str();}
 
@@ -0,0 +1,268 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mem_trace.h"
+#include <string.h>
+#include <zlib.h>
+#include <algorithm>
+#include "log.h"
+
+static inline void putVarint(std::vector<uint8_t>& buf, uint64_t v) {
+    while (v >= 0x80) {
+        buf.push_back((uint8_t)(v | 0x80));
+        v >>= 7;
+    }
+    buf.push_back((uint8_t)v);
+}
+
+static inline uint64_t getVarint(const std::vector<uint8_t>& buf, size_t& pos) {
+    uint64_t v = 0;
+    for (uint32_t shift = 0; ; shift += 7) {
+        if (pos >= buf.size() || shift > 63) panic("Corrupt memory trace block");
+        uint8_t b = buf[pos++];
+        v |= ((uint64_t)(b & 0x7f)) << shift;
+        if (!(b & 0x80)) return v;
+    }
+}
+
+static inline uint64_t zigzag(int64_t v) { return (((uint64_t)v) << 1) ^ (uint64_t)(v >> 63); }
+static inline int64_t unzigzag(uint64_t v) { return (int64_t)(v >> 1) ^ -(int64_t)(v & 1); }
+
+/* Writer */
+
+MemTraceWriter::MemTraceWriter(const g_string& _fname) : fname(_fname) {
+    futex_init(&ioLock);
+    futex_init(&wakeLock);
+    futex_lock(&wakeLock);  // first wait blocks until a block fills
+    done = false;
+    numRecords = 0;
+
+    FILE* f = fopen(fname.c_str(), "wb");
+    if (!f) panic("Could not create memory trace %s", fname.c_str());
+    fwrite(MEM_TRACE_MAGIC, 1, strlen(MEM_TRACE_MAGIC), f);
+    fclose(f);
+    fileBytes = strlen(MEM_TRACE_MAGIC);
+}
+
+uint32_t MemTraceWriter::addController() {
+    Buffer* buf = new Buffer();
+    buf->cur = 0;
+    for (Block& b : buf->blocks) {
+        b.num = 0;
+        b.full = false;
+    }
+    futex_init(&buf->appendLock);
+    buffers.push_back(buf);
+    return buffers.size() - 1;
+}
+
+// Caller holds buf.appendLock
+void MemTraceWriter::blockFull(Buffer& buf) {
+    buf.blocks[buf.cur].full = true;
+    // If the writer has not caught up with the other block, stay here; the
+    // next producer writes it (see writeBehind)
+    if (!buf.blocks[buf.cur ^ 1].full) buf.cur ^= 1;
+    futex_unlock(&wakeLock);
+}
+
+// Caller holds buf.appendLock, and both blocks are full. Writes the older one
+// with appendLock released, so producers only wait for the full buffer and
+// not for each other's I/O, then switches to it.
+void MemTraceWriter::writeBehind(Buffer& buf) {
+    // Nothing is appended or switched while blocks[cur] is full
+    Block& older = buf.blocks[buf.cur ^ 1];
+    futex_unlock(&buf.appendLock);
+    futex_lock(&ioLock);
+    if (older.full) writeBlocks({&older});
+    futex_unlock(&ioLock);
+    futex_lock(&buf.appendLock);
+    if (buf.blocks[buf.cur].full && !buf.blocks[buf.cur ^ 1].full) buf.cur ^= 1;
+}
+
+// Caller holds ioLock
+void MemTraceWriter::writeBlocks(const std::vector<Block*>& blks) {
+    // Each controller's blocks form one run; always take the run head with
+    // the lowest cycle, which keeps every run in order
+    struct Run {
+        std::vector<Block*> blocks;
+        uint32_t block;
+        uint32_t pos;
+        const MemTraceRecord& head() const { return blocks[block]->recs[pos]; }
+    };
+    std::vector<Run> runs;
+    for (Block* b : blks) {
+        if (!b->num) continue;
+        uint32_t ctrl = b->recs[0].ctrl;
+        auto it = std::find_if(runs.begin(), runs.end(), [&](const Run& r) { return r.head().ctrl == ctrl; });
+        if (it == runs.end()) runs.push_back({{b}, 0, 0});
+        else it->blocks.push_back(b);
+    }
+
+    std::vector<MemTraceRecord> merged;
+    while (!runs.empty()) {
+        auto next = std::min_element(runs.begin(), runs.end(),
+                [](const Run& a, const Run& b) { return a.head().cycle < b.head().cycle; });
+        merged.push_back(next->head());
+        if (++next->pos == next->blocks[next->block]->num) {
+            next->pos = 0;
+            if (++next->block == next->blocks.size()) runs.erase(next);
+        }
+        if (merged.size() == BLOCK_RECORDS) {
+            writeRecords(merged.data(), merged.size());
+            merged.clear();
+        }
+    }
+    if (!merged.empty()) writeRecords(merged.data(), merged.size());
+
+    for (Block* b : blks) {
+        b->num = 0;
+        __sync_synchronize();
+        b->full = false;
+    }
+}
+
+// Caller holds ioLock
+void MemTraceWriter::writeRecords(const MemTraceRecord* recs, uint32_t num) {
+    std::vector<uint8_t> raw;
+    raw.reserve(num * 8);
+    Address lastAddr = 0;
+    uint64_t lastCycle = 0;
+    for (uint32_t i = 0; i < num; i++) {
+        const MemTraceRecord& r = recs[i];
+        putVarint(raw, zigzag(r.lineAddr - lastAddr));
+        putVarint(raw, zigzag(r.cycle - lastCycle));
+        putVarint(raw, (((uint64_t)r.ctrl) << 1) | (r.write? 1 : 0));
+        lastAddr = r.lineAddr;
+        lastCycle = r.cycle;
+    }
+
+    uLongf compBytes = compressBound(raw.size());
+    std::vector<uint8_t> comp(compBytes);
+    if (compress2(comp.data(), &compBytes, raw.data(), raw.size(), 1) != Z_OK) panic("Memory trace compression failed");
+
+    uint32_t hdr[3] = {num, (uint32_t)raw.size(), (uint32_t)compBytes};
+    FILE* f = fopen(fname.c_str(), "ab");
+    if (!f) panic("Could not open memory trace %s", fname.c_str());
+    fwrite(hdr, sizeof(uint32_t), 3, f);
+    fwrite(comp.data(), 1, compBytes, f);
+    fclose(f);
+
+    numRecords += num;
+    fileBytes += sizeof(hdr) + compBytes;
+}
+
+void MemTraceWriter::WriterThreadTrampoline(void* arg) {
+    MemTraceWriter* w = static_cast<MemTraceWriter*>(arg);
+    while (true) {
+        futex_lock(&w->wakeLock);  // producers unlock when a block fills
+        if (w->done) break;
+        futex_lock(&w->ioLock);
+        std::vector<Block*> full;
+        for (Buffer* buf : w->buffers) {
+            futex_lock(&buf->appendLock);
+            // blocks[cur ^ 1] is older; blocks[cur] is only full if both are
+            Block& older = buf->blocks[buf->cur ^ 1];
+            Block& newer = buf->blocks[buf->cur];
+            if (older.full) full.push_back(&older);
+            if (newer.full) full.push_back(&newer);
+            futex_unlock(&buf->appendLock);
+        }
+        w->writeBlocks(full);
+        futex_unlock(&w->ioLock);
+    }
+}
+
+void MemTraceWriter::finish() {
+    futex_lock(&ioLock);
+    std::vector<Block*> pending;
+    for (Buffer* buf : buffers) {
+        futex_lock(&buf->appendLock);
+        // blocks[cur ^ 1] is older; blocks[cur] is only full if both are
+        if (buf->blocks[buf->cur ^ 1].full) pending.push_back(&buf->blocks[buf->cur ^ 1]);
+        pending.push_back(&buf->blocks[buf->cur]);
+    }
+    writeBlocks(pending);
+    done = true;
+    futex_unlock(&wakeLock);
+    for (Buffer* buf : buffers) futex_unlock(&buf->appendLock);
+    futex_unlock(&ioLock);
+    info("Memory trace %s: %ld records, %ld bytes (%.2f bytes/record)", fname.c_str(),
+            numRecords, fileBytes, numRecords? ((double)fileBytes)/numRecords : 0.0);
+}
+
+/* Reader */
+
+MemTraceReader::MemTraceReader(const char* fname) : pos(0), left(0) {
+    f = fopen(fname, "rb");
+    if (!f) panic("Could not open memory trace %s", fname);
+    char magic[8];
+    if (fread(magic, 1, sizeof(magic), f) != sizeof(magic) || memcmp(magic, MEM_TRACE_MAGIC, sizeof(magic)) != 0) {
+        panic("%s is not a memory trace", fname);
+    }
+    nextBlock();
+}
+
+MemTraceReader::~MemTraceReader() {
+    fclose(f);
+}
+
+bool MemTraceReader::isMemTrace(const char* fname) {
+    FILE* f = fopen(fname, "rb");
+    if (!f) return false;
+    char magic[8];
+    bool res = fread(magic, 1, sizeof(magic), f) == sizeof(magic) && memcmp(magic, MEM_TRACE_MAGIC, sizeof(magic)) == 0;
+    fclose(f);
+    return res;
+}
+
+MemTraceRecord MemTraceReader::read() {
+    assert(left);
+    MemTraceRecord r;
+    r.lineAddr = last.lineAddr + unzigzag(getVarint(raw, pos));
+    r.cycle = last.cycle + unzigzag(getVarint(raw, pos));
+    uint64_t cw = getVarint(raw, pos);
+    r.ctrl = cw >> 1;
+    r.write = cw & 1;
+    last = r;
+    if (--left == 0) nextBlock();
+    return r;
+}
+
+void MemTraceReader::nextBlock() {
+    uint32_t hdr[3];
+    if (fread(hdr, sizeof(uint32_t), 3, f) != 3) return;  // end of trace
+    comp.resize(hdr[2]);
+    raw.resize(hdr[1]);
+    if (fread(comp.data(), 1, hdr[2], f) != hdr[2]) panic("Truncated memory trace block");
+    uLongf rawBytes = hdr[1];
+    if (uncompress(raw.data(), &rawBytes, comp.data(), hdr[2]) != Z_OK || rawBytes != hdr[1]) {
+        panic("Corrupt memory trace block");
+    }
+    pos = 0;
+    left = hdr[0];
+    last.lineAddr = 0;
+    last.cycle = 0;
+    if (!left) nextBlock();
+}
@@ -0,0 +1,148 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEM_TRACE_H_
+#define MEM_TRACE_H_
+
+#include <stdio.h>
+#include <vector>
+#include "g_std/g_string.h"
+#include "g_std/g_vector.h"
+#include "galloc.h"
+#include "locks.h"
+#include "memory_hierarchy.h"
+
+/* Streaming traces of the requests seen by the DRAM cache memory controllers
+ * (sys.mem.enableTrace). All controllers share one file.
+ *
+ * Format: an 8-byte magic, then independent blocks, each with a header of
+ * three uint32_t (records, raw bytes, compressed bytes) followed by the
+ * zlib-compressed payload. The payload encodes each record as three LEB128
+ * varints: zigzag(lineAddr delta), zigzag(cycle delta), (ctrl << 1) | write.
+ * Deltas are against the previous record of the same block and start from 0.
+ */
+
+#define MEM_TRACE_MAGIC "ZSMEMTR1"
+
+struct MemTraceRecord {
+    Address lineAddr;  // controller-local
+    uint64_t cycle;
+    uint32_t ctrl;
+    bool write;  // dirty writeback (PUTX); everything else is a load
+};
+
+/* Producers (simulation threads in any process) append to one of two
+ * shared blocks of their controller, so controllers do not contend with each
+ * other. A writer thread in the master process merges the full blocks of all
+ * controllers by cycle, then compresses and writes them while the other
+ * blocks fill. Records stay in order per controller; across controllers,
+ * only blocks written together are merged. If the writer falls behind and
+ * both blocks of a controller fill, its producers write the older one
+ * themselves, outside appendLock, so no records are lost and memory stays
+ * bounded. The file is reopened for each write, as producers can live in
+ * other processes. Lock order: ioLock, then appendLock.
+ */
+class MemTraceWriter : public GlobAlloc {
+    private:
+        static const uint32_t BLOCK_RECORDS = 64*1024;
+
+        struct Block {
+            MemTraceRecord recs[BLOCK_RECORDS];
+            uint32_t num;
+            volatile bool full;  // waiting to be written
+        };
+
+        // One per controller
+        struct Buffer : public GlobAlloc {
+            Block blocks[2];
+            uint32_t cur;  // block producers append to
+            lock_t appendLock;
+        };
+
+        g_vector<Buffer*> buffers;
+        lock_t ioLock;  // serializes block writes
+        lock_t wakeLock;  // writer thread sleeps on this, starts locked
+        volatile bool done;
+
+        g_string fname;
+        uint64_t numRecords;
+        uint64_t fileBytes;
+
+    public:
+        explicit MemTraceWriter(const g_string& fname);
+
+        // Called once per controller at construction, before any write;
+        // returns its ID
+        uint32_t addController();
+
+        inline void write(const MemTraceRecord& rec) {
+            Buffer& buf = *buffers[rec.ctrl];
+            futex_lock(&buf.appendLock);
+            while (unlikely(buf.blocks[buf.cur].full)) writeBehind(buf);
+            Block& b = buf.blocks[buf.cur];
+            b.recs[b.num++] = rec;
+            if (unlikely(b.num == BLOCK_RECORDS)) blockFull(buf);
+            futex_unlock(&buf.appendLock);
+        }
+
+        // Writer thread body; returns after finish()
+        static void WriterThreadTrampoline(void* arg);
+
+        // Writes out all pending records. Call once, at the end of the simulation.
+        void finish();
+
+    private:
+        void blockFull(Buffer& buf);
+        void writeBehind(Buffer& buf);
+        // Merges the records of the blocks and writes them. Blocks of the
+        // same controller must come oldest first.
+        void writeBlocks(const std::vector<Block*>& blks);
+        void writeRecords(const MemTraceRecord* recs, uint32_t num);
+};
+
+class MemTraceReader {
+    private:
+        FILE* f;
+        std::vector<uint8_t> raw;
+        std::vector<uint8_t> comp;
+        size_t pos;
+        uint32_t left;  // records left in the current block
+        MemTraceRecord last;
+
+    public:
+        explicit MemTraceReader(const char* fname);
+        ~MemTraceReader();
+
+        // True if the file starts with MEM_TRACE_MAGIC
+        static bool isMemTrace(const char* fname);
+
+        inline bool empty() const { return left == 0; }
+        MemTraceRecord read();
+
+    private:
+        void nextBlock();
+};
+
+#endif  // MEM_TRACE_H_
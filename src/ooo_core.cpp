@@ -30,6 +30,7 @@
 #include "bithacks.h"
 #include "decoder.h"
 #include "filter_cache.h"
+#include "tlb.h"
 #include "zsim.h"
 
 /* Uncomment to induce backpressure to the IW when the load/store buffers fill up. In theory, more detailed,
@@ -55,7 +56,7 @@
 #define ISSUES_PER_CYCLE 4
 #define RF_READS_PER_CYCLE 3
 
-OOOCore::OOOCore(FilterCache* _l1i, FilterCache* _l1d, g_string& _name) : Core(_name), l1i(_l1i), l1d(_l1d), cRec(0, _name) {
+OOOCore::OOOCore(FilterCache* _l1i, FilterCache* _l1d, g_string& _name) : Core(_name), l1i(_l1i), l1d(_l1d), dtlb(nullptr), cRec(0, _name) {
     decodeCycle = DECODE_STAGE;  // allow subtracting from it
     curCycle = 0;
     phaseEndCycle = zinfo->phaseLength;
@@ -113,6 +114,7 @@ void OOOCore::initStats(AggregateStat* parentStat) {
     profIssueStalls.init("issueStalls",  "Issue stalls");  coreStat->append(&profIssueStalls);
 #endif
 
+    if (dtlb) dtlb->initStats(coreStat);
     parentStat->append(coreStat);
 }
 
@@ -127,6 +129,7 @@ void OOOCore::contextSwitch(int32_t gid) {
         // Invalidate virtually-addressed filter caches
         l1i->contextSwitch();
         l1d->contextSwitch();
+        if (dtlb) dtlb->flush();
     }
 }
 
@@ -137,6 +140,16 @@ inline void OOOCore::load(Address addr) {
     loadAddrs[loads++] = addr;
 }
 
+// Returns the cycle the access can issue at. Each page walk read is a
+// dependent L1D access, recorded like a load.
+inline uint64_t OOOCore::translate(Address addr, uint64_t dispatchCycle) {
+    return dtlb->translate(addr, dispatchCycle, [this](Address pLineAddr, uint64_t startCycle) {
+        uint64_t respCycle = l1d->walk(pLineAddr, startCycle) + L1D_LAT;
+        cRec.record(curCycle, startCycle, respCycle);
+        return respCycle;
+    });
+}
+
 void OOOCore::store(Address addr) {
     storeAddrs[stores++] = addr;
 }
@@ -176,6 +189,10 @@ inline void OOOCore::bbl(Address bblAddr, BblInfo* bblInfo) {
     uint32_t prevDecCycle = 0;
     uint64_t lastCommitCycle = 0;  // used to find misprediction penalty
 
+    // A TLB shootdown interrupt holds the front end
+    uint64_t shootdownStall = takeShootdownStall();
+    if (unlikely(shootdownStall)) decodeCycle = MAX(decodeCycle, curCycle) + shootdownStall;
+
     // Run dispatch/IW
     for (uint32_t i = 0; i < bbl->uops; i++) {
         DynUop* uop = &(bbl->uop[i]);
@@ -268,6 +285,7 @@ inline void OOOCore::bbl(Address bblAddr, BblInfo* bblInfo) {
                     Address addr = loadAddrs[loadIdx++];
                     uint64_t reqSatisfiedCycle = dispatchCycle;
                     if (addr != ((Address)-1L)) {
+                        if (dtlb) dispatchCycle = translate(addr, dispatchCycle);
                         reqSatisfiedCycle = l1d->load(addr, dispatchCycle) + L1D_LAT;
                         cRec.record(curCycle, dispatchCycle, reqSatisfiedCycle);
                     }
@@ -305,6 +323,7 @@ inline void OOOCore::bbl(Address bblAddr, BblInfo* bblInfo) {
                     dispatchCycle = MAX(lastStoreAddrCommitCycle+1, dispatchCycle);
 
                     Address addr = storeAddrs[storeIdx++];
+                    if (dtlb) dispatchCycle = translate(addr, dispatchCycle);
                     uint64_t reqSatisfiedCycle = l1d->store(addr, dispatchCycle) + L1D_LAT;
                     cRec.record(curCycle, dispatchCycle, reqSatisfiedCycle);
 
@@ -448,6 +467,7 @@ void OOOCore::join() {
     uint64_t targetCycle = cRec.notifyJoin(curCycle);
     if (targetCycle > curCycle) advance(targetCycle);
     phaseEndCycle = zinfo->globPhaseCycles + zinfo->phaseLength;
+    skipShootdowns();
     // assert(targetCycle <= phaseEndCycle);
     DEBUG_MSG("[%s] Joined, curCycle %ld phaseEnd %ld", name.c_str(), curCycle, phaseEndCycle);
 }
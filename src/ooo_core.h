@@ -39,6 +39,7 @@
 // #define OOO_STALL_STATS
 
 class FilterCache;
+class TLBHierarchy;
 
 /* 2-level branch predictor:
  *  - L1: Branch history shift registers (bshr): 2^NB entries, HB bits of history/entry, indexed by XOR'd PC
@@ -362,6 +363,7 @@ class OOOCore : public Core {
     private:
         FilterCache* l1i;
         FilterCache* l1d;
+        TLBHierarchy* dtlb;  // nullptr if TLBs are not modeled
 
         uint64_t phaseEndCycle; //next stopping point
 
@@ -437,6 +439,7 @@ class OOOCore : public Core {
         OOOCore(FilterCache* _l1i, FilterCache* _l1d, g_string& _name);
 
         void initStats(AggregateStat* parentStat);
+        void setDTLB(TLBHierarchy* _dtlb) {dtlb = _dtlb;}
 
         uint64_t getInstrs() const;
         uint64_t getPhaseCycles() const;
@@ -457,6 +460,7 @@ class OOOCore : public Core {
     private:
         inline void load(Address addr);
         inline void store(Address addr);
+        inline uint64_t translate(Address addr, uint64_t dispatchCycle);
 
         /* NOTE: Analysis routines cannot touch curCycle directly, must use
          * advance() for long jumps or insWindow.advancePos() for 1-cycle
@@ -1,56 +1,116 @@
 #include "os_placement.h"
 #include "cache.h"
-#include <queue>
-#include <vector>
-#include <functional>
+#include <algorithm>
+
+OSPlacementPolicy::OSPlacementPolicy(MemoryController * mc, uint32_t num_threads)
+   : _mc(mc)
+{
+   assert(num_threads > 0);
+   _num_helpers = num_threads - 1;
+   // A few chunks per thread, so a thread that starts late still gets work
+   _num_chunks = 4 * num_threads;
+   _chunks = gm_calloc<Chunk>(_num_chunks);
+   for (uint32_t i = 0; i < _num_chunks; i++)
+      new (&_chunks[i].top) g_vector<Candidate>();
+   _wake_locks = gm_calloc<lock_t>(_num_helpers);
+   for (uint32_t i = 0; i < _num_helpers; i++) {
+      futex_init(&_wake_locks[i]);
+      futex_lock(&_wake_locks[i]);  // starts locked, so helpers sleep
+   }
+   _tlb = nullptr;
+   _next_chunk = _num_chunks;  // nothing to take until the first epoch ends
+   _chunks_done = 0;
+   _helper_ticket = 0;
+}
 
 void
-OSPlacementPolicy::handleCacheAccess(Address tag, ReqType type)
+OSPlacementPolicy::handleCacheAccess(TLBEntry * page, ReqType type)
 {
-   //map<Address, TLBEntry> &tlb = *_mc->getTLB();
-   //assert(tlb.find(tag) != tlb.end());
-   //tlb[tag].count ++; 
+   if (page->count < TLBEntry::MAX_COUNT)
+      page->count ++;
 }
 
-uint64_t 
-OSPlacementPolicy::remapPages() 
+// Keeps the top num_ways candidates, in no particular order. O(candidates).
+void
+OSPlacementPolicy::keepHottest(g_vector<Candidate> &c, uint32_t num_ways)
 {
-   /*
-   map<Address, TLBEntry> &tlb = *_mc->getTLB();
-   // sort the pages based on frequency. 
-   // if they have the same frequency, prioritize the page already cached.
-   auto cmp = [](TLBEntry * left, TLBEntry * right) { return (left->count < right->count); };
-   priority_queue<TLBEntry *, vector<TLBEntry *>, decltype(cmp)> queue(cmp);
-   //priority_queue<TLBEntry *> queue(cmp);
-   //printf("size = %ld\n", tlb.size());
-   for(map<Address, TLBEntry>::iterator it = tlb.begin(); it != tlb.end(); ++it) {
-      // move the page out of dram cache.
-      it->second.way = _mc->getNumWays();
-      queue.push(&it->second);
+   auto hotter = [num_ways](const Candidate &a, const Candidate &b) {
+      if (a.count != b.count)
+         return a.count > b.count;
+      bool a_cached = a.page->way != num_ways;
+      bool b_cached = b.page->way != num_ways;
+      if (a_cached != b_cached)
+         return a_cached;
+      return a.page->tag < b.page->tag;
+   };
+   if (c.size() > num_ways) {
+      std::nth_element(c.begin(), c.begin() + num_ways, c.end(), hotter);
+      c.resize(num_ways);
    }
-   
-   uint64_t cur_way = 0;
-   assert(_mc->getNumSets() == 1);
-   uint64_t num_replace = 0;
-   for (uint64_t i = 0; i < _mc->getNumWays(); i++) {
-      if (i == tlb.size())
-         break;
-      TLBEntry * top = queue.top();
-	  if (top->way == _mc->getNumWays())
-		  num_replace ++;
-      top->way = cur_way;
-      queue.pop();
-
-      Set * cache = _mc->getSets();
-      cache[0].ways[cur_way].valid = true;
-      cache[0].ways[cur_way].tag = top->tag;
-      cache[0].ways[cur_way].dirty = false; 
-      cur_way ++;
+}
+
+// The hottest pages of one chunk of slots, whose counters are then halved
+void
+OSPlacementPolicy::selectChunk(uint32_t chunk)
+{
+   uint64_t capacity = _tlb->capacity();
+   g_vector<Candidate> &top = _chunks[chunk].top;
+   top.clear();
+   _tlb->forEach(capacity * chunk / _num_chunks, capacity * (chunk + 1) / _num_chunks, [&](TLBEntry &page) {
+      // Pages never accessed are never worth moving in
+      if (page.count > 0)
+         top.push_back({page.count, &page});
+      page.count /= 2;
+   });
+   keepHottest(top, _mc->getNumWays());
+}
+
+// Takes chunks until none are left
+void
+OSPlacementPolicy::runChunks()
+{
+   uint32_t chunk;
+   while ((chunk = __sync_fetch_and_add(&_next_chunk, 1)) < _num_chunks) {
+      selectChunk(chunk);
+      __sync_fetch_and_add(&_chunks_done, 1);
+   }
+}
+
+void
+OSPlacementPolicy::HelperThreadTrampoline(void* arg)
+{
+   OSPlacementPolicy * policy = static_cast<OSPlacementPolicy *>(arg);
+   uint32_t id = __sync_fetch_and_add(&policy->_helper_ticket, 1);
+   assert(id < policy->_num_helpers);
+   while (true) {
+      futex_lock(&policy->_wake_locks[id]);  // unlocked by selectHotPages
+      policy->runChunks();
    }
-   // Clear all the counters in TLB
-   for(map<Address, TLBEntry>::iterator it = tlb.begin(); it != tlb.end(); ++it)
-      it->second.count /= 2;
-   return num_replace;
-   */
-   return 0;
+}
+
+void
+OSPlacementPolicy::selectHotPages(PageTable * tlb, g_vector<TLBEntry *> &hot)
+{
+   assert(_mc->getNumSets() == 1);
+   _tlb = tlb;
+   _chunks_done = 0;
+   __sync_synchronize();
+   _next_chunk = 0;
+   __sync_synchronize();
+   // Wake the helpers that have started; a late one finds no chunks left
+   uint32_t helpers = std::min((uint32_t)_helper_ticket, _num_helpers);
+   for (uint32_t i = 0; i < helpers; i++)
+      futex_unlock(&_wake_locks[i]);
+   runChunks();
+   while (_chunks_done < _num_chunks)
+      _mm_pause();
+   __sync_synchronize();
+
+   g_vector<Candidate> top;
+   for (uint32_t i = 0; i < _num_chunks; i++)
+      top.insert(top.end(), _chunks[i].top.begin(), _chunks[i].top.end());
+   keepHottest(top, _mc->getNumWays());
+   hot.clear();
+   for (const Candidate &c : top)
+      hot.push_back(c.page);
 }
@@ -1,20 +1,60 @@
 #pragma once
+#include "g_std/g_vector.h"
 #include "memory_hierarchy.h"
 #include "mc.h"
+#include "pad.h"
 
 class DramCache;
 
+// HMA: software-managed MC-Dram. Pages are not placed on misses. Instead, the
+// OS counts accesses per page and, at the end of every epoch, moves the
+// hottest pages into MC-Dram (see MemoryController::remapPages).
+//
+// The selection splits the page table into chunks. The thread that ends the
+// epoch and up to num_threads - 1 helper threads each take chunks, keep the
+// top pages of each, and the caller merges them. Helpers are started by the
+// simulator (see HelperThreadTrampoline); without them, the caller does every
+// chunk. Ties are broken by tag, so the result does not depend on the split.
 class OSPlacementPolicy
 {
 public:
-	OSPlacementPolicy(MemoryController * mc) : _mc(mc) {};
-	void handleCacheAccess(Address tag, ReqType type);
-	uint64_t remapPages(); 
-	
-	void clearStats(); 
+	OSPlacementPolicy(MemoryController * mc, uint32_t num_threads);
+	void handleCacheAccess(TLBEntry * page, ReqType type);
+	// Fills hot with the pages to hold in MC-Dram next epoch: the most
+	// accessed ones, at most one per way, preferring cached pages on ties.
+	// Then halves all counters, so older epochs weigh less.
+	void selectHotPages(PageTable * tlb, g_vector<TLBEntry *> &hot);
+
+	uint32_t getNumHelpers() { return _num_helpers; };
+	// Helper thread body; never returns
+	static void HelperThreadTrampoline(void* arg);
+
+	void clearStats();
 	//void printInfo();
-	 
+
 private:
-	
+	struct Candidate {
+		uint32_t count;  // before this epoch's halving
+		TLBEntry * page;
+	};
+	struct Chunk {
+		g_vector<Candidate> top;
+		PAD();
+	};
+
+	static void keepHottest(g_vector<Candidate> &c, uint32_t num_ways);
+	void selectChunk(uint32_t chunk);
+	void runChunks();
+
 	MemoryController * _mc;
+	uint32_t _num_helpers;
+	uint32_t _num_chunks;
+	Chunk * _chunks;
+	lock_t * _wake_locks;  // one per helper; helpers sleep on theirs
+
+	// The current selection
+	PageTable * _tlb;
+	volatile uint32_t _next_chunk;
+	volatile uint32_t _chunks_done;
+	volatile uint32_t _helper_ticket;
 };
@@ -0,0 +1,101 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "page_allocator.h"
+#include <string>
+#include "config.h"
+#include "log.h"
+#include "zsim.h"
+
+PageAllocator::PageAllocator(Config& config) {
+    for (Stripe& s : stripes) futex_init(&s.lock);
+    futex_init(&allocLock);
+
+    std::string p = config.get<const char*>("sim.pagePolicy", "Random");
+    if (p == "Random") policy = Random;
+    else if (p == "Sequential") policy = Sequential;
+    else if (p == "FirstTouch") policy = FirstTouch;
+    else if (p == "HugePage") policy = HugePage;
+    else panic("Invalid sim.pagePolicy %s (Random, Sequential, FirstTouch or HugePage)", p.c_str());
+    unitBits = (policy == HugePage)? HUGE_PAGE_BITS : 0;
+
+    // 0 = as many frames as physical addresses hold
+    uint64_t physMB = config.get<uint64_t>("sim.physMemMB", 0);
+    maxFrames = physMB? (physMB << 20 >> 12 >> unitBits) : (1ul << (PROC_SHIFT - unitBits));
+    if (!maxFrames) panic("sim.physMemMB = %ld holds no %s pages", physMB, (policy == HugePage)? "2 MB" : "4 KB");
+
+    srand48_r(0, &randBuf);
+    nextFrame = 0;
+
+    // FirstTouch places pages on the controller SplitAddrMemory sends them to
+    numCtrls = 1;
+    granulePages = 1;
+    if (policy == FirstTouch) {
+        uint32_t ctrls = config.get<uint32_t>("sys.mem.controllers", 1);
+        uint32_t mapGranu = config.get<uint32_t>("sys.mem.mapGranu", 64);
+        if (ctrls > 1 && config.get<bool>("sys.mem.splitAddrs", true) && mapGranu % (1 << PAGE_LINES_BITS) == 0) {
+            numCtrls = ctrls;
+            granulePages = mapGranu >> PAGE_LINES_BITS;
+        } else {
+            warn("sim.pagePolicy = FirstTouch needs several controllers interleaved at page granularity or coarser, pages are placed sequentially");
+        }
+    }
+    ctrlNextFrame = gm_calloc<uint64_t>(numCtrls);
+}
+
+void PageAllocator::initStats(AggregateStat* parentStat) {
+    AggregateStat* allocStat = new AggregateStat();
+    allocStat->init("pageAlloc", "Page allocator stats");
+    profPages.init("pages", "4 KB pages mapped");
+    allocStat->append(&profPages);
+    parentStat->append(allocStat);
+}
+
+Address PageAllocator::allocFrame(Address vunit, uint32_t core) {
+    futex_lock(&allocLock);
+    Address frame;
+    if (policy == Random) {
+        if (usedFrames.size() == maxFrames) panic("Out of physical memory (%ld pages), raise sim.physMemMB", maxFrames);
+        do {
+            long hi, lo;
+            lrand48_r(&randBuf, &hi);
+            lrand48_r(&randBuf, &lo);
+            frame = (((Address)hi << 31) | lo) % maxFrames;
+        } while (usedFrames.count(frame));
+        usedFrames.insert(frame);
+    } else if (policy == FirstTouch && numCtrls > 1) {
+        // Cores and controllers are spread over domains in order, as in init
+        uint32_t ctrl = (core < zinfo->numCores)? core*numCtrls/zinfo->numCores : vunit % numCtrls;
+        uint64_t k = ctrlNextFrame[ctrl]++;
+        frame = ((k / granulePages) * numCtrls + ctrl) * granulePages + k % granulePages;
+        if (frame >= maxFrames) panic("Out of physical memory on controller %d, raise sim.physMemMB", ctrl);
+    } else {
+        frame = nextFrame++;
+        if (frame >= maxFrames) panic("Out of physical memory (%ld pages), raise sim.physMemMB", maxFrames << unitBits);
+    }
+    profPages.inc(1ul << unitBits);
+    futex_unlock(&allocLock);
+    return frame;
+}
@@ -0,0 +1,114 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PAGE_ALLOCATOR_H_
+#define PAGE_ALLOCATOR_H_
+
+#include <stdlib.h>
+#include "g_std/g_unordered_map.h"
+#include "g_std/g_unordered_set.h"
+#include "galloc.h"
+#include "locks.h"
+#include "memory_hierarchy.h"
+#include "pad.h"
+#include "stats.h"
+
+class Config;
+
+/* System-wide virtual-to-physical page allocator (sim.enableTLB). All L1s
+ * share one page table, so threads of a process see the same physical page
+ * for a virtual page, whichever core they run on. Physical pages are unique
+ * across processes, so physical addresses carry no process bits.
+ *
+ * Policies (sim.pagePolicy) decide where a page lands on its first touch:
+ *  - Random: a random free 4 KB frame (the default)
+ *  - Sequential: the next free frame, so memory fills densely in touch order
+ *  - FirstTouch: the next free frame of the memory controller closest to the
+ *    touching core (see sys.mem.mapGranu and SplitAddrMemory)
+ *  - HugePage: 2 MB pages, handed out like Sequential; the 4 KB pages of a
+ *    2 MB virtual page stay contiguous and keep their offset
+ *
+ * The page table is striped by virtual page, so lookups of different pages
+ * rarely contend. Frames are picked under a separate lock, on first touch only.
+ */
+class PageAllocator : public GlobAlloc {
+    public:
+        enum Policy {Random, Sequential, FirstTouch, HugePage};
+
+    private:
+        static const uint32_t STRIPE_BITS = 6;
+        static const uint32_t PAGE_LINES_BITS = 6;  // 4 KB pages of 64 B lines
+        static const uint32_t HUGE_PAGE_BITS = 9;  // 2 MB = 512 pages
+        static const uint32_t PROC_SHIFT = 52;  // virtual pages fit below this
+
+        struct Stripe {
+            lock_t lock;
+            g_unordered_map<Address, Address> pages;  // (proc, virtual unit) -> physical unit
+            PAD();
+        };
+
+        Stripe stripes[1 << STRIPE_BITS];
+
+        Policy policy;
+        uint32_t unitBits;  // log2 of pages per mapping unit: 0, or HUGE_PAGE_BITS
+        uint64_t maxFrames;  // physical memory, in mapping units
+
+        lock_t allocLock;
+        drand48_data randBuf;
+        g_unordered_set<Address> usedFrames;  // Random only
+        uint64_t nextFrame;
+
+        // FirstTouch
+        uint32_t numCtrls;
+        uint32_t granulePages;  // consecutive pages on one controller
+        uint64_t* ctrlNextFrame;
+
+        Counter profPages;  // 4 KB pages mapped
+
+    public:
+        explicit PageAllocator(Config& config);
+
+        void initStats(AggregateStat* parentStat);
+
+        // Physical line of a virtual line of process proc, touched from
+        // core (or -1 if the thread has no core). Maps the page if needed.
+        inline Address translate(uint32_t proc, Address vLineAddr, uint32_t core) {
+            Address vpn = vLineAddr >> PAGE_LINES_BITS;
+            Address key = ((Address)proc << PROC_SHIFT) | (vpn >> unitBits);
+            Stripe& s = stripes[(key * 0x9E3779B97F4A7C15ul) >> (64 - STRIPE_BITS)];
+            futex_lock(&s.lock);
+            auto it = s.pages.find(key);
+            Address frame = (it != s.pages.end())? it->second : (s.pages[key] = allocFrame(vpn >> unitBits, core));
+            futex_unlock(&s.lock);
+            Address pageOffset = vLineAddr & ((1ul << (PAGE_LINES_BITS + unitBits)) - 1);
+            return (frame << (PAGE_LINES_BITS + unitBits)) | pageOffset;
+        }
+
+    private:
+        // Picks a free frame, in mapping units; called with the page's stripe lock held
+        Address allocFrame(Address vunit, uint32_t core);
+};
+
+#endif  // PAGE_ALLOCATOR_H_
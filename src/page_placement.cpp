@@ -1,13 +1,17 @@
 #include "page_placement.h"
 #include "mc.h"
+#include "mc_checkpoint.h"
 #include <stdlib.h>
+#include <algorithm>
 #include <iostream>
 
 void
 PagePlacementPolicy::initialize(Config & config)
 {
 	_num_chunks = _mc->getNumSets();
-	_chunks = (ChunkInfo *) gm_malloc(sizeof(ChunkInfo) *  _num_chunks);
+	// gm_malloc does not align to cache lines, so round up by hand
+	uintptr_t chunks = (uintptr_t) gm_malloc(sizeof(ChunkInfo) * _num_chunks + CACHE_LINE_BYTES);
+	_chunks = (ChunkInfo *) ((chunks + CACHE_LINE_BYTES - 1) & ~((uintptr_t) CACHE_LINE_BYTES - 1));
 	
 	_scheme = _mc->getScheme();
 	_sample_rate = config.get<double>("sys.mem.mcdram.sampleRate");
@@ -19,28 +23,24 @@ PagePlacementPolicy::initialize(Config & config)
 	} else 
 		_max_count_size = 255;
 
-	_num_entries_per_chunk = 9; //g_num_entries_per_chunk;
+	assert(_max_count_size <= UINT8_MAX);
 	//_num_stable_entries = _num_entries_per_chunk / 2;
 	assert(_num_entries_per_chunk > _mc->getNumWays());
 	for (uint64_t i = 0; i < _num_chunks; i++)
 	{
-		_chunks[i].num_hits = 0;
-		_chunks[i].num_misses = 0;
-		_chunks[i].entries = (ChunkEntry *) gm_malloc(sizeof(ChunkEntry) * _num_entries_per_chunk);
-		for (uint32_t j = 0; j < _num_entries_per_chunk; j++)
-			_chunks[i].entries[j].valid = false;
+		flushChunk(i);
+		for (uint32_t j = 0; j < _mc->getNumWays(); j++)
+			_chunks[i].lru[j] = j;
 	}
 	_histogram = NULL;
-	srand48_r(rand(), &_buffer);
+	_num_stripes = _mc->getNumSetLocks();
+	_stripes = gm_calloc<StripeState>(_num_stripes);
+	long seed = rand();
+	for (uint32_t i = 0; i < _num_stripes; i++)
+		srand48_r(seed + i, &_stripes[i].buffer);
 	clearStats();
 
 	g_string scheme = config.get<const char *>("sys.mem.mcdram.placementPolicy");
-	_lru_bits = (uint32_t **) gm_malloc(sizeof(uint32_t *) * _mc->getNumSets());
-	for (uint64_t i = 0; i < _mc->getNumSets(); i++) {
-		_lru_bits[i] = (uint32_t *) gm_malloc(sizeof(uint32_t) * _mc->getNumWays()); 
-		for (uint32_t j = 0; j < _mc->getNumWays(); j++)
-			_lru_bits[i][j] = j;
-	}
 	// hyrbid
 	if (scheme == "LRU")
 		_placement_policy = LRU;
@@ -51,29 +51,31 @@ PagePlacementPolicy::initialize(Config & config)
 }
 
 uint32_t 
-PagePlacementPolicy::handleCacheMiss(Address tag, ReqType type, uint64_t set_num, Set * set, bool &counter_access)
+PagePlacementPolicy::handleCacheMiss(Address tag, ReqType type, uint64_t set_num, bool &counter_access)
 {
 	uint64_t chunk_num = set_num;
-	//ChunkInfo * chunk = &_chunks[chunk_num];
-	_chunks[chunk_num].num_misses ++;
+	ChunkInfo * chunk = &_chunks[chunk_num];
+	StripeState & stripe = _stripes[_mc->getLockStripe(set_num)];
+	TagArray * tags = _mc->getTags();
+	uint32_t empty_way = tags->getEmptyWay(set_num);
 	
 	if (_placement_policy == LRU)
 	{
-		if (set->hasEmptyWay()) {
-			updateLRU(set_num, set->getEmptyWay());
-			return set->getEmptyWay();
+		if (empty_way < _mc->getNumWays()) {
+			updateLRU(set_num, empty_way);
+			return empty_way;
 	 	}
 		if (!_enable_replace)
 			return _mc->getNumWays();
 	  	double f;
 	  	int64_t way;
-		drand48_r(&_buffer, &f);
-	  	lrand48_r(&_buffer, &way);
+		drand48_r(&stripe.buffer, &f);
+	  	lrand48_r(&stripe.buffer, &way);
 		if (f < _sample_rate) {
 			//if (_scheme == UnisonCache) {
 				for (uint32_t i = 0; i < _mc->getNumWays(); i++)
-					if (_lru_bits[set_num][i] == _mc->getNumWays() - 1) {
-						Address victim_tag = set->ways[i].tag;
+					if (chunk->lru[i] == _mc->getNumWays() - 1) {
+						Address victim_tag = tags->getTag(set_num, i);
 						if (_scheme == HybridCache) {
 							if (_mc->getTagBuffer()->canInsert(tag, victim_tag)) {
 								updateLRU(set_num, i);
@@ -93,21 +95,7 @@ PagePlacementPolicy::handleCacheMiss(Address tag, ReqType type, uint64_t set_num
 	assert(_placement_policy == FBR);
 	assert(_enable_replace);
 
-#if 1
-	ChunkInfo * chunk = &_chunks[chunk_num];
-	for (uint32_t way = 0; way < _mc->getNumWays(); way++)
-		if (set->ways[way].valid) {
-			if (set->ways[way].tag != _chunks[chunk_num].entries[way].tag)
-			{
-				for (uint32_t i = 0; i < _num_entries_per_chunk; i++)
-					printf("ID=%d, tag=%ld, valid=%d, count=%d\n", 
-						i, chunk->entries[i].tag, chunk->entries[i].valid, chunk->entries[i].count);
-				for (uint32_t i = 0; i < _mc->getNumWays(); i++)
-					printf("ID=%d, tag=%ld\n", i, set->ways[i].tag);
-			}
-			assert(set->ways[way].tag == _chunks[chunk_num].entries[way].tag);
-		}
-#endif 
+	checkChunk(set_num);
 
 	// for HybridCache, never replace for store (LLC dirty evict) 
 	if (type == STORE)
@@ -121,51 +109,44 @@ PagePlacementPolicy::handleCacheMiss(Address tag, ReqType type, uint64_t set_num
 		sample_rate = 1;
 
 	// the set uses FBR replacement policy
-	bool updateFBR = set->hasEmptyWay() ||  sampleOrNot(sample_rate, miss_rate_tune);
+	bool updateFBR = empty_way < _mc->getNumWays() ||  sampleOrNot(stripe.buffer, sample_rate, miss_rate_tune);
 	if (updateFBR)
 	{
-		uint32_t empty_way = set->getEmptyWay();
 		counter_access = true;
-		_num_counter_read ++;
-		_num_counter_write ++;
-		uint32_t idx = getChunkEntry(tag, &_chunks[chunk_num]);
+		stripe.num_counter_read ++;
+		stripe.num_counter_write ++;
+		uint32_t idx = getChunkEntry(tag, chunk, stripe.buffer);
 		if (idx == _num_entries_per_chunk)
 			return _mc->getNumWays();
-		ChunkEntry * chunk_entry = &_chunks[chunk_num].entries[idx];
-		chunk_entry->count ++;
-		if (chunk_entry->count >= _max_count_size) 
-			handleCounterOverflow(&_chunks[chunk_num], chunk_entry);
+		incrementCounter(chunk, idx);
 		
-		//idx = adjustEntryOrder(&_chunks[chunk_num], idx);
-		//chunk_entry = &_chunks[chunk_num].entries[idx];
+		//idx = adjustEntryOrder(chunk, idx);
 		
 		// empty slots left in dram cache
 		if (empty_way < _mc->getNumWays()) {
 			assert(idx == empty_way);
-			_num_empty_replace ++;
+			stripe.num_empty_replace ++;
 			return empty_way;
 		}
 		else // figure if we can replace an entry. 
 		{
 			assert(idx >= _mc->getNumWays());
-			uint32_t victim_way = pickVictimWay(&_chunks[chunk_num]);
+			uint32_t victim_way = pickVictimWay(chunk);
 			assert(victim_way < _mc->getNumWays());
-/*			if (compareCounter(&_chunks[chunk_num].entries[idx], &_chunks[chunk_num].entries[victim_way]) && !_mc->getTagBuffer()->canInsert(tag, _chunks[chunk_num].entries[victim_way].tag)) 
+/*			if (compareCounter(chunk->counts[idx], chunk->counts[victim_way]) && !_mc->getTagBuffer()->canInsert(tag, chunk->tags[victim_way])) 
 			{
 				printf("!!!!!!Occupancy = %f\n", _mc->getTagBuffer()->getOccupancy());
 				static int n = 0;
 				printf("cannot insert (%d)   occupancy=%f.  set1=%ld, set2=%ld\n", 
-						n++, _mc->getTagBuffer()->getOccupancy(), (tag % 128), _chunks[chunk_num].entries[victim_way].tag % 128);
+						n++, _mc->getTagBuffer()->getOccupancy(), (tag % 128), chunk->tags[victim_way] % 128);
 			}
 */			
-			if (compareCounter(&_chunks[chunk_num].entries[idx], &_chunks[chunk_num].entries[victim_way])
-				&& _mc->getTagBuffer()->canInsert(tag, _chunks[chunk_num].entries[victim_way].tag))
+			if (compareCounter(chunk->counts[idx], chunk->counts[victim_way])
+				&& _mc->getTagBuffer()->canInsert(tag, chunk->tags[victim_way]))
 			{
 				//assert(idx < _num_stable_entries);
 				// swap current way with victim way.
-				ChunkEntry tmp = _chunks[chunk_num].entries[idx];
-				_chunks[chunk_num].entries[idx] = _chunks[chunk_num].entries[victim_way];
-				_chunks[chunk_num].entries[victim_way] = tmp;
+				chunk->swapEntries(idx, victim_way);
 				//assert(idx >= _mc->getNumWays() && idx < _num_stable_entries);
 				return victim_way;
 			} 
@@ -178,9 +159,9 @@ PagePlacementPolicy::handleCacheMiss(Address tag, ReqType type, uint64_t set_num
 }
 
 void 
-PagePlacementPolicy::handleCacheHit(Address tag, ReqType type, uint64_t set_num, Set * set, bool &counter_access, uint32_t hit_way)
+PagePlacementPolicy::handleCacheHit(Address tag, ReqType type, uint64_t set_num, bool &counter_access, uint32_t hit_way)
 {
-	assert(tag == set->ways[hit_way].tag);
+	assert(tag == _mc->getTags()->getTag(set_num, hit_way));
 	if (_placement_policy == LRU) {
 		//if (_scheme == UnisonCache)
 			updateLRU(set_num, hit_way);
@@ -188,36 +169,8 @@ PagePlacementPolicy::handleCacheHit(Address tag, ReqType type, uint64_t set_num,
 	}
 	uint64_t chunk_num = set_num;
 	ChunkInfo * chunk = &_chunks[chunk_num];
-#if 1
-	// for DEBUG
-	// the first few entries in chunk->entries must be in dram cache
-	for (uint32_t way = 0; way < _mc->getNumWays(); way++)
-		if (set->ways[way].valid) {
-			if (set->ways[way].tag != _chunks[chunk_num].entries[way].tag)
-			{
-				for (uint32_t i = 0; i < _num_entries_per_chunk; i++)
-					printf("ID=%d, tag=%ld, valid=%d, count=%d\n", 
-						i, chunk->entries[i].tag, chunk->entries[i].valid, chunk->entries[i].count);
-				for (uint32_t i = 0; i < _mc->getNumWays(); i++)
-					printf("ID=%dm tag=%ld\n", i, set->ways[i].tag);
-			}
-			assert(set->ways[way].tag == _chunks[chunk_num].entries[way].tag);
-		}
-	// chunk->entries are properly ordered.
-	/*uint32_t min_count = 10000;
-	for (uint32_t way = 0; way < _num_stable_entries; way++)
-		if (chunk->entries[way].valid && chunk->entries[way].count < min_count)
-			min_count = chunk->entries[way].count;
-	for (uint32_t way = _num_stable_entries; way < _num_entries_per_chunk; way++)
-		if (chunk->entries[way].valid) {
-			if (chunk->entries[way].count > min_count)
-			{
-				for (uint32_t i = 0; i < _num_entries_per_chunk; i++)
-					cout <<  i << " " << chunk->entries[i].valid << " " << chunk->entries[i].count << endl;
-			}
-			assert(chunk->entries[way].count <= min_count);
-		}*/
-#endif 
+	StripeState & stripe = _stripes[_mc->getLockStripe(set_num)];
+	checkChunk(set_num);
 
 	double sample_rate = _sample_rate;
 	bool miss_rate_tune = true; //false; 
@@ -225,60 +178,57 @@ PagePlacementPolicy::handleCacheHit(Address tag, ReqType type, uint64_t set_num,
 		miss_rate_tune = false;
 	if (_mc->getNumRequests() < _mc->getNumSets() * _mc->getNumWays() * 64 * 8)
 	 	sample_rate = 1;
-	if (sampleOrNot(sample_rate, miss_rate_tune))
+	if (sampleOrNot(stripe.buffer, sample_rate, miss_rate_tune))
 	{
 		counter_access = true;
-		_num_counter_read ++;
-		_num_counter_write ++;
-		uint32_t idx = getChunkEntry(tag, &_chunks[chunk_num]);
-		ChunkEntry * chunk_entry = &_chunks[chunk_num].entries[idx];
+		stripe.num_counter_read ++;
+		stripe.num_counter_write ++;
+		uint32_t idx = getChunkEntry(tag, chunk, stripe.buffer);
 		assert(idx < _mc->getNumWays()); 
-		chunk_entry->count ++;
-		//assert( idx == adjustEntryOrder(&_chunks[chunk_num], idx ));
-		if (chunk_entry->count >= _max_count_size) 
-			handleCounterOverflow(&_chunks[chunk_num], chunk_entry);
+		incrementCounter(chunk, idx);
+		//assert( idx == adjustEntryOrder(chunk, idx ));
 	}
 }
 
 uint32_t
-PagePlacementPolicy::getChunkEntry(Address tag, ChunkInfo * chunk_info, bool allocate)
+PagePlacementPolicy::getChunkEntry(Address tag, ChunkInfo * chunk_info, drand48_data &buffer, bool allocate)
 {
 	uint32_t idx = _num_entries_per_chunk; 
 	for (uint32_t i = 0; i < _num_entries_per_chunk; i++)
 	{
-		if (chunk_info->entries[i].valid && chunk_info->entries[i].tag == tag)
-			return i; //&chunk_info->entries[i];
-		else if (!chunk_info->entries[i].valid && idx == _num_entries_per_chunk) 
+		if (chunk_info->isValid(i) && chunk_info->tags[i] == tag)
+			return i;
+		else if (!chunk_info->isValid(i) && idx == _num_entries_per_chunk) 
 			idx = i; 
 	}
 	if (idx == _num_entries_per_chunk && allocate) 
 	{
 	  	int64_t rand;
 		double f;
-	  	lrand48_r(&_buffer, &rand);
-		drand48_r(&_buffer, &f);
+	  	lrand48_r(&buffer, &rand);
+		drand48_r(&buffer, &f);
 		// randomly pick a victim entry
 		idx = _mc->getNumWays() + rand % (_num_entries_per_chunk - _mc->getNumWays());
 		assert(idx >= _mc->getNumWays());
 		// replace the entry with certain probability.
 		// high count value reduces the probability
-		if (chunk_info->entries[idx].count > 0 && f > 1.0 / chunk_info->entries[idx].count)
+		if (chunk_info->counts[idx] > 0 && f > 1.0 / chunk_info->counts[idx])
 			idx = _num_entries_per_chunk;
 	}
 	if (idx < _num_entries_per_chunk) {
-		chunk_info->entries[idx].valid = true; 
-		chunk_info->entries[idx].tag = tag; 
-		chunk_info->entries[idx].count = 0;
+		chunk_info->valid |= 1 << idx; 
+		chunk_info->tags[idx] = tag; 
+		chunk_info->counts[idx] = 0;
 	}
 	return idx;
 }
 
 bool 
-PagePlacementPolicy::sampleOrNot(double sample_rate, bool miss_rate_tune)
+PagePlacementPolicy::sampleOrNot(drand48_data &buffer, double sample_rate, bool miss_rate_tune)
 {
 	double miss_rate = _mc->getRecentMissRate();
 	double f;
-	drand48_r(&_buffer, &f);
+	drand48_r(&buffer, &f);
 	if (miss_rate_tune)
 		return f < sample_rate * miss_rate;
 	else 
@@ -286,15 +236,10 @@ PagePlacementPolicy::sampleOrNot(double sample_rate, bool miss_rate_tune)
 }
 
 bool
-PagePlacementPolicy::compareCounter(ChunkEntry * entry1, ChunkEntry * entry2)
+PagePlacementPolicy::compareCounter(uint32_t count1, uint32_t count2)
 {
-	if (!entry1)
-		return false;
-	else if (!entry2)
-		return entry1->count > 0;
-	else
-		//return entry1->count >= entry2->count + 32 * _sample_rate; 
-		return entry1->count >= entry2->count + (_mc->getGranularity() / 64 / 2) * _sample_rate; 
+	//return count1 >= count2 + 32 * _sample_rate; 
+	return count1 >= count2 + (_mc->getGranularity() / 64 / 2) * _sample_rate; 
 		//getCurrSampleRate());
 		//return (entry1->count - 1 > 1.1 * entry2->count); 
 }
@@ -312,25 +257,38 @@ PagePlacementPolicy::adjustEntryOrder(ChunkInfo * chunk_info, uint32_t idx)
 	uint32_t min_idx = 100;
 	for (uint32_t i = _mc->getNumWays(); i < _num_stable_entries; i++)
 	{
-		assert(chunk_info->entries[i].valid);
-		if (chunk_info->entries[i].count < min_count)
+		assert(chunk_info->isValid(i));
+		if (chunk_info->counts[i] < min_count)
 		{
-			min_count = chunk_info->entries[i].count;
+			min_count = chunk_info->counts[i];
 			min_idx = i;
 		}
 	}
-	if (min_count <= chunk_info->entries[idx].count)
+	if (min_count <= chunk_info->counts[idx])
 	{
 		// swap the two entries
-		ChunkEntry tmp = chunk_info->entries[idx];
-		chunk_info->entries[idx] = chunk_info->entries[min_idx];
-		chunk_info->entries[min_idx] = tmp;
+		chunk_info->swapEntries(idx, min_idx);
 		return min_idx;
 	}
 	return idx;
 */
 }
 
+uint32_t
+PagePlacementPolicy::peekVictim(uint64_t set_num)
+{
+	if (_mc->getTags()->hasEmptyWay(set_num))
+		return _mc->getNumWays();
+	ChunkInfo * chunk = &_chunks[set_num];
+	if (_placement_policy == LRU) {
+		for (uint32_t i = 0; i < _mc->getNumWays(); i++)
+			if (chunk->lru[i] == _mc->getNumWays() - 1)
+				return i;
+		return _mc->getNumWays();
+	}
+	return pickVictimWay(chunk);
+}
+
 uint32_t 
 PagePlacementPolicy::pickVictimWay(ChunkInfo * chunk_info)
 {
@@ -338,35 +296,83 @@ PagePlacementPolicy::pickVictimWay(ChunkInfo * chunk_info)
 	uint32_t min_idx = _mc->getNumWays();
 	for (uint32_t i = 0; i < _mc->getNumWays(); i++)
 	{
-		assert(chunk_info->entries[i].valid);
-		if (chunk_info->entries[i].count < min_count)
+		assert(chunk_info->isValid(i));
+		if (chunk_info->counts[i] < min_count)
 		{
-			min_count = chunk_info->entries[i].count;
+			min_count = chunk_info->counts[i];
 			min_idx = i;
 		}
 	}
 	return min_idx;
 }
 
+// On saturation, all counters of the chunk are halved (the overflowing one
+// after its increment), keeping their relative order.
 void 
-PagePlacementPolicy::handleCounterOverflow(ChunkInfo * chunk_info, ChunkEntry * overflow_entry)
+PagePlacementPolicy::incrementCounter(ChunkInfo * chunk_info, uint32_t idx)
 {
+	chunk_info->counts[idx] ++;
+	if (chunk_info->counts[idx] < _max_count_size)
+		return;
 	for (uint32_t i = 0; i < _num_entries_per_chunk; i++)
 	{
-		if (overflow_entry == &chunk_info->entries[i])
-			++(overflow_entry->count) /= 2; 
+		if (i == idx)
+			chunk_info->counts[i] = (chunk_info->counts[i] + 1) / 2; 
 		else 
-			chunk_info->entries[i].count /= 2;
+			chunk_info->counts[i] /= 2;
 	}
 }
 
+void
+PagePlacementPolicy::ChunkInfo::swapEntries(uint32_t a, uint32_t b)
+{
+	std::swap(tags[a], tags[b]);
+	std::swap(counts[a], counts[b]);
+	uint16_t bit_a = (valid >> a) & 1;
+	uint16_t bit_b = (valid >> b) & 1;
+	valid = (valid & ~((1 << a) | (1 << b))) | (bit_a << b) | (bit_b << a);
+}
+
+// Debug-only: the first num_ways entries must track the set's ways in order.
+// Build with -DDEBUG_PAGE_PLACEMENT to check on every FBR access.
+void
+PagePlacementPolicy::checkChunk(uint64_t set_num)
+{
+#ifdef DEBUG_PAGE_PLACEMENT
+	ChunkInfo * chunk = &_chunks[set_num];
+	TagArray * tags = _mc->getTags();
+	for (uint32_t way = 0; way < _mc->getNumWays(); way++)
+		if (tags->isValid(set_num, way)) {
+			if (tags->getTag(set_num, way) != chunk->tags[way])
+			{
+				for (uint32_t i = 0; i < _num_entries_per_chunk; i++)
+					printf("ID=%d, tag=%ld, valid=%d, count=%d\n", 
+						i, chunk->tags[i], chunk->isValid(i), chunk->counts[i]);
+				for (uint32_t i = 0; i < _mc->getNumWays(); i++)
+					printf("ID=%d, tag=%ld\n", i, tags->getTag(set_num, i));
+			}
+			assert(tags->getTag(set_num, way) == chunk->tags[way]);
+		}
+#endif
+}
+
+uint64_t
+PagePlacementPolicy::getTraffic()
+{
+	uint64_t traffic = 0;
+	for (uint32_t i = 0; i < _num_stripes; i++)
+		traffic += _stripes[i].num_counter_read + _stripes[i].num_counter_write;
+	return traffic;
+}
+
 void 
 PagePlacementPolicy::clearStats()
 {
-	_num_counter_read = 0;
-	_num_counter_write = 0;
-	
-	_num_empty_replace = 0;
+	for (uint32_t i = 0; i < _num_stripes; i++) {
+		_stripes[i].num_counter_read = 0;
+		_stripes[i].num_counter_write = 0;
+		_stripes[i].num_empty_replace = 0;
+	}
 }
 
 void 
@@ -385,11 +391,11 @@ PagePlacementPolicy::computeFreqDistr()
 			uint32_t max_count = 0; 
 			for (uint32_t j = 0; j < _num_entries_per_chunk; j++)
 			{
-				if (_chunks[chunk_id].entries[j].valid)
+				if (_chunks[chunk_id].isValid(j))
 				{
-					if (_chunks[chunk_id].entries[j].count > max_count)
+					if (_chunks[chunk_id].counts[j] > max_count)
 					{
-						max_count = _chunks[chunk_id].entries[j].count;
+						max_count = _chunks[chunk_id].counts[j];
 						idx = j;
 					}
 				}
@@ -399,7 +405,7 @@ PagePlacementPolicy::computeFreqDistr()
 			if (idx != _num_entries_per_chunk)
 			{
 				_histogram[i] += max_count;
-				_chunks[chunk_id].entries[idx].count = 0;
+				_chunks[chunk_id].counts[idx] = 0;
 			}
 			else 
 				break;
@@ -410,19 +416,35 @@ PagePlacementPolicy::computeFreqDistr()
 void 
 PagePlacementPolicy::updateLRU(uint64_t set_num, uint32_t way_num)
 {
+	uint8_t * lru = _chunks[set_num].lru;
 	for (uint32_t i = 0; i < _mc->getNumWays(); i++)
-		if (_lru_bits[set_num][i] < _lru_bits[set_num][way_num])
-			_lru_bits[set_num][i] ++;
-	_lru_bits[set_num][way_num] = 0;
+		if (lru[i] < lru[way_num])
+			lru[i] ++;
+	lru[way_num] = 0;
 }
 
 void 
 PagePlacementPolicy::flushChunk(uint32_t set)
 {
+	_chunks[set].valid = 0;
 	for (uint32_t i = 0; i < _num_entries_per_chunk; i ++) {
-		_chunks[set].entries[i].valid = false; 
-		_chunks[set].entries[i].tag = 0; 
-		_chunks[set].entries[i].count = 0; 
+		_chunks[set].tags[i] = 0; 
+		_chunks[set].counts[i] = 0; 
 	}	
 }
 
+void
+PagePlacementPolicy::save(CheckpointWriter &w)
+{
+	w.put(_chunks, sizeof(ChunkInfo) * _num_chunks);
+	for (uint32_t i = 0; i < _num_stripes; i++)
+		w.put(_stripes[i].buffer);
+}
+
+void
+PagePlacementPolicy::restore(CheckpointReader &r)
+{
+	r.get(_chunks, sizeof(ChunkInfo) * _num_chunks);
+	for (uint32_t i = 0; i < _num_stripes; i++)
+		r.get(_stripes[i].buffer);
+}
@@ -2,9 +2,8 @@
 
 #include "config.h"
 #include "mc.h"
+#include "pad.h"
 
-class Way;
-class Set; 
 class DramCache;
 
 class PagePlacementPolicy
@@ -18,51 +17,68 @@ public:
 
 	PagePlacementPolicy(MemoryController * mc) : _mc(mc) {};
 	void initialize(Config & config);
-	uint32_t handleCacheMiss(Address tag, ReqType type, uint64_t set_num, Set * set, bool &counter_access);
-	void handleCacheHit(Address tag, ReqType type, uint64_t set_num, Set * set, bool &counter_access, uint32_t hit_way);
+	uint32_t handleCacheMiss(Address tag, ReqType type, uint64_t set_num, bool &counter_access);
+	void handleCacheHit(Address tag, ReqType type, uint64_t set_num, bool &counter_access, uint32_t hit_way);
+	// The way the next replacement in the set would evict, or the number of
+	// ways while a way is empty. Changes no state.
+	uint32_t peekVictim(uint64_t set_num);
 	
-	uint64_t getTraffic() { return _num_counter_read + _num_counter_write; };
+	uint64_t getTraffic();
 	void flushChunk(uint32_t set);
 	void clearStats(); 
+	void save(CheckpointWriter &w);
+	void restore(CheckpointReader &r);
 	RepScheme get_placement_policy() { return _placement_policy; }
 private:
 	MemoryController * _mc;
-	struct ChunkEntry 
+	static const uint32_t _num_entries_per_chunk = 9;
+	// All FBR and LRU metadata of one set, packed into two cache lines.
+	// Entries [0, num_ways) track the pages in the set's ways, in way order;
+	// the rest track candidates. Counters saturate at _max_count_size (<= 255).
+	struct ChunkInfo
 	{
-		bool valid;
-		Address tag;
-		uint32_t count;
-	};
-	struct ChunkInfo 
+		Address tags[_num_entries_per_chunk];
+		uint8_t counts[_num_entries_per_chunk];
+		uint8_t lru[_num_entries_per_chunk - 1]; // per way, for LRU
+		uint16_t valid; // bit per entry
+
+		bool isValid(uint32_t idx) { return valid & (1 << idx); };
+		void swapEntries(uint32_t a, uint32_t b);
+	} ATTR_LINE_ALIGNED;
+
+	// Placement runs under the set's lock stripe only, so each stripe has
+	// its own random stream and counters
+	struct StripeState
 	{
-		uint32_t access_count;
-		ChunkEntry * entries;
-		uint64_t num_hits;
-		uint64_t num_misses;
+		drand48_data buffer;
+		uint64_t num_counter_read;
+		uint64_t num_counter_write;
+		uint64_t num_empty_replace;
+		PAD();
 	};
 
-	uint32_t getChunkEntry(Address tag, ChunkInfo * chunk_info, bool allocate=true);
-	bool sampleOrNot(double sample_rate, bool miss_rate_tune = true);
-	bool compareCounter(ChunkEntry * entry1, ChunkEntry * entry2);
+	uint32_t getChunkEntry(Address tag, ChunkInfo * chunk_info, drand48_data &buffer, bool allocate=true);
+	bool sampleOrNot(drand48_data &buffer, double sample_rate, bool miss_rate_tune = true);
+	bool compareCounter(uint32_t count1, uint32_t count2);
 	uint32_t adjustEntryOrder(ChunkInfo * chunk_info, uint32_t idx);
 	uint32_t pickVictimWay(ChunkInfo * chunk_info);
-	void handleCounterOverflow(ChunkInfo * chunk_info, ChunkEntry * overflow_entry);
+	void incrementCounter(ChunkInfo * chunk_info, uint32_t idx);
 	void computeFreqDistr();
 	void updateLRU(uint64_t set_num, uint32_t way_num);
+	void checkChunk(uint64_t set_num);
 	double getCurrSampleRate();
 
 	RepScheme _placement_policy;
-	drand48_data _buffer;
+	StripeState * _stripes;
+	uint32_t _num_stripes;
 	Scheme _scheme;	
-	uint32_t ** _lru_bits; // on per set
 
 	uint32_t _granularity;
-	// Frequency Base Replacement
+	// Frequency Base Replacement and LRU state, one per set
 	ChunkInfo * _chunks;
 	
 	// Parameters
 	uint64_t _num_chunks;
-	uint32_t _num_entries_per_chunk;
 	//uint32_t _num_stable_entries;
 	double _sample_rate;
 	uint32_t _access_count_threshold;
@@ -71,7 +87,4 @@ private:
 
 	// Stats
 	uint64_t * _histogram;
-	uint64_t _num_counter_read;
-	uint64_t _num_counter_write;
-	uint64_t _num_empty_replace;
 };
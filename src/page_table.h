@@ -0,0 +1,222 @@
+#ifndef PAGE_TABLE_H_
+#define PAGE_TABLE_H_
+
+#include "galloc.h"
+#include "memory_hierarchy.h"
+
+class CheckpointWriter;
+class CheckpointReader;
+
+// Per-page DRAM cache mapping, kept by the page-granularity schemes. Packed
+// into 32 bytes; way stays a whole word so lock-free readers can load it.
+class TLBEntry
+{
+public:
+   static const uint32_t MAX_COUNT = (1u << 25) - 1;
+
+   Address tag;
+   uint32_t way;
+   uint32_t count : 25; // for OS based placement policy, saturating
+   // footprint prediction: the line whose miss brought the page in
+   uint32_t trigger : 6;
+   uint32_t cleaned : 1; // written back by the cleaner since it was last filled
+
+   // the following two are only for UnisonCache
+   // due to space cosntraint, it is not feasible to keep one bit for each line,
+   // so we use 1 bit for 4 lines.
+   uint64_t touch_bitvec; // whether a line is touched in a page
+   uint64_t dirty_bitvec; // whether a line is dirty in page
+};
+
+static_assert(sizeof(TLBEntry) == 32, "TLBEntry should stay packed");
+
+/* Flat page table: an open-addressing hash table (linear probing, power-of-2
+ * capacity) that stores TLBEntry inline. A lookup is one multiplicative hash
+ * and a short probe, and a page costs one 32-byte slot instead of a heap
+ * node. Pages are never unmapped, so entries are never removed, and a pointer
+ * returned by lookup() or lookupOrInsert() stays valid until the next
+ * insertion (which may grow the table).
+ *
+ * Tables built with fetch bits also keep a 64-bit fetch vector per slot, in a
+ * parallel array, for the schemes that track which lines of a page were
+ * fetched (footprint prediction, sectored fills); see fetchBits().
+ *
+ * Writers must hold the owner's lock. Readers may also use getWay() without
+ * it: entries are published with their tag last, and a grow publishes the
+ * new array only once it is complete. Once keepRetired() is called, an old
+ * array is retired rather than freed, because a lock-free reader may still be
+ * probing it; the owner frees retired arrays with freeRetired() when no such
+ * reader can run.
+ */
+class PageTable : public GlobAlloc {
+private:
+	static const Address EMPTY = -1ul;  // never a valid page tag
+
+	struct Slots {
+		uint64_t capacity;
+		uint32_t shift;  // 64 - log2(capacity)
+		Slots * retired;  // previous array, kept alive for lock-free readers
+		uint64_t * fetch;  // capacity fetch vectors, or nullptr
+		TLBEntry entries[0];
+	};
+
+	Slots * _slots;
+	uint64_t _size;
+	bool _fetch_bits;
+	bool _keep_retired;
+
+	static inline uint64_t slot(const Slots * s, Address tag) {
+		// Fibonacci hashing; the top bits mix all tag bits, which matters
+		// because the tags in one lock stripe share their low bits
+		return (tag * 0x9E3779B97F4A7C15ul) >> s->shift;
+	}
+
+	static uint64_t bytes(uint64_t capacity, bool fetch_bits) {
+		return sizeof(Slots) + capacity * (sizeof(TLBEntry) + (fetch_bits? sizeof(uint64_t) : 0));
+	}
+
+	Slots * allocate(uint64_t capacity) {
+		Slots * s = (Slots *) gm_malloc(bytes(capacity, _fetch_bits));
+		s->capacity = capacity;
+		s->shift = 64 - __builtin_ctzll(capacity);
+		s->retired = nullptr;
+		s->fetch = _fetch_bits? (uint64_t *) &s->entries[capacity] : nullptr;
+		for (uint64_t i = 0; i < capacity; i++)
+			s->entries[i].tag = EMPTY;
+		return s;
+	}
+
+	static void freeChain(Slots * s) {
+		while (s) {
+			Slots * next = s->retired;
+			gm_free(s);
+			s = next;
+		}
+	}
+
+	// Called once the new array is published
+	void retire(Slots * old) {
+		if (_keep_retired)
+			_slots->retired = old;
+		else
+			freeChain(old);
+	}
+
+	void grow() {
+		Slots * old = _slots;
+		Slots * s = allocate(2 * old->capacity);
+		for (uint64_t i = 0; i < old->capacity; i++) {
+			if (old->entries[i].tag == EMPTY) continue;
+			uint64_t j = slot(s, old->entries[i].tag);
+			while (s->entries[j].tag != EMPTY)
+				j = (j + 1) & (s->capacity - 1);
+			s->entries[j] = old->entries[i];
+			if (_fetch_bits)
+				s->fetch[j] = old->fetch[i];
+		}
+		__atomic_store_n(&_slots, s, __ATOMIC_RELEASE);
+		retire(old);
+	}
+
+public:
+	explicit PageTable(bool fetch_bits, uint64_t capacity = 1024) : _size(0), _fetch_bits(fetch_bits), _keep_retired(false) {
+		assert(capacity >= 2 && (capacity & (capacity - 1)) == 0);
+		_slots = allocate(capacity);
+	}
+
+	inline TLBEntry * lookup(Address tag) {
+		assert(tag != EMPTY);
+		for (uint64_t s = slot(_slots, tag); ; s = (s + 1) & (_slots->capacity - 1)) {
+			if (_slots->entries[s].tag == tag) return &_slots->entries[s];
+			if (_slots->entries[s].tag == EMPTY) return nullptr;
+		}
+	}
+
+	// A new entry starts unmapped (way = invalid_way) with clear counters
+	inline TLBEntry * lookupOrInsert(Address tag, uint32_t invalid_way, bool &inserted) {
+		assert(tag != EMPTY);
+		inserted = false;
+		uint64_t s = slot(_slots, tag);
+		for (; _slots->entries[s].tag != EMPTY; s = (s + 1) & (_slots->capacity - 1))
+			if (_slots->entries[s].tag == tag) return &_slots->entries[s];
+
+		inserted = true;
+		if (8 * (_size + 1) > 7 * _slots->capacity) {  // keep the load <= 7/8
+			grow();
+			s = slot(_slots, tag);
+			while (_slots->entries[s].tag != EMPTY)
+				s = (s + 1) & (_slots->capacity - 1);
+		}
+		_size++;
+		TLBEntry &e = _slots->entries[s];
+		e.way = invalid_way;
+		e.count = 0;
+		e.touch_bitvec = 0;
+		e.dirty_bitvec = 0;
+		e.trigger = 0;
+		e.cleaned = false;
+		if (_fetch_bits)
+			_slots->fetch[s] = 0;
+		__atomic_store_n(&e.tag, tag, __ATOMIC_RELEASE);
+		return &e;
+	}
+
+	// Lock-free read of a page's way; returns invalid_way for unknown pages.
+	// Writers that change an entry's way must use setWay().
+	inline uint32_t getWay(Address tag, uint32_t invalid_way) const {
+		const Slots * slots = __atomic_load_n(&_slots, __ATOMIC_ACQUIRE);
+		for (uint64_t s = slot(slots, tag); ; s = (s + 1) & (slots->capacity - 1)) {
+			Address t = __atomic_load_n(&slots->entries[s].tag, __ATOMIC_ACQUIRE);
+			if (t == tag) return __atomic_load_n(&slots->entries[s].way, __ATOMIC_RELAXED);
+			if (t == EMPTY) return invalid_way;
+		}
+	}
+
+	static inline void setWay(TLBEntry * entry, uint32_t way) {
+		__atomic_store_n(&entry->way, way, __ATOMIC_RELAXED);
+	}
+
+	// Visits every mapped page; caller holds the owner's lock
+	template <typename F>
+	void forEach(F f) { forEach(0, capacity(), f); }
+	// Visits the mapped pages in slots [begin, end), so disjoint ranges can
+	// be visited in parallel
+	template <typename F>
+	void forEach(uint64_t begin, uint64_t end, F f) {
+		for (uint64_t i = begin; i < end; i++)
+			if (_slots->entries[i].tag != EMPTY)
+				f(_slots->entries[i]);
+	}
+	uint64_t capacity() const { return _slots->capacity; }
+
+	// Keep arrays replaced by a grow until freeRetired(), for getWay()
+	// callers without the lock
+	void keepRetired() { _keep_retired = true; }
+	// Caller holds the owner's lock, and no getWay() may be running
+	void freeRetired() {
+		freeChain(_slots->retired);
+		_slots->retired = nullptr;
+	}
+
+	bool hasFetchBits() const { return _fetch_bits; }
+	// The page's fetch vector; the table must have fetch bits. Valid as
+	// long as the entry pointer is.
+	inline uint64_t &fetchBits(const TLBEntry * entry) {
+		assert(_fetch_bits);
+		return _slots->fetch[entry - _slots->entries];
+	}
+
+	void save(CheckpointWriter &w);
+	void restore(CheckpointReader &r);
+
+	uint64_t size() const { return _size; }
+	// Host memory held, including retired arrays
+	uint64_t getMemUsage() const {
+		uint64_t total = 0;
+		for (const Slots * s = _slots; s; s = s->retired)
+			total += bytes(s->capacity, _fetch_bits);
+		return total;
+	}
+};
+
+#endif  // PAGE_TABLE_H_
@@ -26,10 +26,23 @@
 #ifndef PRIO_QUEUE_H_
 #define PRIO_QUEUE_H_
 
-#include "g_std/g_multimap.h"
+#include <utility>
+#include "g_std/g_vector.h"
 
+/* Bucketed priority queue for timing events. Elements less than B blocks of
+ * 64 cycles ahead of the current block go in blocks[], a circular array of
+ * per-cycle lists. A two-level occupancy bitmap over blocks[] finds the next
+ * populated block with a couple of ctz's, however sparse the queue is.
+ *
+ * Elements further ahead wait in a calendar of far buckets, each spanning B/2
+ * blocks, starting at farBase; those beyond the calendar go in farOverflow.
+ * Buckets are unsorted, and move to blocks[] as a whole once the window of
+ * blocks[] covers them.
+ */
 template <typename T, uint32_t B>
 class PrioQueue {
+    static_assert(B >= 128 && B <= 64*64 && (B & (B - 1)) == 0, "PrioQueue blocks must be a power of 2 between 128 and 4096");
+
     struct PQBlock {
         T* array[64];
         uint64_t occ; // bit i is 1 if array[i] is populated
@@ -61,17 +74,32 @@ class PrioQueue {
     };
 
     PQBlock blocks[B];
+    uint64_t blockOcc[B/64]; // bit i of word w is 1 if blocks[64*w + i] is populated
+    uint64_t blockOccTop; // bit w is 1 if blockOcc[w] is non-zero
 
-    typedef g_multimap<uint64_t, T*> FEMap; //far element map
-    typedef typename FEMap::iterator FEMapIterator;
+    static const uint32_t FAR_BUCKETS = 64;
+    static const uint64_t FAR_SPAN = B/2; // blocks per far bucket
 
-    FEMap feMap;
+    typedef g_vector<std::pair<uint64_t, T*>> FarBucket; //(cycle, element), unsorted
+
+    FarBucket farBuckets[FAR_BUCKETS]; // absolute bucket h goes in farBuckets[h % FAR_BUCKETS]
+    uint64_t farOcc; // bit i is 1 if farBuckets[i] is non-empty
+    FarBucket farOverflow; // buckets >= farBase + FAR_BUCKETS
+    uint64_t farOverflowMin; // earliest cycle in farOverflow
+    uint64_t farBase; // first absolute bucket of the calendar, (curBlock + B)/FAR_SPAN
+    uint64_t farElems;
 
     uint64_t curBlock;
     uint64_t elems;
 
     public:
         PrioQueue() {
+            for (uint32_t w = 0; w < B/64; w++) blockOcc[w] = 0;
+            blockOccTop = 0;
+            farOcc = 0;
+            farOverflowMin = -1L;
+            farBase = B/FAR_SPAN;
+            farElems = 0;
             curBlock = 0;
             elems = 0;
         }
@@ -81,43 +109,29 @@ class PrioQueue {
             assert(absBlock >= curBlock);
 
             if (absBlock < curBlock + B) {
-                uint32_t i = absBlock % B;
-                uint32_t offset = cycle % 64;
-                blocks[i].enqueue(obj, offset);
+                enqueueBlock(obj, cycle);
             } else {
-                //info("XXX far enq() %ld", cycle);
-                feMap.insert(std::pair<uint64_t, T*>(cycle, obj));
+                enqueueFar(obj, cycle);
             }
             elems++;
         }
 
         T* dequeue(uint64_t& deqCycle) {
             assert(elems);
-            while (!blocks[curBlock % B].occ) {
-                curBlock++;
-                if ((curBlock % (B/2)) == 0 && !feMap.empty()) {
-                    uint64_t topCycle = (curBlock + B)*64;
-                    //Move every element with cycle < topCycle to blocks[]
-                    FEMapIterator it = feMap.begin();
-                    while (it != feMap.end() && it->first < topCycle) {
-                        uint64_t cycle = it->first;
-                        T* obj = it->second;
-
-                        uint64_t absBlock = cycle/64;
-                        assert(absBlock >= curBlock);
-                        assert(absBlock < curBlock + B);
-                        uint32_t i = absBlock % B;
-                        uint32_t offset = cycle % 64;
-                        blocks[i].enqueue(obj, offset);
-                        it++;
-                    }
-                    feMap.erase(feMap.begin(), it);
-                }
+            uint64_t absBlock;
+            bool found = nextBlock(absBlock);
+            // Far elements all come after farBase's first block
+            if (farElems && (!found || absBlock >= farBase*FAR_SPAN)) {
+                uint64_t farBlock = farFirstCycle()/64;
+                if (!found || farBlock < absBlock) absBlock = farBlock;
             }
+            advance(absBlock);
 
             //We're now at the first populated block
+            uint32_t i = curBlock % B;
             uint32_t offset;
-            T* obj = blocks[curBlock % B].dequeue(offset);
+            T* obj = blocks[i].dequeue(offset);
+            if (!blocks[i].occ) clearBlockOcc(i);
             elems--;
 
             deqCycle = curBlock*64 + offset;
@@ -130,23 +144,134 @@ class PrioQueue {
 
         inline uint64_t firstCycle() const {
             assert(elems);
-            for (uint32_t i = 0; i < B/2; i++) {
-                uint64_t occ = blocks[(curBlock + i) % B].occ;
-                if (occ) {
-                    uint64_t pos = __builtin_ctzl(occ);
-                    return (curBlock + i)*64 + pos;
-                }
+            uint64_t absBlock;
+            uint64_t cycle = -1L;
+            if (nextBlock(absBlock)) {
+                cycle = absBlock*64 + __builtin_ctzl(blocks[absBlock % B].occ);
+                if (absBlock < farBase*FAR_SPAN) return cycle;
             }
-            for (uint32_t i = B/2; i < B; i++) { //beyond B/2 blocks, there may be a far element that comes earlier
-                uint64_t occ = blocks[(curBlock + i) % B].occ;
-                if (occ) {
-                    uint64_t pos = __builtin_ctzl(occ);
-                    uint64_t cycle = (curBlock + i)*64 + pos;
-                    return feMap.empty()? cycle : MIN(cycle, feMap.begin()->first);
-                }
+            //there may be a far element that comes earlier
+            return farElems? MIN(cycle, farFirstCycle()) : cycle;
+        }
+
+    private:
+        inline void enqueueBlock(T* obj, uint64_t cycle) {
+            uint64_t absBlock = cycle/64;
+            assert(absBlock >= curBlock);
+            assert(absBlock < curBlock + B);
+            uint32_t i = absBlock % B;
+            uint32_t offset = cycle % 64;
+            blocks[i].enqueue(obj, offset);
+            blockOcc[i/64] |= 1L << (i % 64);
+            blockOccTop |= 1L << (i/64);
+        }
+
+        inline void clearBlockOcc(uint32_t i) {
+            blockOcc[i/64] &= ~(1L << (i % 64));
+            if (!blockOcc[i/64]) blockOccTop &= ~(1L << (i/64));
+        }
+
+        // First populated block at or after index i of blocks[], or B if none
+        inline uint32_t findBlockFrom(uint32_t i) const {
+            uint32_t w = i/64;
+            uint64_t bits = blockOcc[w] & (-1L << (i % 64));
+            if (bits) return w*64 + __builtin_ctzl(bits);
+            uint64_t top = (w + 1 < 64)? blockOccTop & (-1L << (w + 1)) : 0;
+            if (!top) return B;
+            w = __builtin_ctzl(top);
+            return w*64 + __builtin_ctzl(blockOcc[w]);
+        }
+
+        // Absolute index of the first populated block, starting from curBlock
+        inline bool nextBlock(uint64_t& absBlock) const {
+            uint32_t start = curBlock % B;
+            if (blocks[start].occ) {
+                absBlock = curBlock;
+                return true;
+            }
+            if (!blockOccTop) return false;
+            uint32_t i = findBlockFrom(start);
+            if (i == B) i = findBlockFrom(0); //wrap around
+            assert(i < B);
+            absBlock = curBlock + (i + B - start) % B;
+            return true;
+        }
+
+        inline void enqueueFar(T* obj, uint64_t cycle) {
+            uint64_t h = cycle/64/FAR_SPAN;
+            assert(h >= farBase);
+            if (h < farBase + FAR_BUCKETS) {
+                farBuckets[h % FAR_BUCKETS].push_back(std::make_pair(cycle, obj));
+                farOcc |= 1L << (h % FAR_BUCKETS);
+            } else {
+                farOverflow.push_back(std::make_pair(cycle, obj));
+                farOverflowMin = MIN(farOverflowMin, cycle);
+            }
+            farElems++;
+        }
+
+        // Earliest far cycle; the first non-empty bucket precedes farOverflow
+        uint64_t farFirstCycle() const {
+            assert(farElems);
+            if (!farOcc) return farOverflowMin;
+            uint32_t rot = farBase % FAR_BUCKETS;
+            uint64_t bits = rot? ((farOcc >> rot) | (farOcc << (FAR_BUCKETS - rot))) : farOcc;
+            const FarBucket& bucket = farBuckets[(rot + __builtin_ctzl(bits)) % FAR_BUCKETS];
+            uint64_t cycle = -1L;
+            for (auto& e : bucket) cycle = MIN(cycle, e.first);
+            return cycle;
+        }
+
+        /* Moves curBlock forward, with no element before it. Far buckets the
+         * window of blocks[] now covers move into it, and overflow elements
+         * the calendar now covers move into the calendar.
+         */
+        void advance(uint64_t absBlock) {
+            assert(absBlock >= curBlock);
+            curBlock = absBlock;
+            uint64_t newBase = (curBlock + B)/FAR_SPAN;
+            if (newBase == farBase) return;
+            assert(newBase > farBase);
+
+            uint64_t n = newBase - farBase;
+            uint64_t mask = farOcc;
+            if (n < FAR_BUCKETS) {
+                uint64_t span = (1L << n) - 1;
+                uint32_t rot = farBase % FAR_BUCKETS;
+                mask &= rot? ((span << rot) | (span >> (FAR_BUCKETS - rot))) : span;
             }
+            farOcc &= ~mask;
+            while (mask) {
+                uint32_t b = __builtin_ctzl(mask);
+                mask &= mask - 1;
+                FarBucket& bucket = farBuckets[b];
+                for (auto& e : bucket) enqueueBlock(e.second, e.first);
+                farElems -= bucket.size();
+                bucket.clear();
+            }
+            farBase = newBase;
 
-            return feMap.begin()->first;
+            if (farOverflowMin/64/FAR_SPAN < farBase + FAR_BUCKETS) {
+                // Stable, so elements of a cycle keep their order
+                uint64_t overflowElems = farOverflow.size();
+                uint32_t kept = 0;
+                farOverflowMin = -1L;
+                farElems -= overflowElems;
+                for (uint32_t i = 0; i < overflowElems; i++) {
+                    uint64_t cycle = farOverflow[i].first;
+                    T* obj = farOverflow[i].second;
+                    if (cycle/64 < curBlock + B) {
+                        enqueueBlock(obj, cycle);
+                    } else if (cycle/64/FAR_SPAN < farBase + FAR_BUCKETS) {
+                        enqueueFar(obj, cycle);
+                    } else {
+                        farOverflow[kept++] = farOverflow[i];
+                        farOverflowMin = MIN(farOverflowMin, cycle);
+                        farElems++;
+                    }
+                }
+                farOverflow.resize(kept);
+            }
         }
 };
 
@@ -59,7 +59,7 @@ void SimpleCore::bbl(Address bblAddr, BblInfo* bblInfo) {
     //info("BBL %s %p", name.c_str(), bblInfo);
     //info("%d %d", bblInfo->instrs, bblInfo->bytes);
     instrs += bblInfo->instrs;
-    curCycle += bblInfo->instrs;
+    curCycle += bblInfo->instrs + takeShootdownStall();
 
     Address endBblAddr = bblAddr + bblInfo->bytes;
     for (Address fetchAddr = bblAddr; fetchAddr < endBblAddr; fetchAddr+=(1 << lineBits)) {
@@ -81,6 +81,7 @@ void SimpleCore::join() {
         curCycle = zinfo->globPhaseCycles;
     }
     phaseEndCycle = zinfo->globPhaseCycles + zinfo->phaseLength;
+    skipShootdowns();
     //note that with long events, curCycle can be arbitrarily larger than phaseEndCycle; however, it must be aligned in current phase
     //info("[%s] Joined, curCycle %ld phaseEnd %ld haltedCycles %ld", name.c_str(), curCycle, phaseEndCycle, haltedCycles);
 }
@@ -247,6 +247,11 @@ class Counter : public ScalarStat {
         inline void set(uint64_t data) {
             _count = data;
         }
+
+        // For stat dumps that read the count in place (see StatDumpPlan)
+        inline const uint64_t* countPtr() const {
+            return &_count;
+        }
 };
 
 class VectorCounter : public VectorStat {
@@ -296,6 +301,10 @@ class VectorCounter : public VectorStat {
         inline uint32_t size() const {
             return _counters.size();
         }
+
+        inline const uint64_t* countsPtr() const {
+            return &_counters[0];
+        }
 };
 
 /*
@@ -0,0 +1,66 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "stats_plan.h"
+#include <typeinfo>
+#include "log.h"
+
+StatDumpPlan::StatDumpPlan(Stat* root, bool _skipVectors, bool _sumRegularAggregates)
+    : skipVectors(_skipVectors), sumRegularAggregates(_sumRegularAggregates)
+{
+    uint32_t dst = 0;
+    compile(root, dst, false);
+    recordWords = dst;
+}
+
+void StatDumpPlan::compile(Stat* s, uint32_t& dst, bool add) {
+    if (AggregateStat* as = dynamic_cast<AggregateStat*>(s)) {
+        if (as->isRegular() && sumRegularAggregates && as->size()) {
+            uint32_t start = dst;
+            compile(as->get(0), dst, add);
+            for (uint32_t i = 1; i < as->size(); i++) {
+                uint32_t childDst = start;
+                compile(as->get(i), childDst, true);
+                if (childDst != dst) panic("In regular aggregate %s, child %d has a different size than first child", s->name(), i);
+            }
+        } else {
+            for (uint32_t i = 0; i < as->size(); i++) {
+                compile(as->get(i), dst, add);
+            }
+        }
+    } else if (ScalarStat* ss = dynamic_cast<ScalarStat*>(s)) {
+        // Subclasses may override get(), so only plain Counters are read in place
+        const uint64_t* src = (typeid(*ss) == typeid(Counter))? static_cast<Counter*>(ss)->countPtr() : nullptr;
+        reads.push_back({src, ss, nullptr, dst, 1, add});
+        dst++;
+    } else if (VectorStat* vs = dynamic_cast<VectorStat*>(s)) {
+        if (skipVectors || !vs->size()) return;
+        const uint64_t* src = (typeid(*vs) == typeid(VectorCounter))? static_cast<VectorCounter*>(vs)->countsPtr() : nullptr;
+        reads.push_back({src, nullptr, vs, dst, vs->size(), add});
+        dst += vs->size();
+    } else {
+        panic("Unrecognized stat type");
+    }
+}
@@ -0,0 +1,95 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STATS_PLAN_H_
+#define STATS_PLAN_H_
+
+#include <stdint.h>
+#include "g_std/g_vector.h"
+#include "galloc.h"
+#include "stats.h"
+
+/* A stat tree compiled into a flat list of reads, so backends dump without
+ * walking the tree and dynamic_cast'ing every node. Each read copies one stat
+ * to a fixed offset of a record of uint64_t's. Counters and VectorCounters
+ * are read in place; other stats (which may compute their value) through
+ * get() or count().
+ *
+ * With sumRegularAggregates, the children of a regular aggregate all map to
+ * the same offsets: the first child's reads store, and the others' add.
+ * Stats are laid out in the same order as the old tree walk did.
+ */
+class StatDumpPlan : public GlobAlloc {
+    private:
+        struct Read {
+            const uint64_t* src;  // in place, or nullptr
+            ScalarStat* scalar;
+            VectorStat* vector;
+            uint32_t dst;
+            uint32_t len;
+            bool add;
+        };
+
+        g_vector<Read> reads;
+        uint32_t recordWords;
+
+        bool skipVectors;
+        bool sumRegularAggregates;
+
+        void compile(Stat* s, uint32_t& dst, bool add);
+
+    public:
+        StatDumpPlan(Stat* root, bool _skipVectors, bool _sumRegularAggregates);
+
+        // uint64_t's per record
+        inline uint32_t size() const {
+            return recordWords;
+        }
+
+        void dump(uint64_t* record) const {
+            for (const Read& r : reads) {
+                uint64_t* d = record + r.dst;
+                if (r.src) {
+                    if (r.add) {
+                        for (uint32_t i = 0; i < r.len; i++) d[i] += r.src[i];
+                    } else {
+                        for (uint32_t i = 0; i < r.len; i++) d[i] = r.src[i];
+                    }
+                } else if (r.scalar) {
+                    uint64_t v = r.scalar->get();
+                    if (r.add) *d += v;
+                    else *d = v;
+                } else {
+                    for (uint32_t i = 0; i < r.len; i++) {
+                        uint64_t v = r.vector->count(i);
+                        if (r.add) d[i] += v;
+                        else d[i] = v;
+                    }
+                }
+            }
+        }
+};
+
+#endif  // STATS_PLAN_H_
@@ -25,37 +25,50 @@
 
 #include <fstream>
 #include <iostream>
+#include <string>
+#include "g_std/g_string.h"
+#include "g_std/g_vector.h"
 #include "galloc.h"
 #include "log.h"
 #include "stats.h"
+#include "stats_plan.h"
 #include "zsim.h"
 
 using std::endl;
 
+/* Dumps stats as an indented tree. The text around each value (names,
+ * descriptions, indentation) does not change across dumps, so it is built
+ * once; a dump fills in the values from a StatDumpPlan and interleaves them.
+ */
 class TextBackendImpl : public GlobAlloc {
     private:
         const char* filename;
         AggregateStat* rootStat;
 
-        void dumpStat(Stat* s, uint32_t level, std::ofstream* out) {
-            for (uint32_t i = 0; i < level; i++) *out << " ";
-            *out << s->name() << ": ";
+        StatDumpPlan* plan;
+        uint64_t* values;
+        g_vector<g_string> texts; // texts[i] goes before values[i], the last one after every value
+
+        void compileText(Stat* s, uint32_t level, std::string& cur) {
+            cur.append(level, ' ');
+            cur += s->name();
+            cur += ": ";
             if (AggregateStat* as = dynamic_cast<AggregateStat*>(s)) {
-                *out << "# " << as->desc() << endl;
+                cur.append("# ").append(as->desc()).append("\n");
                 for (uint32_t i = 0; i < as->size(); i++) {
-                    dumpStat(as->get(i), level+1, out);
+                    compileText(as->get(i), level+1, cur);
                 }
             } else if (ScalarStat* ss = dynamic_cast<ScalarStat*>(s)) {
-                *out << ss->get() << " # " << ss->desc() << endl;
+                texts.push_back(cur.c_str());
+                cur = std::string(" # ") + ss->desc() + "\n";
             } else if (VectorStat* vs = dynamic_cast<VectorStat*>(s)) {
-                *out << "# " << vs->desc() << endl;
+                cur.append("# ").append(vs->desc()).append("\n");
                 for (uint32_t i = 0; i < vs->size(); i++) {
-                    for (uint32_t j = 0; j < level+1; j++) *out << " ";
-                    if (vs->hasCounterNames()) {
-                        *out << vs->counterName(i) << ": " << vs->count(i) << endl;
-                    } else {
-                        *out << i << ": " << vs->count(i) << endl;
-                    }
+                    cur.append(level+1, ' ');
+                    cur += vs->hasCounterNames()? std::string(vs->counterName(i)) : std::to_string(i);
+                    cur += ": ";
+                    texts.push_back(cur.c_str());
+                    cur = "\n";
                 }
             } else {
                 panic("Unrecognized stat type");
@@ -66,15 +79,26 @@ class TextBackendImpl : public GlobAlloc {
         TextBackendImpl(const char* _filename, AggregateStat* _rootStat) :
             filename(_filename), rootStat(_rootStat)
         {
+            plan = new StatDumpPlan(rootStat, false /*skipVectors*/, false /*sumRegularAggregates*/);
+            values = gm_calloc<uint64_t>(plan->size());
+            std::string cur;
+            compileText(rootStat, 0, cur);
+            cur += "===\n";
+            texts.push_back(cur.c_str());
+            assert(texts.size() == plan->size() + 1);
+
             std::ofstream out(filename, std::ios_base::out);
             out << "# zsim stats" << endl;
             out << "===" << endl;
         }
 
         void dump(bool buffered) {
+            plan->dump(values);
             std::ofstream out(filename, std::ios_base::app);
-            dumpStat(rootStat, 0, &out);
-            out << "===" << endl;
+            for (uint32_t i = 0; i < plan->size(); i++) {
+                out << texts[i] << values[i];
+            }
+            out << texts[plan->size()];
         }
 };
 
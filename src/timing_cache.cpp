@@ -29,6 +29,7 @@
 #include "zsim.h"
 #include "dramsim_mem_ctrl.h"
 #include "config.h"
+#include "mc.h"
 
 // Events
 class HitEvent : public TimingEvent {
@@ -89,17 +90,30 @@ TimingCache::TimingCache(uint32_t _numLines, CC* _cc, CacheArray* _array, ReplPo
     activeMisses = 0;
     domain = _domain;
 	repl_type = _replType;
+    dcAware = (repl_type == "LRU_DC");
     dram_cache_granularity = 0;
     _mapping_granu = 0;
     _mcdram_per_mc = 0;
     _granularity = 0;
     enable_selfWB = false;
-    memControllers = 0;
-    mems = nullptr;
     dynamic_repl_rate = 0.0;
     //info("%s: mshrs %d domain %d, replType = %s cacheType:%s ,this pointer is %p", name.c_str(), numMSHRs, domain, repl_type.c_str(),_cacheType.c_str(), this);
 }
 
+void TimingCache::setDramCaches(MemObject* mem) {
+    dramCaches.clear();
+    SplitAddrMemory* split = dynamic_cast<SplitAddrMemory*>(mem);
+    if (split) {
+        for (MemObject* m : *split->getMems()) dramCaches.push_back(dynamic_cast<MemoryController*>(m));
+    } else {
+        dramCaches.push_back(dynamic_cast<MemoryController*>(mem));
+    }
+    for (MemoryController* mc : dramCaches) {
+        if (!mc) panic("%s: LRU_DC replacement needs sys.mem.type = \"DramCache\"", name.c_str());
+        mc->enableResidencyQueries();
+    }
+}
+
 void TimingCache::initStats(AggregateStat* parentStat) {
     AggregateStat* cacheStat = new AggregateStat();
     cacheStat->init(name.c_str(), "Timing cache stats");
@@ -141,53 +155,27 @@ uint64_t TimingCache::access(MemReq& req) {
         double mcBwRatio = -1.0;
 #if 1
         //assert this cache is timing cache, because we assume TLB only exist in LLC timing cache
-        if(isTimingCache() && DramCacheAware())
+        if(dcAware)
         {
 #if 1
             assert(getDCGranu() != 0);
-            g_unordered_map <Address, TLBEntry>* temp_tlb;
-            MemObject* temp_mems = getMems();
-            assert(temp_mems!=nullptr);
-			uint32_t memCtrls = getMemCtrls();
-			uint32_t _mapping_granu = getMappingGranu();
-            if( memCtrls >1 )
-			{
-				//Those codes are from SplitAddrMemory::access();
-				Address addr = req.lineAddr;
-                uint32_t mem = (addr / _mapping_granu) % memCtrls;
-				Address sel1 = addr / _mapping_granu / memCtrls;
-				Address sel2 = addr % _mapping_granu;
-				DramCacheAddr = sel1 * _mapping_granu + sel2;
-                Address	temp_tag = DramCacheAddr / (getCacheGranu() / 64);
-
-                SplitAddrMemory *temp_split = dynamic_cast<SplitAddrMemory*>(temp_mems);
-                const g_vector<MemObject*>* temp_mem = temp_split->getMems();
-
-                temp_tlb  = dynamic_cast<MemoryController*>((*temp_mem)[mem])->getTLB();
-                //info("temp_tlb is %p", temp_tlb);
-                if(temp_tlb != NULL && temp_tlb->find(temp_tag) != temp_tlb->end())
-                {
-                    dram_cache_hit = true;
-                    mcBwRatio = dynamic_cast<MemoryController*>((*temp_mem)[mem])->getRecentBWRatio();
-                    profDramCacheHit.inc();
-                    //info("HBM bandwidth with ratio is %lf", mcBwRatio);
-                    //info("In LLC, DramCache Hit, access address is 0x%lx, tag is 0x%lx", DramCacheAddr, temp_tag);
-                }
+            assert(!dramCaches.empty());
+            // Same interleaving as SplitAddrMemory::access()
+            uint32_t mem = 0;
+            DramCacheAddr = req.lineAddr;
+            if (dramCaches.size() > 1) {
+                Address addr = req.lineAddr;
+                mem = (addr / _mapping_granu) % dramCaches.size();
+                Address sel1 = addr / _mapping_granu / dramCaches.size();
+                Address sel2 = addr % _mapping_granu;
+                DramCacheAddr = sel1 * _mapping_granu + sel2;
             }
-            else
-            {
-                temp_tlb  = dynamic_cast<MemoryController*>(temp_mems)->getTLB();
-                //info("temp_tlb is %p", temp_tlb);
-                Address	temp_tag = req.lineAddr / (_mapping_granu / 64);
-                if(temp_tlb != NULL && temp_tlb->find(temp_tag) != temp_tlb->end())
-                {
-                   dram_cache_hit = true;
-                   profDramCacheHit.inc();
-                   mcBwRatio = dynamic_cast<MemoryController*>(temp_mems)->getRecentBWRatio();
-                   //info("HBM bandwidth with ratio is %lf", mcBwRatio);
-                   //info("In LLC, DramCache Hit, access address is 0x%lx, tag is 0x%lx", req.lineAddr, temp_tag);
-                }
-
+            if (dramCaches[mem]->isResident(DramCacheAddr)) {
+                dram_cache_hit = true;
+                profDramCacheHit.inc();
+                mcBwRatio = dramCaches[mem]->getRecentBWRatio();
+                //info("HBM bandwidth with ratio is %lf", mcBwRatio);
+                //info("In LLC, DramCache Hit, access address is 0x%lx", DramCacheAddr);
             }
             if(mcBwRatio > 0.5)
             {
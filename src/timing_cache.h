@@ -30,6 +30,7 @@
 #include "cache.h"
 
 class HitEvent;
+class MemoryController;
 class MissStartEvent;
 class MissResponseEvent;
 class MissWritebackEvent;
@@ -48,6 +49,7 @@ class TimingCache : public Cache {
 
         uint32_t domain;
         g_string repl_type;
+        bool dcAware;  // repl_type == "LRU_DC", cached off the access path
 
         // For zcache replacement simulation (pessimistic, assumes we walk the whole tree)
         uint32_t tagLat, ways, cands;
@@ -56,15 +58,14 @@ class TimingCache : public Cache {
         lock_t topLock;
         PAD();
 
-        //point to mem controller or SplitAddrMemory to get TLB in them
-        MemObject* mems;
+        // DRAM cache controllers probed by LRU_DC, resolved once at init
+        g_vector<MemoryController*> dramCaches;
         uint32_t _mcdram_per_mc;
         uint32_t _mapping_granu;
         uint32_t _granularity;
         bool enable_selfWB;
 
         uint32_t dram_cache_granularity;
-        uint32_t memControllers;
         double dynamic_repl_rate;
 
     public:
@@ -80,8 +81,8 @@ class TimingCache : public Cache {
         void simulateReplAccess(ReplAccessEvent* ev, uint64_t cycle);
 
 
-        void setMems(MemObject* _mems) { mems = _mems;};
-        MemObject* getMems() { return mems;};
+        // mem is the LLC's parent: a MemoryController or a SplitAddrMemory of them
+        void setDramCaches(MemObject* mem);
 
         void setDCGranu(uint32_t granu) { dram_cache_granularity =granu; };
         uint32_t getDCGranu() { return dram_cache_granularity ; };
@@ -104,11 +105,9 @@ class TimingCache : public Cache {
         bool isSelfWriteBack() { return enable_selfWB; }
 
         //void setReplName(g_string name) {  repl_type = name;} ;
-        void setMemCtrls(uint32_t mem_ctrls) {  memControllers = mem_ctrls;} ;
-        uint32_t getMemCtrls() {  return memControllers;} ;
         //TODO: getReplName func will lead to memory leak if invoke in TimingCache::access, don't know why :-(
         //std::string getReplName() {  return repl_type;} ;
-        bool DramCacheAware() { return repl_type == "LRU_DC";}
+        bool DramCacheAware() { return dcAware;}
         bool isTimingCache() { return cacheType=="Timing"; }
 
     private:
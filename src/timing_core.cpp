@@ -25,13 +25,14 @@
 
 #include "timing_core.h"
 #include "filter_cache.h"
+#include "tlb.h"
 #include "zsim.h"
 
 #define DEBUG_MSG(args...)
 //#define DEBUG_MSG(args...) info(args)
 
 TimingCore::TimingCore(FilterCache* _l1i, FilterCache* _l1d, uint32_t _domain, g_string& _name)
-    : Core(_name), l1i(_l1i), l1d(_l1d), instrs(0), curCycle(0), cRec(_domain, _name) {}
+    : Core(_name), l1i(_l1i), l1d(_l1d), dtlb(nullptr), instrs(0), curCycle(0), cRec(_domain, _name) {}
 
 uint64_t TimingCore::getPhaseCycles() const {
     return curCycle % zinfo->phaseLength;
@@ -55,6 +56,7 @@ void TimingCore::initStats(AggregateStat* parentStat) {
     instrsStat->init("instrs", "Simulated instructions", &instrs);
     coreStat->append(instrsStat);
 
+    if (dtlb) dtlb->initStats(coreStat);
     parentStat->append(coreStat);
 }
 
@@ -63,6 +65,7 @@ void TimingCore::contextSwitch(int32_t gid) {
     if (gid == -1) {
         l1i->contextSwitch();
         l1d->contextSwitch();
+        if (dtlb) dtlb->flush();
     }
 }
 
@@ -70,6 +73,7 @@ void TimingCore::join() {
     DEBUG_MSG("[%s] Joining, curCycle %ld phaseEnd %ld", name.c_str(), curCycle, phaseEndCycle);
     curCycle = cRec.notifyJoin(curCycle);
     phaseEndCycle = zinfo->globPhaseCycles + zinfo->phaseLength;
+    skipShootdowns();
     DEBUG_MSG("[%s] Joined, curCycle %ld phaseEnd %ld", name.c_str(), curCycle, phaseEndCycle);
 }
 
@@ -77,13 +81,24 @@ void TimingCore::leave() {
     cRec.notifyLeave(curCycle);
 }
 
+// Page walk reads are recorded one by one, as the core recorder takes one access at a time
+void TimingCore::translateAndRecord(Address addr) {
+    curCycle = dtlb->translate(addr, curCycle, [this](Address pLineAddr, uint64_t startCycle) {
+        uint64_t respCycle = l1d->walk(pLineAddr, startCycle);
+        cRec.record(startCycle);
+        return respCycle;
+    });
+}
+
 void TimingCore::loadAndRecord(Address addr) {
+    if (dtlb) translateAndRecord(addr);
     uint64_t startCycle = curCycle;
     curCycle = l1d->load(addr, curCycle);
     cRec.record(startCycle);
 }
 
 void TimingCore::storeAndRecord(Address addr) {
+    if (dtlb) translateAndRecord(addr);
     uint64_t startCycle = curCycle;
     curCycle = l1d->store(addr, curCycle);
     cRec.record(startCycle);
@@ -91,7 +106,7 @@ void TimingCore::storeAndRecord(Address addr) {
 
 void TimingCore::bblAndRecord(Address bblAddr, BblInfo* bblInfo) {
     instrs += bblInfo->instrs;
-    curCycle += bblInfo->instrs;
+    curCycle += bblInfo->instrs + takeShootdownStall();
 
     Address endBblAddr = bblAddr + bblInfo->bytes;
     for (Address fetchAddr = bblAddr; fetchAddr < endBblAddr; fetchAddr+=(1 << lineBits)) {
@@ -33,11 +33,13 @@
 #include "pad.h"
 
 class FilterCache;
+class TLBHierarchy;
 
 class TimingCore : public Core {
     private:
         FilterCache* l1i;
         FilterCache* l1d;
+        TLBHierarchy* dtlb;  // nullptr if TLBs are not modeled
 
         uint64_t instrs;
 
@@ -49,6 +51,7 @@ class TimingCore : public Core {
     public:
         TimingCore(FilterCache* _l1i, FilterCache* _l1d, uint32_t domain, g_string& _name);
         void initStats(AggregateStat* parentStat);
+        void setDTLB(TLBHierarchy* _dtlb) {dtlb = _dtlb;}
 
         uint64_t getInstrs() const {return instrs;}
         uint64_t getPhaseCycles() const;
@@ -66,6 +69,7 @@ class TimingCore : public Core {
         void cSimEnd() {curCycle = cRec.cSimEnd(curCycle);}
 
     private:
+        inline void translateAndRecord(Address addr);
         inline void loadAndRecord(Address addr);
         inline void storeAndRecord(Address addr);
         inline void bblAndRecord(Address bblAddr, BblInfo* bblInstrs);
@@ -0,0 +1,112 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "tlb.h"
+#include <string>
+#include "bithacks.h"
+#include "config.h"
+#include "log.h"
+#include "page_allocator.h"
+#include "zsim.h"
+
+TLBArray::TLBArray(uint32_t entries, uint32_t ways, const char* name) : numWays(ways), clock(0) {
+    if (!ways || entries % ways || !isPow2(entries / ways)) panic("%s: %d entries and %d ways do not make a power of 2 of sets", name, entries, ways);
+    numSets = entries / ways;
+    tags = gm_calloc<Address>(entries);
+    lastUse = gm_calloc<uint64_t>(entries);
+}
+
+void TLBArray::insert(Address tag) {
+    uint32_t first = (tag & (numSets - 1)) * numWays;
+    uint32_t victim = first;
+    for (uint32_t i = first; i < first + numWays; i++) {
+        if (lastUse[i] < lastUse[victim]) victim = i;
+    }
+    tags[victim] = tag;
+    lastUse[victim] = ++clock;
+}
+
+void TLBArray::clear() {
+    for (uint32_t i = 0; i < numSets*numWays; i++) {
+        tags[i] = 0;
+        lastUse[i] = 0;
+    }
+}
+
+TLBHierarchy::TLBHierarchy(Config& config, const g_string& _name, uint32_t _coreId)
+    : l1(config.get<uint32_t>("sys.tlbs.l1Entries", 64), config.get<uint32_t>("sys.tlbs.l1Ways", 4), "sys.tlbs.l1"),
+      l2(config.get<uint32_t>("sys.tlbs.l2Entries", 1536), config.get<uint32_t>("sys.tlbs.l2Ways", 12), "sys.tlbs.l2"),
+      // Fully associative unless walkCacheWays says otherwise
+      walkCache(config.get<uint32_t>("sys.tlbs.walkCacheEntries", 32),
+              config.get<uint32_t>("sys.tlbs.walkCacheWays", config.get<uint32_t>("sys.tlbs.walkCacheEntries", 32)), "sys.tlbs.walkCache"),
+      lastPage(0), name(_name), coreId(_coreId)
+{
+    // Page size defaults to what the page allocator backs pages with
+    bool hugePages = config.get<bool>("sim.enableTLB", false) && std::string(config.get<const char*>("sim.pagePolicy", "Random")) == "HugePage";
+    uint32_t pageSize = config.get<uint32_t>("sys.tlbs.pageSize", hugePages? (2 << 20) : 4096);
+    if (pageSize == 4096) {
+        pageBits = 12;
+        leafLevel = 1;
+    } else if (pageSize == (2 << 20)) {
+        pageBits = 21;
+        leafLevel = 2;
+    } else {
+        panic("sys.tlbs.pageSize must be 4096 or 2097152 (2 MB), is %d", pageSize);
+    }
+    l2Lat = config.get<uint32_t>("sys.tlbs.l2Latency", 7);
+}
+
+void TLBHierarchy::initStats(AggregateStat* parentStat) {
+    AggregateStat* tlbStat = new AggregateStat();
+    tlbStat->init("dtlb", "Data TLB stats");
+    profL1Hits.init("l1Hits", "L1 TLB hits");
+    profL2Hits.init("l2Hits", "L2 TLB hits");
+    profWalks.init("walks", "Page walks");
+    profWalkCacheHits.init("walkCacheHits", "Page walks that skipped levels through the walk cache");
+    profWalkReads.init("walkReads", "Page table entries read by walks");
+    profWalkCycles.init("walkCycles", "Cycles spent in page walks");
+    tlbStat->append(&profL1Hits);
+    tlbStat->append(&profL2Hits);
+    tlbStat->append(&profWalks);
+    tlbStat->append(&profWalkCacheHits);
+    tlbStat->append(&profWalkReads);
+    tlbStat->append(&profWalkCycles);
+    parentStat->append(tlbStat);
+}
+
+void TLBHierarchy::flush() {
+    l1.clear();
+    l2.clear();
+    walkCache.clear();
+    lastPage = 0;
+}
+
+Address TLBHierarchy::entryLine(uint32_t level, Address vpn) {
+    Address node = vpn >> (LEVEL_BITS*level);
+    Address index = (vpn >> (LEVEL_BITS*(level - 1))) & ((1 << LEVEL_BITS) - 1);
+    // Each table is one 4 KB page of 8-byte entries, 8 entries per line
+    Address vLineAddr = PT_LINES | ((Address)level << 40) | (node << 6) | (index >> 3);
+    return zinfo->pageAllocator? zinfo->pageAllocator->translate(procIdx, vLineAddr, coreId) : procMask | vLineAddr;
+}
@@ -0,0 +1,163 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TLB_H_
+#define TLB_H_
+
+#include "g_std/g_string.h"
+#include "galloc.h"
+#include "memory_hierarchy.h"
+#include "stats.h"
+
+class Config;
+
+/* Set-associative, LRU array of page numbers. Tags are never 0, callers add 1. */
+class TLBArray : public GlobAlloc {
+    private:
+        Address* tags;
+        uint64_t* lastUse;
+        uint32_t numSets;
+        uint32_t numWays;
+        uint64_t clock;
+
+    public:
+        TLBArray(uint32_t entries, uint32_t ways, const char* name);
+
+        inline bool lookup(Address tag) {
+            uint32_t first = (tag & (numSets - 1)) * numWays;
+            for (uint32_t i = first; i < first + numWays; i++) {
+                if (tags[i] == tag) {
+                    lastUse[i] = ++clock;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void insert(Address tag);
+        void clear();
+};
+
+/* Per-core data TLBs (sys.tlbs): an L1 TLB, a unified L2 TLB, and a page walk
+ * cache that holds non-leaf page table entries, so walks can skip the upper
+ * levels. Page tables are x86-64 radix trees: 4 levels for 4 KB pages, 3 for
+ * 2 MB pages. Walks read one entry per level, and each read is a physical line
+ * access that the caller sends through the cache hierarchy.
+ *
+ * This only models timing; the addresses the caches see still come from
+ * FilterCache (and the shared PageAllocator with sim.enableTLB). Page table
+ * pages live in a reserved virtual region and are backed like any other page.
+ */
+class TLBHierarchy : public GlobAlloc {
+    private:
+        static const uint32_t LEVEL_BITS = 9;  // 512 entries per page table page
+        static const uint32_t TOP_LEVEL = 4;
+        // Page table lines, above any user virtual line (48-bit addresses)
+        static const Address PT_LINES = 1ul << 45;
+
+        TLBArray l1;
+        TLBArray l2;
+        TLBArray walkCache;
+        Address lastPage;  // L1 hit filter, invalid if 0
+
+        g_string name;
+        uint32_t coreId;
+        uint32_t pageBits;
+        uint32_t leafLevel;  // 1 for 4 KB pages, 2 for 2 MB pages
+        uint32_t l2Lat;
+
+        Counter profL1Hits, profL2Hits, profWalks;
+        Counter profWalkCacheHits, profWalkReads, profWalkCycles;
+
+    public:
+        TLBHierarchy(Config& config, const g_string& _name, uint32_t _coreId);
+        void initStats(AggregateStat* parentStat);
+
+        // Drops all translations (address space changes)
+        void flush();
+
+        /* Returns the cycle at which vAddr is translated. On a miss in both
+         * TLBs, walks the page table, calling walkRead(pLineAddr, cycle) for
+         * each entry read; it must return the read's response cycle.
+         */
+        template <typename F>
+        inline uint64_t translate(Address vAddr, uint64_t cycle, F walkRead) {
+            Address page = (vAddr >> pageBits) + 1;
+            if (likely(page == lastPage)) {
+                profL1Hits.inc();
+                return cycle;
+            }
+            if (l1.lookup(page)) {
+                lastPage = page;
+                profL1Hits.inc();
+                return cycle;
+            }
+            return miss(page, cycle, walkRead);
+        }
+
+    private:
+        template <typename F>
+        uint64_t miss(Address page, uint64_t cycle, F walkRead) {
+            lastPage = page;
+            cycle += l2Lat;
+            if (l2.lookup(page)) {
+                l1.insert(page);
+                profL2Hits.inc();
+                return cycle;
+            }
+
+            // Start below the lowest level whose entry is cached
+            uint64_t startCycle = cycle;
+            Address vpn = (page - 1) << (pageBits - 12);  // 4 KB page number
+            uint32_t level = TOP_LEVEL;
+            for (uint32_t l = leafLevel + 1; l <= TOP_LEVEL; l++) {
+                if (walkCache.lookup(walkCacheTag(l, vpn))) {
+                    level = l - 1;
+                    profWalkCacheHits.inc();
+                    break;
+                }
+            }
+            for (; level >= leafLevel; level--) {
+                cycle = walkRead(entryLine(level, vpn), cycle);
+                profWalkReads.inc();
+                if (level > leafLevel) walkCache.insert(walkCacheTag(level, vpn));
+            }
+            l2.insert(page);
+            l1.insert(page);
+            profWalks.inc();
+            profWalkCycles.inc(cycle - startCycle);
+            return cycle;
+        }
+
+        // The entry at level covers 2^(9*(level-1)) 4 KB pages
+        static inline Address walkCacheTag(uint32_t level, Address vpn) {
+            return (((Address)level << 40) | (vpn >> (LEVEL_BITS*(level - 1)))) + 1;
+        }
+
+        // Physical line holding the level's entry for vpn
+        Address entryLine(uint32_t level, Address vpn);
+};
+
+#endif  // TLB_H_
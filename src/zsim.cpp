@@ -51,6 +51,8 @@
 #include "galloc.h"
 #include "init.h"
 #include "log.h"
+#include "mem_trace.h"
+#include "page_allocator.h"
 #include "pin.H"
 #include "pin_cmd.h"
 #include "process_tree.h"
@@ -243,13 +245,89 @@ VOID NOPBasicBlock(THREADID tid, ADDRINT bblAddr, BblInfo* bblInfo) {}
 VOID NOPRecordBranch(THREADID tid, ADDRINT addr, BOOL taken, ADDRINT takenNpc, ADDRINT notTakenNpc) {}
 VOID NOPPredLoadStoreSingle(THREADID tid, ADDRINT addr, BOOL pred) {}
 
+/* FF DRAM cache warmup (sys.mem.mcdram.ffWarmup): during FF, loads and stores
+ * go through a per-thread, direct-mapped functional filter that stands in for
+ * the cache hierarchy. Filter misses and dirty evictions are sent to the
+ * memory controllers as MemReq::WARMUP requests, which update their
+ * functional state only. Filters are process-local and never shared. They are
+ * indexed by virtual line, so pages are only translated (sim.enableTLB) on misses.
+ * A thread's filter lives from ThreadStart to ThreadFini; when the thread
+ * leaves fast-forward, its dirty lines are written back and it is emptied.
+ */
+struct FFWarmupLine {
+    Address vLineAddr;
+    Address lineAddr;  // physical
+    bool dirty;
+};
+
+static FFWarmupLine* ffWarmupFilters[MAX_THREADS];
+
+static void FFWarmupClear(FFWarmupLine* filter) {
+    for (uint32_t i = 0; i < zinfo->ffWarmupFilterLines; i++) filter[i] = {(Address)-1L, (Address)-1L, false};
+}
+
+static void FFWarmupStart(THREADID tid) {
+    if (!zinfo->ffWarmupMem) return;
+    assert(!ffWarmupFilters[tid]);
+    ffWarmupFilters[tid] = new FFWarmupLine[zinfo->ffWarmupFilterLines];
+    FFWarmupClear(ffWarmupFilters[tid]);
+}
+
+// Writes back the dirty lines and empties the filter
+static void FFWarmupFlush(THREADID tid) {
+    FFWarmupLine* filter = ffWarmupFilters[tid];
+    if (!filter) return;
+    MESIState state = I;
+    for (uint32_t i = 0; i < zinfo->ffWarmupFilterLines; i++) {
+        if (filter[i].lineAddr != (Address)-1L && filter[i].dirty) {
+            MemReq wbReq = {filter[i].lineAddr, PUTX, 0, &state, 0, nullptr, I, 0, MemReq::WARMUP};
+            zinfo->ffWarmupMem->access(wbReq);
+        }
+    }
+    FFWarmupClear(filter);
+}
+
+static void FFWarmupFini(THREADID tid) {
+    FFWarmupFlush(tid);
+    delete[] ffWarmupFilters[tid];
+    ffWarmupFilters[tid] = nullptr;
+}
+
+static void FFWarmupAccess(THREADID tid, ADDRINT addr, bool isStore) {
+    FFWarmupLine* filter = ffWarmupFilters[tid];
+    Address vLineAddr = addr >> lineBits;
+    FFWarmupLine& line = filter[vLineAddr & (zinfo->ffWarmupFilterLines - 1)];
+    if (line.vLineAddr == vLineAddr) {
+        line.dirty |= isStore;
+        return;
+    }
+
+    MESIState state = I;
+    if (line.lineAddr != (Address)-1L && line.dirty) {
+        MemReq wbReq = {line.lineAddr, PUTX, 0, &state, 0, nullptr, I, 0, MemReq::WARMUP};
+        zinfo->ffWarmupMem->access(wbReq);
+    }
+    Address lineAddr = zinfo->pageAllocator? zinfo->pageAllocator->translate(procIdx, vLineAddr, -1) : procMask | vLineAddr;
+    MemReq req = {lineAddr, isStore? GETX : GETS, 0, &state, 0, nullptr, I, 0, MemReq::WARMUP};
+    zinfo->ffWarmupMem->access(req);
+    line.vLineAddr = vLineAddr;
+    line.lineAddr = lineAddr;
+    line.dirty = isStore;
+}
+
 // FF is basically NOP except for basic blocks
 VOID FFBasicBlock(THREADID tid, ADDRINT bblAddr, BblInfo* bblInfo) {
     if (unlikely(!procTreeNode->isInFastForward())) {
+        FFWarmupFlush(tid);
         SimThreadStart(tid);
     }
 }
 
+VOID FFWarmupLoadSingle(THREADID tid, ADDRINT addr) { FFWarmupAccess(tid, addr, false); }
+VOID FFWarmupStoreSingle(THREADID tid, ADDRINT addr) { FFWarmupAccess(tid, addr, true); }
+VOID FFWarmupPredLoadSingle(THREADID tid, ADDRINT addr, BOOL pred) { if (pred) FFWarmupAccess(tid, addr, false); }
+VOID FFWarmupPredStoreSingle(THREADID tid, ADDRINT addr, BOOL pred) { if (pred) FFWarmupAccess(tid, addr, true); }
+
 // FFI is instruction-based fast-forwarding
 /* FFI works as follows: when in fast-forward, we install a special FF BBL func
  * ptr that counts instructions and checks whether we have reached the switch
@@ -309,6 +387,7 @@ VOID FFIInit() {
     const g_vector<uint64_t>& ffiPoints = procTreeNode->getFFIPoints();
     if (!ffiPoints.empty()) {
         if (zinfo->ffReinstrument) panic("FFI and reinstrumenting on FF switches are incompatible");
+        if (zinfo->ffWarmupMem) warn("FFI processes do not warm up the DRAM cache during fast-forward");
         ffiEnabled = true;
         ffiPoint = 0;
         ffiInstrsDone = 0;
@@ -367,12 +446,14 @@ static const InstrFuncPtrs joinPtrs = {JoinAndLoadSingle, JoinAndStoreSingle, Jo
 static const InstrFuncPtrs nopPtrs = {NOPLoadStoreSingle, NOPLoadStoreSingle, NOPBasicBlock, NOPRecordBranch, NOPPredLoadStoreSingle, NOPPredLoadStoreSingle, FPTR_NOP};
 static const InstrFuncPtrs retryPtrs = {NOPLoadStoreSingle, NOPLoadStoreSingle, NOPBasicBlock, NOPRecordBranch, NOPPredLoadStoreSingle, NOPPredLoadStoreSingle, FPTR_RETRY};
 static const InstrFuncPtrs ffPtrs = {NOPLoadStoreSingle, NOPLoadStoreSingle, FFBasicBlock, NOPRecordBranch, NOPPredLoadStoreSingle, NOPPredLoadStoreSingle, FPTR_NOP};
+static const InstrFuncPtrs ffWarmupPtrs = {FFWarmupLoadSingle, FFWarmupStoreSingle, FFBasicBlock, NOPRecordBranch, FFWarmupPredLoadSingle, FFWarmupPredStoreSingle, FPTR_NOP};
 
 static const InstrFuncPtrs ffiPtrs = {NOPLoadStoreSingle, NOPLoadStoreSingle, FFIBasicBlock, NOPRecordBranch, NOPPredLoadStoreSingle, NOPPredLoadStoreSingle, FPTR_NOP};
 static const InstrFuncPtrs ffiEntryPtrs = {NOPLoadStoreSingle, NOPLoadStoreSingle, FFIEntryBasicBlock, NOPRecordBranch, NOPPredLoadStoreSingle, NOPPredLoadStoreSingle, FPTR_NOP};
 
 static const InstrFuncPtrs& GetFFPtrs() {
-    return ffiEnabled? (ffiNFF? ffiEntryPtrs : ffiPtrs) : ffPtrs;
+    if (ffiEnabled) return ffiNFF? ffiEntryPtrs : ffiPtrs;
+    return zinfo->ffWarmupMem? ffWarmupPtrs : ffPtrs;
 }
 
 //Fast-forwarding
@@ -868,6 +949,7 @@ VOID ThreadStart(THREADID tid, CONTEXT *ctxt, INT32 flags, VOID *v) {
         info("Unpaused");
     }
 
+    FFWarmupStart(tid);
     if (procTreeNode->isInFastForward()) {
         info("FF thread %d starting", tid);
         fPtrs[tid] = GetFFPtrs();
@@ -889,6 +971,7 @@ VOID SimThreadFini(THREADID tid) {
 
 VOID ThreadFini(THREADID tid, const CONTEXT *ctxt, INT32 flags, VOID *v) {
     //NOTE: Thread has no valid cid here!
+    FFWarmupFini(tid);
     if (fPtrs[tid].type == FPTR_NOP) {
         info("Shadow/NOP thread %d finished", tid);
         return;
@@ -1128,6 +1211,7 @@ VOID SimEnd() {
         zinfo->trigger = 20000;
         for (StatsBackend* backend : *(zinfo->statsBackends)) backend->dump(false /*unbuffered, write out*/);
         for (AccessTraceWriter* t : *(zinfo->traceWriters)) t->dump(false);  // flushes trace writer
+        if (zinfo->memTraceWriter) zinfo->memTraceWriter->finish();
 
         if (zinfo->sched) zinfo->sched->notifyTermination();
     }
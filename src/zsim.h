@@ -47,6 +47,9 @@ class PinCmd;
 class PortVirtualizer;
 class VectorCounter;
 class AccessTraceWriter;
+class MemTraceWriter;
+class MemObject;
+class PageAllocator;
 class TraceDriver;
 template <typename T> class g_vector;
 
@@ -178,6 +181,18 @@ struct GlobSimInfo {
     // Trace writers (stored globally because they need to be deleted when the simulation ends)
     g_vector<AccessTraceWriter*>* traceWriters;
 
+    // DRAM cache controller trace (sys.mem.enableTrace), nullptr if disabled
+    MemTraceWriter* memTraceWriter;
+
+    // DRAM cache warmup (see MemoryController)
+    volatile bool dcWarmupInstrsDone; //set once the aggregate instructions reach sys.mem.mcdram.warmupInstrs
+    MemObject* ffWarmupMem; //memory controllers fed during fast-forward (sys.mem.mcdram.ffWarmup), nullptr if disabled
+    uint32_t ffWarmupFilterLines; //per-thread functional filter in front of ffWarmupMem
+    volatile uint64_t tlbShootdownCycles; //total stall of all TLB shootdowns (sys.mem.mcdram.tb_flush_stall); every core takes each one on its next bbl
+
+    // Virtual-to-physical page allocator shared by all L1s (sim.enableTLB), nullptr if disabled
+    PageAllocator* pageAllocator;
+
     // Trace-driven simulation (no cores)
     bool traceDriven;
     TraceDriver* traceDriver;